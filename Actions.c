@@ -11,8 +11,23 @@
 #include "Actions.h"
 #include "Common.h"
 #include "Controller.h"
+#include "CRC.h"
 #include "Definitions.h"
 #include "Externs.h"
+#include "FileMap.h"
+#include "Input.h"
+#include "InputMovie.h"
+#include "InputSampler.h"
+#include "MemPak.h"
+#include "PIFIdle.h"
+#include "PIFStats.h"
+#include "PIFTrace.h"
+#include "PIFWorker.h"
+#include "SaveArchive.h"
+#include "SaveFlusher.h"
+#include "SICapture.h"
+#include "SITiming.h"
+#include "Thread.h"
 
 #ifdef __cplusplus
 #include <cassert>
@@ -24,81 +39,49 @@
 #include <string.h>
 #endif
 
-#ifdef GLFW3
-#include <GLFW/glfw3.h>
-#else
-#include <GL/glfw.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
-/* ============================================================================
- *  CalculateMemPakCRC: Calculates the CRC of MemPak data.
- *  TODO: Ripped straight from MAME/MESS; look into it.
- * ========================================================================= */
-static uint8_t
-CalculateMemPakCRC(uint8_t *buffer, int size) {
-  uint32_t crc = 0;
-  int i, j;
-
-  for (i = 0; i <= size; i++) {
-    for (j = 7; j >= 0; j--) {
-      uint32_t temp = ((crc & 0x80) != 0) ? 0x85 : 0x00;
-
-      crc <<= 1;
-
-      if (i == size)
-        crc &= 0xFF;
-
-      else {
-        if ((buffer[i] & (1 << j)) != 0)
-          crc |= 0x1;
-      }
-
-      crc ^= temp;
-    }
-  }
-
-  return crc;
-}
+static void ReadControllerInput(struct PIFController *, unsigned, uint8_t *);
 
 /* ============================================================================
  *  PIFHandleCommand: Perform action specified by the PIF RAM.
  *  TODO: Ripped straight from MAME/MESS; look into it.
+ *
+ *  recvBuffer points straight into PIF RAM, so it must only be written
+ *  once the command is known to succeed (i.e., return 0), and never past
+ *  recvBytes: commands whose sizes differ from what they send and return
+ *  are refused, rather than spilling into the next command's bytes.
  * ========================================================================= */
 static int
 PIFHandleCommand(struct PIFController *controller, unsigned channel,
-  uint8_t *sendBuffer, uint8_t sendBytes, uint8_t *recvBuffer,
+  const uint8_t *sendBuffer, uint8_t sendBytes, uint8_t *recvBuffer,
   uint8_t recvBytes) {
   uint8_t command = sendBuffer[0];
   uint16_t address, offset;
+  uint8_t *block;
 
-#ifdef GLFW3
-  int count;
-  const unsigned char *buttons;
-  const float *joystick;
-#else
-  unsigned char buttons[17];
-  float joystick[5];
-  uint32_t joystickint[5];
-#endif /*GLFW3*/
-  int8_t axes[2];
-  uint8_t shift;
-  
   switch(command) {
   case 0x00:
   case 0xFF:
-    debug("Command: Read PIF status/reset?");
+    if (recvBytes != 3) {
+      debug("PIF | Unusual status recv size?");
+      return 1;
+    }
 
     switch(channel) {
     case 0:
-      recvBuffer[0] = 0x05;
-      recvBuffer[1] = 0x00;
-      recvBuffer[2] = 0x01;
-      break;
-
     case 1:
     case 2:
     case 3:
-      return 1;
+      controller->channelStats[channel].statusPolls++;
+
+      if (!controller->channels[channel].connected)
+        return 1;
+
+      memcpy(recvBuffer, controller->channels[channel].status, 3);
+      break;
 
     case 4:
       recvBuffer[0] = 0x00;
@@ -114,220 +97,27 @@ PIFHandleCommand(struct PIFController *controller, unsigned channel,
     break;
 
   case 0x01:
+    if (recvBytes != 4) {
+      debug("PIF | Unusual controller read recv size?");
+      return 1;
+    }
+
     switch(channel) {
     case 0:
-      debug("Read from controller.");
-      memset(recvBuffer, 0, 4);
-
-      switch(controller->input) {
-      case KEYBOARD:
-        /* Check for joystick input. */
-        /* L/R shift for less intensity. */
-        shift = (glfwGetKey(GLFW_KEY_LSHIFT)
-          | glfwGetKey(GLFW_KEY_RSHIFT) ? 38 : 114);
-
-        recvBuffer[2] = glfwGetKey(GLFW_KEY_RIGHT)
-          ? shift : glfwGetKey(GLFW_KEY_LEFT) * -shift;
-
-        recvBuffer[3] = glfwGetKey(GLFW_KEY_UP)
-          ? shift : glfwGetKey(GLFW_KEY_DOWN) * -shift;
-
-        /* Check for C buttons */
-        recvBuffer[1] |= glfwGetKey(GLFW_KEY_HOME) << 3; /* C Up */
-        recvBuffer[1] |= glfwGetKey(GLFW_KEY_END) << 2; /* C Down */
-        recvBuffer[1] |= glfwGetKey(GLFW_KEY_DEL) << 1; /* C Left */
-        recvBuffer[1] |= glfwGetKey(GLFW_KEY_PAGEDOWN) << 0; /* C Right */
-
-        /* Check for L/R flippers. */
-        recvBuffer[1] |= glfwGetKey('A') << 5;
-        recvBuffer[1] |= glfwGetKey('S') << 4;
-
-        /* Check for A, Z, and B buttons. */
-        recvBuffer[0] |= glfwGetKey('X') << 7;
-        recvBuffer[0] |= glfwGetKey('C') << 6;
-        recvBuffer[0] |= glfwGetKey('Z') << 5;
-        recvBuffer[0] |= glfwGetKey(GLFW_KEY_ENTER) << 4;
-
-        /* Check for the D-Pad buttons. */
-        recvBuffer[0] |= glfwGetKey(GLFW_KEY_KP_8) << 3; /* D Up */
-        recvBuffer[0] |= glfwGetKey(GLFW_KEY_KP_2) << 2; /* D Down */
-        recvBuffer[0] |= glfwGetKey(GLFW_KEY_KP_4) << 1; /* D Left */
-        recvBuffer[0] |= glfwGetKey(GLFW_KEY_KP_6) << 0; /* D Right */
-        break;
-
-      case RETROLINK:
-        /* Read the x and y axes of the controller. */
-        glfwGetJoystickPos(channel, joystick, 2);
-        glfwGetJoystickButtons(channel, buttons, 12);
-
-        axes[0] = joystick[0] * 127;
-        axes[1] = joystick[1] * 127;
-        recvBuffer[2] = axes[0];
-        recvBuffer[3] = axes[1];
-
-        /* Check for joystick input. */
-        recvBuffer[0] = 0;
-
-        /* Check for C buttons. */
-        recvBuffer[1] |= buttons[0] << 3;
-        recvBuffer[1] |= buttons[1] << 0;
-        recvBuffer[1] |= buttons[2] << 2;
-        recvBuffer[1] |= buttons[3] << 1;
-
-        /* Check for L/R flippers. */
-        recvBuffer[1] |= buttons[4] << 5;
-        recvBuffer[1] |= buttons[5] << 4;
-
-        /* Check for A, Z, and B buttons. */
-        recvBuffer[0] |= buttons[6] << 7;
-        recvBuffer[0] |= buttons[7] << 5;
-        recvBuffer[0] |= buttons[8] << 6;
-
-        /* Check for the start button. */
-        recvBuffer[0] |= buttons[9] << 4;
-
-        /* Check for D-Pad buttons. */
-        /* TODO: Cannot read from Linux? */
-        break;
+    case 1:
+    case 2:
+    case 3:
+      controller->channelStats[channel].polls++;
 
-      case MAYFLASH_N64:
-        /* Read the x and y axes of the controller. */
-        glfwGetJoystickPos(channel, joystick, 4);
-        glfwGetJoystickButtons(channel, buttons, 16);
-
-        axes[0] = joystick[0] * 127;
-        axes[1] = joystick[1] * 127;
-        recvBuffer[2] = axes[0];
-        recvBuffer[3] = axes[1];
-
-        /* Check for joystick input. */
-        recvBuffer[0] = 0;
-
-        /* Check for C buttons. */
-        memcpy(joystickint, joystick, 16);
-        if(0x3F4103C2 == joystickint[2]) recvBuffer[1] |= BUTTON_C_DOWN;
-        else if(0xBF3FFFC0 == joystickint[2]) recvBuffer[1] |= BUTTON_C_UP;
-        if(0x3F4103C2 == joystickint[3]) recvBuffer[1] |= BUTTON_C_LEFT;
-        else if(0xBF3FFFC0 == joystickint[3]) recvBuffer[1] |= BUTTON_C_RIGHT;
-
-        /* Check for L/R flippers. */
-        recvBuffer[1] |= buttons[6] << 5;
-        recvBuffer[1] |= buttons[7] << 4;
-
-        /* Check for A, B, Z, and Start buttons. */
-        recvBuffer[0] |= buttons[1] << 7; /* A */
-        recvBuffer[0] |= buttons[2] << 6; /* B */
-        recvBuffer[0] |= buttons[8] << 5; /* Z */
-        recvBuffer[0] |= buttons[9] << 4; /* S */
-
-        /* Check for the D-Pad buttons. */
-        recvBuffer[0] |= buttons[12] << 3; /* D Up */
-        recvBuffer[0] |= buttons[14] << 2; /* D Down */
-        recvBuffer[0] |= buttons[15] << 1; /* D Left */
-        recvBuffer[0] |= buttons[13] << 0; /* D Right */
-        break;
+      if (!controller->channels[channel].connected)
+        return 1;
 
-      case WIIU:
-        /* joystick[0] = left joystick X, left=-1.000 - right=+1.000 */
-        /* joystick[1] = left joystick Y, down=-1.000 - up   =+1.000 *(uint*) */
-        /* joystick[3] = right joystick Y, up =-1.000 - down =+1.000 */
-        /* joystick[4] = right joystick X,left=-1.000 - right=+1.000 *(uint*) */
-        /* button 0 = B, 1 = A, 2 = X, 3 = Y, 4 = L, 5 = R, 6 = ZL, 7 = ZR */
-        /*        8 = BACK, 9 = START, 10 = HOME, 11 = LEFT ANALOG CLICK */
-        /*        12 = RIGHT ANALOG CLICK, 13 = D-UP, 14 = D-DOWN, 15 = D-LEFT */
-        /*        16 = D-RIGHT */
-
-        /* Read the x and y axes of the controller. */
-        glfwGetJoystickPos(channel, joystick, 4);
-        glfwGetJoystickButtons(channel, buttons, 17);
-
-        axes[0] = joystick[0] * 127;
-        axes[1] = joystick[1] * 127;
-        recvBuffer[2] = axes[0];
-        recvBuffer[3] = axes[1];
-
-        /* Check for joystick input. */
-        recvBuffer[0] = 0;
-        recvBuffer[1] = 0;
-
-        /* Check for C buttons. */
-        if(joystick[3] < -.75F) recvBuffer[1] |= BUTTON_C_DOWN;
-        else if(joystick[3] > .75F) recvBuffer[1] |= BUTTON_C_UP;
-        if(joystick[2] < -.75F) recvBuffer[1] |= BUTTON_C_LEFT;
-        else if(joystick[2] > .75F) recvBuffer[1] |= BUTTON_C_RIGHT;
-
-        /* Check for L/R flippers. */
-        recvBuffer[1] |= buttons[6] << 5; /* L */
-        recvBuffer[1] |= buttons[5] << 4; /* R */
-
-        /* Check for A, B, Z, and Start buttons. */
-        recvBuffer[0] |= buttons[1] << 7; /* A */
-        recvBuffer[0] |= buttons[0] << 6; /* B */
-        recvBuffer[0] |= buttons[4] << 5; /* Z */
-        recvBuffer[0] |= buttons[9] << 4; /* S */
-
-        /* Check for the D-Pad buttons. */
-        recvBuffer[0] |= buttons[13] << 3; /* D Up */
-        recvBuffer[0] |= buttons[14] << 2; /* D Down */
-        recvBuffer[0] |= buttons[15] << 1; /* D Left */
-        recvBuffer[0] |= buttons[16] << 0; /* D Right */
-        break;
+      if (!(controller->activeChannels & (1 << channel)))
+        AddPIFAtomic(&controller->activeChannels, 1 << channel);
 
-      case XBOX360:
-        /* joystick[0] = left joystick X, left=-1.000 - right=+1.000 */
-        /* joystick[1] = left joystick Y, down=-1.000 - up   =+1.000 *(uint*) */
-        /* joystick[3] = right joystick Y, up =-1.000 - down =+1.000 */
-        /* joystick[4] = right joystick X,left=-1.000 - right=+1.000 *(uint*) */
-        /* button 0 = A, 1 = B, 2 = X, 3 = Y, 4 = L, 5 = R, 6 = BACK, */
-        /*        7 = START, 8 = LEFT ANALOG CLICK, 9 = RIGHT ANALOG CLICK */
-
-        /* Read the x and y axes of the controller. */
-        glfwGetJoystickPos(channel, joystick, 5);
-        glfwGetJoystickButtons(channel, buttons, 10);
-
-        axes[0] = joystick[0] * 127;
-        axes[1] = joystick[1] * 127;
-        recvBuffer[2] = axes[0];
-        recvBuffer[3] = axes[1];
-
-        /* Check for joystick input. */
-        recvBuffer[0] = 0;
-        recvBuffer[1] = 0;
-
-        /* Check for C buttons. */
-        if(joystick[3] > .75F) recvBuffer[1] |= BUTTON_C_DOWN;
-        else if(joystick[3] < -.75F) recvBuffer[1] |= BUTTON_C_UP;
-        if(joystick[4] < -.75F) recvBuffer[1] |= BUTTON_C_LEFT;
-        else if(joystick[4] > .75F) recvBuffer[1] |= BUTTON_C_RIGHT;
-
-        /* Check for L/R flippers. */
-        recvBuffer[1] |= buttons[4] << 5; /* L */
-        recvBuffer[1] |= (joystick[2] < -.75F) ? (1 << 4) : 0; /* R */
-
-        /* Check for A, B, Z, and Start buttons. */
-        recvBuffer[0] |= buttons[0] << 7; /* A */
-        recvBuffer[0] |= buttons[1] << 6; /* B */
-        recvBuffer[0] |= (joystick[2] > .75F) ? (1 << 5) : 0; /* Z */
-        recvBuffer[0] |= buttons[7] << 4; /* S */
-
-        /* Check for the D-Pad buttons. */
-        /* TODO: Cannot read values from GLFW? */
-#if 0
-        recvBuffer[0] |= buttons[12] << 3; /* D Up */
-        recvBuffer[0] |= buttons[14] << 2; /* D Down */
-        recvBuffer[0] |= buttons[15] << 1; /* D Left */
-        recvBuffer[0] |= buttons[13] << 0; /* D Right */
-#endif
-      default:
-        break;
-      }
+      ReadControllerInput(controller, channel, recvBuffer);
       return 0;
 
-    case 1:
-    case 2:
-    case 3:
-      return 1;
-
     default:
       debug("Read from invalid controller?");
       return 1;
@@ -336,69 +126,99 @@ PIFHandleCommand(struct PIFController *controller, unsigned channel,
     break;
 
   case 0x02:
-    debug("MemPak | Command: Read from MemPak.");
-    memcpy(&address, sendBuffer + 1, sizeof(address));
-    address = ByteOrderSwap16(address) & ~0x1F;
-
-    if (address == 0x8000) {
-      memset(recvBuffer, 0, recvBytes - 1);
-      recvBuffer[recvBytes - 1] = CalculateMemPakCRC(
-        recvBuffer, recvBytes - 1);
+    if (channel >= MEMPAK_NUM_CHANNELS ||
+      !controller->channels[channel].connected ||
+      controller->channels[channel].accessory != PIF_ACCESSORY_MEMPAK)
+      return 1;
 
-      break;
+    if (sendBytes != 3 || recvBytes != MEMPAK_BLOCK_SIZE + 1) {
+      debug("MemPak | Unusual send/recv sizes?");
+      return 1;
     }
 
-    else if (address < 0x7FE0) {
-      memset(recvBuffer, 0, recvBytes - 1);
-      recvBuffer[recvBytes - 1] = CalculateMemPakCRC(
-        recvBuffer, recvBytes - 1);
+    memcpy(&address, sendBuffer + 1, sizeof(address));
+    address = ByteOrderSwap16(address);
 
-      break;
+    if ((block = MemPakBlock(controller->paks + channel, address)) != NULL) {
+      memcpy(recvBuffer, block, MEMPAK_BLOCK_SIZE);
+      recvBuffer[MEMPAK_BLOCK_SIZE] = MemPakCRC(block, MEMPAK_BLOCK_SIZE);
     }
 
-    return 1;
+    /* Unbacked paks and the accessory region read back as zeros. */
+    else {
+      memset(recvBuffer, 0, MEMPAK_BLOCK_SIZE);
+      recvBuffer[MEMPAK_BLOCK_SIZE] = MEMPAK_ZERO_BLOCK_CRC;
+    }
+
+    break;
 
   case 0x03:
-    debug("MemPak | Command: Write to MemPak.");
+    if (channel >= MEMPAK_NUM_CHANNELS ||
+      !controller->channels[channel].connected ||
+      controller->channels[channel].accessory != PIF_ACCESSORY_MEMPAK)
+      return 1;
+
+    if (sendBytes != MEMPAK_BLOCK_SIZE + 3 || recvBytes != 1) {
+      debug("MemPak | Unusual send/recv sizes?");
+      return 1;
+    }
+
     memcpy(&address, sendBuffer + 1, sizeof(address));
-    address = ByteOrderSwap16(address) & ~0x1F;
+    address = ByteOrderSwap16(address);
+
+    if (unlikely(controller->archiveShared &
+      (1 << SAVE_MEDIA_PAK(channel))) &&
+      UnshareSaveArchiveMedia(controller, SAVE_MEDIA_PAK(channel)))
+      return 1;
 
-#if 0
-    if (address < 0x8000) {
-      /* ... */
+    if ((block = MemPakBlock(controller->paks + channel, address)) != NULL) {
+      memcpy(block, sendBuffer + 3, MEMPAK_BLOCK_SIZE);
+
+      if (controller->paks[channel].image) {
+        UpdateSaveImage(controller->paks[channel].image,
+          block - controller->paks[channel].data,
+          block, MEMPAK_BLOCK_SIZE);
+      }
     }
-#endif
 
-    debugarg("MemPak | Destination: [0x%.4X].", address);
-    recvBuffer[0] = CalculateMemPakCRC(sendBuffer + 3, sendBytes - 3);
+    recvBuffer[0] = MemPakCRC(sendBuffer + 3, MEMPAK_BLOCK_SIZE);
     break;
 
   case 0x04:
-    debug("EEPROM | Command: Read from EEPROM.");
-
     if (channel != 4)
       return 1;
 
-    if (sendBytes != 2 || recvBytes != 8) {
+    if (sendBytes != 2 || recvBytes != EEPROM_BLOCK_SIZE) {
       debug("EEPROM | Unusual send/recv sizes?");
+      return 1;
     }
 
-    offset = sendBuffer[1] * 8;
-    memcpy(recvBuffer, controller->eeprom + offset, 8);
+    offset = sendBuffer[1] * EEPROM_BLOCK_SIZE;
+    memcpy(recvBuffer, controller->eeprom + offset, EEPROM_BLOCK_SIZE);
     break;
 
   case 0x05:
-    debug("EEPROM | Command: Write to EEPROM.");
-
     if (channel != 4)
       return 1;
 
-    if (sendBytes != 10 || recvBytes != 1) {
+    if (sendBytes != EEPROM_BLOCK_SIZE + 2 || recvBytes != 1) {
       debug("EEPROM | Unusual send/recv sizes?");
+      return 1;
     }
 
-    offset = sendBuffer[1] * 8;
-    memcpy(controller->eeprom + offset, sendBuffer + 2, 8);
+    if (unlikely(controller->archiveShared & (1 << SAVE_MEDIA_EEPROM)) &&
+      UnshareSaveArchiveMedia(controller, SAVE_MEDIA_EEPROM))
+      return 1;
+
+    offset = sendBuffer[1] * EEPROM_BLOCK_SIZE;
+    memcpy(controller->eeprom + offset, sendBuffer + 2, EEPROM_BLOCK_SIZE);
+    controller->eepromDirty[sendBuffer[1] >> 6] |=
+      (uint64_t) 1 << (sendBuffer[1] & 0x3F);
+
+    if (controller->eepromImage) {
+      UpdateSaveImage(controller->eepromImage, offset,
+        sendBuffer + 2, EEPROM_BLOCK_SIZE);
+    }
     break;
 
   default:
@@ -410,23 +230,79 @@ PIFHandleCommand(struct PIFController *controller, unsigned channel,
   return 0;
 }
 
-static void PIFProcess(struct PIFController *);
+static bool CompareCommandBlocks(const uint8_t *, const uint8_t *);
+static uint64_t HashCommandBlock(const uint8_t *);
+static void PIFInterpret(struct PIFController *, unsigned, unsigned,
+  struct PIFCommandBlock *);
 
 /* ============================================================================
- *  PIFProcess: Perform action specified by the PIF RAM.
- *  TODO: Ripped straight from MAME/MESS; look into it.
+ *  CompareCommandBlocks: Returns true if two 64-byte blocks are equal.
  * ========================================================================= */
-static void
-PIFProcess(struct PIFController *controller) {
-  unsigned channel = 0;
-  int ptr = 0;
+static bool
+CompareCommandBlocks(const uint8_t *a, const uint8_t *b) {
+#ifdef __SSE2__
+  __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + 0x00)),
+    _mm_loadu_si128((const __m128i *) (b + 0x00)));
+  __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + 0x10)),
+    _mm_loadu_si128((const __m128i *) (b + 0x10)));
+  __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + 0x20)),
+    _mm_loadu_si128((const __m128i *) (b + 0x20)));
+  __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + 0x30)),
+    _mm_loadu_si128((const __m128i *) (b + 0x30)));
+
+  return _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(eq0, eq1),
+    _mm_and_si128(eq2, eq3))) == 0xFFFF;
+#else
+  uint64_t diff = 0;
+  unsigned i;
 
-  if (controller->command[0x3F] != 0x1)
-    return;
+  for (i = 0; i < PIF_RAM_ADDRESS_LEN; i += 8) {
+    uint64_t wordA, wordB;
+
+    memcpy(&wordA, a + i, sizeof(wordA));
+    memcpy(&wordB, b + i, sizeof(wordB));
+    diff |= wordA ^ wordB;
+  }
+
+  return diff == 0;
+#endif
+}
+
+/* ============================================================================
+ *  HashCommandBlock: Hashes a 64-byte joybus command block.
+ * ========================================================================= */
+static uint64_t
+HashCommandBlock(const uint8_t *block) {
+  uint64_t hash = 0;
+  unsigned i;
+
+  for (i = 0; i < PIF_RAM_ADDRESS_LEN; i += 8) {
+    uint64_t word;
+
+    memcpy(&word, block + i, sizeof(word));
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 32;
+  }
+
+  return hash;
+}
+
+/* ============================================================================
+ *  PIFInterpret: Walks the command block, starting from a given position.
+ *
+ *  Responses are written straight into PIF RAM. Where the layout of the
+ *  block depends on whether a command succeeded, the walk follows the
+ *  actual results; if an entry is given, each command executed (and its
+ *  result) is recorded into it so the walk can be replayed later.
+ * ========================================================================= */
+static void
+PIFInterpret(struct PIFController *controller, unsigned ptr,
+  unsigned channel, struct PIFCommandBlock *entry) {
+  const uint8_t *command = controller->command;
+  uint8_t *ram = controller->ram;
 
-  /* Logic ripped from MAME. */
   while (ptr < 0x3F) {
-    int8_t sendBytes = controller->command[ptr++];
+    int8_t sendBytes = command[ptr++];
 
     if (sendBytes == -2)
       break;
@@ -435,90 +311,312 @@ PIFProcess(struct PIFController *controller) {
       continue;
 
     if (sendBytes > 0 && (sendBytes & 0xC0) == 0) {
-      int8_t recvBytes = controller->command[ptr++];
-      uint8_t recvBuffer[0x40];
-      uint8_t sendBuffer[0x40];
+      int8_t recvBytes = command[ptr++];
+      unsigned recvCount = recvBytes & 0x3F;
+      unsigned sendOffset = ptr;
+      enum PIFStatsCounter counter;
+      uint64_t start;
       int result;
 
       if (recvBytes == -2)
         break;
 
-      memcpy(sendBuffer, controller->command + ptr, sendBytes);
+      /* Blocks that run off the end of PIF RAM are malformed. */
+      if (sendOffset + sendBytes + recvCount > PIF_RAM_ADDRESS_LEN)
+        break;
+
       ptr += sendBytes;
 
+      counter = PIFStatsCommand(command[sendOffset]);
+      start = BeginPIFStats(controller, counter);
       result = PIFHandleCommand(controller, channel,
-        sendBuffer, sendBytes, recvBuffer, recvBytes);
+        command + sendOffset, sendBytes, ram + ptr, recvCount);
+      EndPIFStats(controller, counter, start);
+
+      if (unlikely(controller->timing != NULL)) {
+        CostSICommand(controller->timing, channel, sendBytes,
+          recvCount, result);
+      }
+
+      TracePIF(controller, PIF_TRACE_JOYBUS, PIF_TRACE_COMMAND, 0, channel,
+        command[sendOffset] | sendBytes << 8 | recvCount << 16 |
+        (result != 0) << 24);
 
-      if (result == 0) {
-        memcpy(controller->ram + ptr, recvBuffer, recvBytes);
-        ptr += recvBytes;
+      if (entry) {
+        struct PIFCommandOp *op = entry->ops + entry->numOps++;
+
+        op->channel = channel;
+        op->sendOffset = sendOffset;
+        op->sendBytes = sendBytes;
+        op->recvOffset = ptr;
+        op->recvBytes = recvCount;
+        op->result = result;
       }
 
+      if (result == 0)
+        ptr += recvCount;
+
       else
-        controller->ram[ptr - 2] |= 0x80;
+        ram[ptr - 2] |= 0x80;
     }
 
     channel++;
   }
+}
 
-  controller->ram[0x3F] = 0;
+/* ============================================================================
+ *  PIFProcess: Perform action specified by the PIF RAM.
+ *
+ *  Games tend to send the same command block over and over, so blocks are
+ *  compiled (by interpreting them once) into a list of commands with
+ *  fixed offsets into PIF RAM, and cached. Should a command's result ever
+ *  differ from the compiled one, the rest of the block is interpreted and
+ *  the stale entry is dropped.
+ * ========================================================================= */
+void
+PIFProcess(struct PIFController *controller) {
+  const uint8_t *command = controller->command;
+  struct PIFResponseMemo *memo = &controller->memo;
+  uint32_t generation[PIF_NUM_CONTROLLERS];
+  struct PIFCommandBlock *entry;
+  uint8_t *ram = controller->ram;
+  uint64_t hash;
+  unsigned i;
+
+  if (command[0x3F] != 0x1)
+    return;
+
+  /* Same block, same inputs and same PIF RAM: same response. */
+  if (controller->memoizeResponses) {
+    for (i = 0; i < PIF_NUM_CONTROLLERS; i++)
+      generation[i] = LoadPIFAtomic(controller->inputGeneration + i);
+  }
+
+  if (controller->memoizeResponses && memo->valid &&
+    !controller->ramWritten && CompareCommandBlocks(memo->command, command)) {
+    for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+      if ((memo->polledChannels & (1 << i)) &&
+        memo->inputGeneration[i] != generation[i])
+        break;
+    }
+
+    if (i == PIF_NUM_CONTROLLERS) {
+      memcpy(ram, memo->response, sizeof(memo->response));
+      controller->memoHits++;
+
+      for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+        controller->channelStats[i].polls += (memo->polledChannels >> i) & 1;
+        controller->channelStats[i].statusPolls +=
+          (memo->statusChannels >> i) & 1;
+      }
+
+      /* Trace and count the commands the response stands for. */
+      for (i = 0; i < memo->numOps; i++) {
+        const struct PIFCommandOp *op = memo->ops + i;
+        uint8_t opcode = command[op->sendOffset];
+
+        EndPIFStats(controller, PIFStatsCommand(opcode), 0);
+        TracePIF(controller, PIF_TRACE_JOYBUS, PIF_TRACE_COMMAND, 0,
+          op->channel, opcode | op->sendBytes << 8 | op->recvBytes << 16 |
+          (op->result != 0) << 24);
+      }
+
+      /* The block processed last was this one, and costs the same. */
+      return;
+    }
+  }
+
+  if (unlikely(controller->timing != NULL))
+    ResetSICommandCycles(controller->timing);
+
+  hash = HashCommandBlock(command);
+  entry = controller->commandCache + (hash & (PIF_COMMAND_CACHE_SIZE - 1));
+
+  if (entry->valid && entry->hash == hash &&
+    !memcmp(entry->block, command, sizeof(entry->block))) {
+    controller->commandCacheHits++;
+
+    for (i = 0; i < entry->numOps; i++) {
+      const struct PIFCommandOp *op = entry->ops + i;
+      enum PIFStatsCounter counter = PIFStatsCommand(command[op->sendOffset]);
+      uint64_t start = BeginPIFStats(controller, counter);
+      int result = PIFHandleCommand(controller, op->channel,
+        command + op->sendOffset, op->sendBytes,
+        ram + op->recvOffset, op->recvBytes);
+
+      EndPIFStats(controller, counter, start);
+
+      if (unlikely(controller->timing != NULL)) {
+        CostSICommand(controller->timing, op->channel, op->sendBytes,
+          op->recvBytes, result);
+      }
+
+      TracePIF(controller, PIF_TRACE_JOYBUS, PIF_TRACE_COMMAND, 0,
+        op->channel, command[op->sendOffset] | op->sendBytes << 8 |
+        op->recvBytes << 16 | (result != 0) << 24);
+
+      if (result)
+        ram[op->recvOffset - 2] |= 0x80;
+
+      if (unlikely(result != op->result)) {
+        entry->valid = false;
+
+        PIFInterpret(controller, op->recvOffset +
+          (result ? 0 : op->recvBytes), op->channel + 1, NULL);
+        break;
+      }
+    }
+  }
+
+  else {
+    controller->commandCacheMisses++;
+
+    entry->valid = true;
+    entry->hash = hash;
+    entry->numOps = 0;
+    memcpy(entry->block, command, sizeof(entry->block));
+
+    PIFInterpret(controller, 0, 0, entry);
+
+    entry->polledChannels = 0;
+    entry->statusChannels = 0;
+    entry->writesMedia = false;
+
+    for (i = 0; i < entry->numOps; i++) {
+      const struct PIFCommandOp *op = entry->ops + i;
+      uint8_t opcode = op->sendBytes ? command[op->sendOffset] : 0xFF;
+
+      if (opcode == 0x01 && op->channel < PIF_NUM_CONTROLLERS)
+        entry->polledChannels |= 1 << op->channel;
+
+      else if ((opcode == 0x00 || opcode == 0xFF) &&
+        op->channel < PIF_NUM_CONTROLLERS)
+        entry->statusChannels |= 1 << op->channel;
+
+      else if (opcode == 0x03 || opcode == 0x05)
+        entry->writesMedia = true;
+    }
+  }
+
+  ram[0x3F] = 0;
+  controller->ramWritten = false;
+
+  /* Blocks that write save media may read back what they wrote. */
+  if (controller->memoizeResponses) {
+    memo->valid = entry->valid && !entry->writesMedia;
+
+    if (memo->valid) {
+      memcpy(memo->command, command, sizeof(memo->command));
+      memcpy(memo->response, ram, sizeof(memo->response));
+      memcpy(memo->inputGeneration, generation, sizeof(generation));
+      memcpy(memo->ops, entry->ops, entry->numOps * sizeof(*entry->ops));
+      memo->numOps = entry->numOps;
+      memo->polledChannels = entry->polledChannels;
+      memo->statusChannels = entry->statusChannels;
+    }
+  }
 }
 
 /* ============================================================================
- *  ReadEEPROMFile: Reads the contents EEPROM file into the controller.
+ *  GetPIFChannelStats: Reports how often the game has polled a port.
+ *
+ *  Reads (0x01) and status queries (0x00/0xFF) are counted whether or
+ *  not anything is connected, so this shows which ports a title uses.
  * ========================================================================= */
 int
-ReadEEPROMFile(struct PIFController *controller) {
-  size_t cur = 0;
-
-  if (!controller->eepromFile)
+GetPIFChannelStats(const struct PIFController *controller, unsigned channel,
+  struct PIFChannelStats *stats) {
+  if (channel >= PIF_NUM_CONTROLLERS)
     return -1;
 
-  rewind(controller->eepromFile);
+  *stats = controller->channelStats[channel];
+  stats->connected = controller->channels[channel].connected;
+  return 0;
+}
+
+/* ============================================================================
+ *  NotifyPIFInputChanged: Notes that a channel's input state has changed.
+ *
+ *  Only matters with response memoization enabled: input is then assumed
+ *  to stay the same until the host says otherwise, typically right after
+ *  it pumps its window system's events.
+ * ========================================================================= */
+void
+NotifyPIFInputChanged(struct PIFController *controller, unsigned channel) {
+  if (channel < PIF_NUM_CONTROLLERS)
+    AddPIFAtomic(&controller->inputGeneration[channel], 1);
+}
+
+/* ============================================================================
+ *  ReadEEPROMFile: Attaches the mapped EEPROM file to the controller.
+ * ========================================================================= */
+int
+ReadEEPROMFile(struct PIFController *controller) {
+  struct FileMap *map = &controller->eepromFile;
 
-  while (cur < sizeof(controller->eeprom)) {
-    size_t remaining = sizeof(controller->eeprom) - cur;
-    size_t ret;
+  if (!map->base)
+    return -1;
 
-    if ((ret = fread(controller->eeprom + cur, 1,
-      remaining, controller->eepromFile)) == 0 &&
-      ferror(controller->eepromFile))
-      return -1;
+  /* Ignore invalid sized files. */
+  if (map->fileSize < EEPROM_SIZE) {
+    memset(map->base, 0, EEPROM_SIZE);
 
-    /* Ignore invalid sized files. */
-    if (feof(controller->eepromFile)) {
-      memset(controller->eeprom, 0, sizeof(controller->eeprom));
+    if (map->fileSize)
       printf("EEPROM: Ignoring short EEPROM file.\n");
-      return 0;
-    }
-
-    cur += ret;
   }
 
+  controller->eeprom = map->base;
+  controller->memo.valid = false;
+  memset(controller->eepromDirty, 0, sizeof(controller->eepromDirty));
   return 0;
 }
 
 /* ============================================================================
- *  SetControlType: Sets the Control Type for the emulator.
+ *  ReadControllerInput: Fetches a controller's 4-byte state.
+ * ========================================================================= */
+static void
+ReadControllerInput(struct PIFController *controller, unsigned channel,
+  uint8_t *state) {
+  struct PIFChannel *port = controller->channels + channel;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_INPUT_POLL);
+
+  if (controller->sampler)
+    ReadSampledInput(controller->sampler, channel, state);
+
+  else
+    port->backend.poll(port->backend.opaque, channel, state);
+
+  EndPIFStats(controller, PIF_STATS_INPUT_POLL, start);
+
+  if (unlikely(controller->movie != NULL))
+    RecordInputMovie(controller->movie, channel, state);
+
+  memcpy(port->lastState, state, sizeof(port->lastState));
+}
+
+/* ============================================================================
+ *  SetControlType: Sets the Control Type for the emulator (first port).
  * ========================================================================= */
 void
 SetControlType(struct PIFController *controller, const char *controltype) {
-  controller->input = INVALID;
+  CONTROLTYPE input = INVALID;
 
   if(!strncmp("keyboard", controltype, 8))
-    controller->input = KEYBOARD;
+    input = KEYBOARD;
   else if(!strncmp("mayflash64", controltype, 10))
-    controller->input = MAYFLASH_N64;
+    input = MAYFLASH_N64;
   else if(!strncmp("retrolink", controltype, 9))
-    controller->input = RETROLINK;
+    input = RETROLINK;
   else if(!strncmp("x360", controltype, 4))
-    controller->input = XBOX360;
+    input = XBOX360;
   else if(!strncmp("wiiu", controltype, 4))
-    controller->input = WIIU;
+    input = WIIU;
 
   /* Default to keyboard. */
-  if (controller->input == INVALID)
-    controller->input = KEYBOARD;
+  if (input == INVALID)
+    input = KEYBOARD;
+
+  SetDeviceInput(controller, 0, input);
 }
 
 /* ============================================================================
@@ -526,18 +624,42 @@ SetControlType(struct PIFController *controller, const char *controltype) {
  * ========================================================================= */
 void
 SetEEPROMFile(struct PIFController *controller, const char *filename) {
-  if (controller->eepromFile != NULL)
-    fclose(controller->eepromFile);
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->eepromFile.base != NULL) {
+    WriteEEPROMFile(controller);
+    CloseFileMap(&controller->eepromFile);
+  }
+
+  controller->eeprom = controller->eepromData;
 
-  /* Try opening with rb+ first, then wb+ iff we fail. */
-  if ((controller->eepromFile = fopen(filename, "rb+")) == NULL) {
-    controller->eepromFile = fopen(filename, "wb+");
+  /* The file is created (or grown) to size if needed. */
+  if (OpenFileMap(&controller->eepromFile, filename,
+    EEPROM_SIZE, FILEMAP_SHARED)) {
+    debug("EEPROM: Failed to map the EEPROM file.");
     return;
   }
 
   ReadEEPROMFile(controller);
 }
 
+/* ============================================================================
+ *  SetResponseMemoization: Enables or disables response memoization.
+ *
+ *  When enabled, a command block identical to the previous one is not
+ *  run again if PIF RAM was not touched in between and no polled channel
+ *  has seen NotifyPIFInputChanged; the previous response is reused.
+ * ========================================================================= */
+void
+SetResponseMemoization(struct PIFController *controller, bool enable) {
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  controller->memoizeResponses = enable;
+  controller->memo.valid = false;
+}
+
 /* ============================================================================
  *  SIHandleDMARead: Invoked when SI_PIF_ADDR_RD64B_REG is written.
  *
@@ -548,16 +670,31 @@ SetEEPROMFile(struct PIFController *controller, const char *filename) {
 void
 SIHandleDMARead(struct PIFController *controller) {
   uint32_t target = controller->regs[SI_DRAM_ADDR_REG] & 0x1FFFFFFF;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_DMA_READ);
   assert(((target & 0x3) == 0) && "Unaligned access.");
+  ResetPIFIdle(controller);
 
-  PIFProcess(controller);
+  /* When pipelining, the block has usually run already. */
+  if (likely(controller->worker == NULL) ||
+    !ClaimPIFWorkerResponse(controller->worker))
+    PIFProcess(controller);
+
+  TracePIF(controller, PIF_TRACE_DMA, PIF_TRACE_DMA_FROM_PIF, 64,
+    target, 0);
+
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_DMA_READ,
+      64, PIF_RAM_BASE_ADDRESS, target, controller->ram);
+  }
 
-  debug("DMA | Request: Read from PIF RAM.");
-  debugarg("DMA | DEST   : [0x%.8x].", target);
-  debugarg("DMA | SOURCE : [0x%.8x].", PIF_RAM_BASE_ADDRESS);
-  debugarg("DMA | LENGTH : [0x%.8x].", 64);
+  if (unlikely(controller->timing != NULL)) {
+    ScheduleSIDMA(controller, true, target);
+    EndPIFStats(controller, PIF_STATS_DMA_READ, start);
+    return;
+  }
 
   DMAToDRAM(controller->bus, target, controller->ram, 64);
+  EndPIFStats(controller, PIF_STATS_DMA_READ, start);
 
   controller->regs[SI_STATUS_REG] |= 0x1000;
   BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
@@ -573,44 +710,93 @@ SIHandleDMARead(struct PIFController *controller) {
 void
 SIHandleDMAWrite(struct PIFController *controller) {
   uint32_t source = controller->regs[SI_DRAM_ADDR_REG] & 0x1FFFFFFF;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_DMA_WRITE);
   assert(((source & 0x3) == 0) && "Unaligned access.");
+  ResetPIFIdle(controller);
 
-  debug("DMA | Request: Write to PIF RAM.");
-  debugarg("DMA | DEST   : [0x%.8x].", PIF_RAM_BASE_ADDRESS);
-  debugarg("DMA | SOURCE : [0x%.8x].", source);
-  debugarg("DMA | LENGTH : [0x%.8x].", 64);
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  TracePIF(controller, PIF_TRACE_DMA, PIF_TRACE_DMA_TO_PIF, 64,
+    source, 0);
 
   DMAFromDRAM(controller->bus, controller->ram, source, 64);
   memcpy(controller->command, controller->ram, 64);
 
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_DMA_WRITE,
+      64, PIF_RAM_BASE_ADDRESS, source, controller->ram);
+  }
+
+  EndPIFStats(controller, PIF_STATS_DMA_WRITE, start);
+  controller->ramWritten = false;
+
+  if (unlikely(controller->worker != NULL))
+    QueuePIFWorker(controller->worker);
+
+  if (unlikely(controller->timing != NULL)) {
+    ScheduleSIDMA(controller, false, source);
+    return;
+  }
+
   controller->regs[SI_STATUS_REG] |= 0x1000;
   BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
 }
 
 /* ============================================================================
- *  WriteEEPROMFile: Dumps the contents of the EEPROM to the backing file.
+ *  WriteEEPROMFile: Writes dirty EEPROM blocks back to the backing file.
+ *
+ *  Writes land in the mapping as they happen, so this only has to force
+ *  the dirty span out to disk. A clean EEPROM costs no I/O at all.
  * ========================================================================= */
 int
 WriteEEPROMFile(struct PIFController *controller) {
-  size_t cur = 0;
+  const unsigned numWords = sizeof(controller->eepromDirty) /
+    sizeof(*controller->eepromDirty);
+  unsigned first = EEPROM_SIZE, last = 0, i;
+  int status;
 
-  if (!controller->eepromFile)
+  if (!controller->eepromFile.base && !controller->archive)
     return -1;
 
-  rewind(controller->eepromFile);
+  /* The flusher owns the file; just ask it to write out now. */
+  if (controller->flusher) {
+    KickSaveFlusher(controller->flusher);
+    return 0;
+  }
+
+  for (i = 0; i < numWords; i++) {
+    uint64_t dirty = controller->eepromDirty[i];
+    unsigned block;
+
+    for (block = i * 64; dirty; dirty >>= 1, block++) {
+      if (dirty & 1) {
+        if (block < first)
+          first = block;
 
-  while (cur < sizeof(controller->eeprom)) {
-    size_t remaining = sizeof(controller->eeprom) - cur;
-    size_t ret;
+        last = block;
+      }
+    }
+  }
 
-    if ((ret = fwrite(controller->eeprom + cur, 1,
-      remaining, controller->eepromFile)) == 0 &&
-      ferror(controller->eepromFile))
-      return -1;
+  if (first == EEPROM_SIZE)
+    return 0;
 
-    cur += ret;
+  /* msync works on whole pages, so sync the dirty span in one go. */
+  if (controller->archive) {
+    status = SyncSaveArchive(controller->archive, controller->eeprom +
+      first * EEPROM_BLOCK_SIZE, (last - first + 1) * EEPROM_BLOCK_SIZE);
   }
 
+  else {
+    status = SyncFileMap(&controller->eepromFile, first * EEPROM_BLOCK_SIZE,
+      (last - first + 1) * EEPROM_BLOCK_SIZE);
+  }
+
+  if (status)
+    return -1;
+
+  memset(controller->eepromDirty, 0, sizeof(controller->eepromDirty));
   return 0;
 }
 
@@ -13,9 +13,15 @@
 #include "Common.h"
 #include "Controller.h"
 
+void PIFProcess(struct PIFController *);
 void SIHandleDMARead(struct PIFController *);
 void SIHandleDMAWrite(struct PIFController *);
 
+int GetPIFChannelStats(const struct PIFController *, unsigned,
+  struct PIFChannelStats *);
+void NotifyPIFInputChanged(struct PIFController *, unsigned);
+void SetResponseMemoization(struct PIFController *, bool);
+
 int ReadEEPROMFile(struct PIFController *);
 void SetEEPROMFile(struct PIFController *, const char *);
 int WriteEEPROMFile(struct PIFController *);
@@ -0,0 +1,330 @@
+/* ============================================================================
+ *  CRC.c: Controller Pak (MemPak) CRC engine.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "CRC.h"
+
+/* ============================================================================
+ *  Slice-by-8 tables for the pak CRC (x^8 + x^7 + x^2 + 1, MSB first).
+ *
+ *  MemPakCRCTable[0][b] is the CRC of the single byte b; each following
+ *  table is the CRC of b followed by that many zero bytes. Since the CRC
+ *  is linear, eight bytes can then be folded in with independent lookups.
+ * ========================================================================= */
+static const uint8_t MemPakCRCTable[8][256] = {
+  {
+    0x00, 0x85, 0x8F, 0x0A, 0x9B, 0x1E, 0x14, 0x91, 0xB3, 0x36, 0x3C, 0xB9,
+    0x28, 0xAD, 0xA7, 0x22, 0xE3, 0x66, 0x6C, 0xE9, 0x78, 0xFD, 0xF7, 0x72,
+    0x50, 0xD5, 0xDF, 0x5A, 0xCB, 0x4E, 0x44, 0xC1, 0x43, 0xC6, 0xCC, 0x49,
+    0xD8, 0x5D, 0x57, 0xD2, 0xF0, 0x75, 0x7F, 0xFA, 0x6B, 0xEE, 0xE4, 0x61,
+    0xA0, 0x25, 0x2F, 0xAA, 0x3B, 0xBE, 0xB4, 0x31, 0x13, 0x96, 0x9C, 0x19,
+    0x88, 0x0D, 0x07, 0x82, 0x86, 0x03, 0x09, 0x8C, 0x1D, 0x98, 0x92, 0x17,
+    0x35, 0xB0, 0xBA, 0x3F, 0xAE, 0x2B, 0x21, 0xA4, 0x65, 0xE0, 0xEA, 0x6F,
+    0xFE, 0x7B, 0x71, 0xF4, 0xD6, 0x53, 0x59, 0xDC, 0x4D, 0xC8, 0xC2, 0x47,
+    0xC5, 0x40, 0x4A, 0xCF, 0x5E, 0xDB, 0xD1, 0x54, 0x76, 0xF3, 0xF9, 0x7C,
+    0xED, 0x68, 0x62, 0xE7, 0x26, 0xA3, 0xA9, 0x2C, 0xBD, 0x38, 0x32, 0xB7,
+    0x95, 0x10, 0x1A, 0x9F, 0x0E, 0x8B, 0x81, 0x04, 0x89, 0x0C, 0x06, 0x83,
+    0x12, 0x97, 0x9D, 0x18, 0x3A, 0xBF, 0xB5, 0x30, 0xA1, 0x24, 0x2E, 0xAB,
+    0x6A, 0xEF, 0xE5, 0x60, 0xF1, 0x74, 0x7E, 0xFB, 0xD9, 0x5C, 0x56, 0xD3,
+    0x42, 0xC7, 0xCD, 0x48, 0xCA, 0x4F, 0x45, 0xC0, 0x51, 0xD4, 0xDE, 0x5B,
+    0x79, 0xFC, 0xF6, 0x73, 0xE2, 0x67, 0x6D, 0xE8, 0x29, 0xAC, 0xA6, 0x23,
+    0xB2, 0x37, 0x3D, 0xB8, 0x9A, 0x1F, 0x15, 0x90, 0x01, 0x84, 0x8E, 0x0B,
+    0x0F, 0x8A, 0x80, 0x05, 0x94, 0x11, 0x1B, 0x9E, 0xBC, 0x39, 0x33, 0xB6,
+    0x27, 0xA2, 0xA8, 0x2D, 0xEC, 0x69, 0x63, 0xE6, 0x77, 0xF2, 0xF8, 0x7D,
+    0x5F, 0xDA, 0xD0, 0x55, 0xC4, 0x41, 0x4B, 0xCE, 0x4C, 0xC9, 0xC3, 0x46,
+    0xD7, 0x52, 0x58, 0xDD, 0xFF, 0x7A, 0x70, 0xF5, 0x64, 0xE1, 0xEB, 0x6E,
+    0xAF, 0x2A, 0x20, 0xA5, 0x34, 0xB1, 0xBB, 0x3E, 0x1C, 0x99, 0x93, 0x16,
+    0x87, 0x02, 0x08, 0x8D
+  },
+  {
+    0x00, 0x97, 0xAB, 0x3C, 0xD3, 0x44, 0x78, 0xEF, 0x23, 0xB4, 0x88, 0x1F,
+    0xF0, 0x67, 0x5B, 0xCC, 0x46, 0xD1, 0xED, 0x7A, 0x95, 0x02, 0x3E, 0xA9,
+    0x65, 0xF2, 0xCE, 0x59, 0xB6, 0x21, 0x1D, 0x8A, 0x8C, 0x1B, 0x27, 0xB0,
+    0x5F, 0xC8, 0xF4, 0x63, 0xAF, 0x38, 0x04, 0x93, 0x7C, 0xEB, 0xD7, 0x40,
+    0xCA, 0x5D, 0x61, 0xF6, 0x19, 0x8E, 0xB2, 0x25, 0xE9, 0x7E, 0x42, 0xD5,
+    0x3A, 0xAD, 0x91, 0x06, 0x9D, 0x0A, 0x36, 0xA1, 0x4E, 0xD9, 0xE5, 0x72,
+    0xBE, 0x29, 0x15, 0x82, 0x6D, 0xFA, 0xC6, 0x51, 0xDB, 0x4C, 0x70, 0xE7,
+    0x08, 0x9F, 0xA3, 0x34, 0xF8, 0x6F, 0x53, 0xC4, 0x2B, 0xBC, 0x80, 0x17,
+    0x11, 0x86, 0xBA, 0x2D, 0xC2, 0x55, 0x69, 0xFE, 0x32, 0xA5, 0x99, 0x0E,
+    0xE1, 0x76, 0x4A, 0xDD, 0x57, 0xC0, 0xFC, 0x6B, 0x84, 0x13, 0x2F, 0xB8,
+    0x74, 0xE3, 0xDF, 0x48, 0xA7, 0x30, 0x0C, 0x9B, 0xBF, 0x28, 0x14, 0x83,
+    0x6C, 0xFB, 0xC7, 0x50, 0x9C, 0x0B, 0x37, 0xA0, 0x4F, 0xD8, 0xE4, 0x73,
+    0xF9, 0x6E, 0x52, 0xC5, 0x2A, 0xBD, 0x81, 0x16, 0xDA, 0x4D, 0x71, 0xE6,
+    0x09, 0x9E, 0xA2, 0x35, 0x33, 0xA4, 0x98, 0x0F, 0xE0, 0x77, 0x4B, 0xDC,
+    0x10, 0x87, 0xBB, 0x2C, 0xC3, 0x54, 0x68, 0xFF, 0x75, 0xE2, 0xDE, 0x49,
+    0xA6, 0x31, 0x0D, 0x9A, 0x56, 0xC1, 0xFD, 0x6A, 0x85, 0x12, 0x2E, 0xB9,
+    0x22, 0xB5, 0x89, 0x1E, 0xF1, 0x66, 0x5A, 0xCD, 0x01, 0x96, 0xAA, 0x3D,
+    0xD2, 0x45, 0x79, 0xEE, 0x64, 0xF3, 0xCF, 0x58, 0xB7, 0x20, 0x1C, 0x8B,
+    0x47, 0xD0, 0xEC, 0x7B, 0x94, 0x03, 0x3F, 0xA8, 0xAE, 0x39, 0x05, 0x92,
+    0x7D, 0xEA, 0xD6, 0x41, 0x8D, 0x1A, 0x26, 0xB1, 0x5E, 0xC9, 0xF5, 0x62,
+    0xE8, 0x7F, 0x43, 0xD4, 0x3B, 0xAC, 0x90, 0x07, 0xCB, 0x5C, 0x60, 0xF7,
+    0x18, 0x8F, 0xB3, 0x24
+  },
+  {
+    0x00, 0xFB, 0x73, 0x88, 0xE6, 0x1D, 0x95, 0x6E, 0x49, 0xB2, 0x3A, 0xC1,
+    0xAF, 0x54, 0xDC, 0x27, 0x92, 0x69, 0xE1, 0x1A, 0x74, 0x8F, 0x07, 0xFC,
+    0xDB, 0x20, 0xA8, 0x53, 0x3D, 0xC6, 0x4E, 0xB5, 0xA1, 0x5A, 0xD2, 0x29,
+    0x47, 0xBC, 0x34, 0xCF, 0xE8, 0x13, 0x9B, 0x60, 0x0E, 0xF5, 0x7D, 0x86,
+    0x33, 0xC8, 0x40, 0xBB, 0xD5, 0x2E, 0xA6, 0x5D, 0x7A, 0x81, 0x09, 0xF2,
+    0x9C, 0x67, 0xEF, 0x14, 0xC7, 0x3C, 0xB4, 0x4F, 0x21, 0xDA, 0x52, 0xA9,
+    0x8E, 0x75, 0xFD, 0x06, 0x68, 0x93, 0x1B, 0xE0, 0x55, 0xAE, 0x26, 0xDD,
+    0xB3, 0x48, 0xC0, 0x3B, 0x1C, 0xE7, 0x6F, 0x94, 0xFA, 0x01, 0x89, 0x72,
+    0x66, 0x9D, 0x15, 0xEE, 0x80, 0x7B, 0xF3, 0x08, 0x2F, 0xD4, 0x5C, 0xA7,
+    0xC9, 0x32, 0xBA, 0x41, 0xF4, 0x0F, 0x87, 0x7C, 0x12, 0xE9, 0x61, 0x9A,
+    0xBD, 0x46, 0xCE, 0x35, 0x5B, 0xA0, 0x28, 0xD3, 0x0B, 0xF0, 0x78, 0x83,
+    0xED, 0x16, 0x9E, 0x65, 0x42, 0xB9, 0x31, 0xCA, 0xA4, 0x5F, 0xD7, 0x2C,
+    0x99, 0x62, 0xEA, 0x11, 0x7F, 0x84, 0x0C, 0xF7, 0xD0, 0x2B, 0xA3, 0x58,
+    0x36, 0xCD, 0x45, 0xBE, 0xAA, 0x51, 0xD9, 0x22, 0x4C, 0xB7, 0x3F, 0xC4,
+    0xE3, 0x18, 0x90, 0x6B, 0x05, 0xFE, 0x76, 0x8D, 0x38, 0xC3, 0x4B, 0xB0,
+    0xDE, 0x25, 0xAD, 0x56, 0x71, 0x8A, 0x02, 0xF9, 0x97, 0x6C, 0xE4, 0x1F,
+    0xCC, 0x37, 0xBF, 0x44, 0x2A, 0xD1, 0x59, 0xA2, 0x85, 0x7E, 0xF6, 0x0D,
+    0x63, 0x98, 0x10, 0xEB, 0x5E, 0xA5, 0x2D, 0xD6, 0xB8, 0x43, 0xCB, 0x30,
+    0x17, 0xEC, 0x64, 0x9F, 0xF1, 0x0A, 0x82, 0x79, 0x6D, 0x96, 0x1E, 0xE5,
+    0x8B, 0x70, 0xF8, 0x03, 0x24, 0xDF, 0x57, 0xAC, 0xC2, 0x39, 0xB1, 0x4A,
+    0xFF, 0x04, 0x8C, 0x77, 0x19, 0xE2, 0x6A, 0x91, 0xB6, 0x4D, 0xC5, 0x3E,
+    0x50, 0xAB, 0x23, 0xD8
+  },
+  {
+    0x00, 0x16, 0x2C, 0x3A, 0x58, 0x4E, 0x74, 0x62, 0xB0, 0xA6, 0x9C, 0x8A,
+    0xE8, 0xFE, 0xC4, 0xD2, 0xE5, 0xF3, 0xC9, 0xDF, 0xBD, 0xAB, 0x91, 0x87,
+    0x55, 0x43, 0x79, 0x6F, 0x0D, 0x1B, 0x21, 0x37, 0x4F, 0x59, 0x63, 0x75,
+    0x17, 0x01, 0x3B, 0x2D, 0xFF, 0xE9, 0xD3, 0xC5, 0xA7, 0xB1, 0x8B, 0x9D,
+    0xAA, 0xBC, 0x86, 0x90, 0xF2, 0xE4, 0xDE, 0xC8, 0x1A, 0x0C, 0x36, 0x20,
+    0x42, 0x54, 0x6E, 0x78, 0x9E, 0x88, 0xB2, 0xA4, 0xC6, 0xD0, 0xEA, 0xFC,
+    0x2E, 0x38, 0x02, 0x14, 0x76, 0x60, 0x5A, 0x4C, 0x7B, 0x6D, 0x57, 0x41,
+    0x23, 0x35, 0x0F, 0x19, 0xCB, 0xDD, 0xE7, 0xF1, 0x93, 0x85, 0xBF, 0xA9,
+    0xD1, 0xC7, 0xFD, 0xEB, 0x89, 0x9F, 0xA5, 0xB3, 0x61, 0x77, 0x4D, 0x5B,
+    0x39, 0x2F, 0x15, 0x03, 0x34, 0x22, 0x18, 0x0E, 0x6C, 0x7A, 0x40, 0x56,
+    0x84, 0x92, 0xA8, 0xBE, 0xDC, 0xCA, 0xF0, 0xE6, 0xB9, 0xAF, 0x95, 0x83,
+    0xE1, 0xF7, 0xCD, 0xDB, 0x09, 0x1F, 0x25, 0x33, 0x51, 0x47, 0x7D, 0x6B,
+    0x5C, 0x4A, 0x70, 0x66, 0x04, 0x12, 0x28, 0x3E, 0xEC, 0xFA, 0xC0, 0xD6,
+    0xB4, 0xA2, 0x98, 0x8E, 0xF6, 0xE0, 0xDA, 0xCC, 0xAE, 0xB8, 0x82, 0x94,
+    0x46, 0x50, 0x6A, 0x7C, 0x1E, 0x08, 0x32, 0x24, 0x13, 0x05, 0x3F, 0x29,
+    0x4B, 0x5D, 0x67, 0x71, 0xA3, 0xB5, 0x8F, 0x99, 0xFB, 0xED, 0xD7, 0xC1,
+    0x27, 0x31, 0x0B, 0x1D, 0x7F, 0x69, 0x53, 0x45, 0x97, 0x81, 0xBB, 0xAD,
+    0xCF, 0xD9, 0xE3, 0xF5, 0xC2, 0xD4, 0xEE, 0xF8, 0x9A, 0x8C, 0xB6, 0xA0,
+    0x72, 0x64, 0x5E, 0x48, 0x2A, 0x3C, 0x06, 0x10, 0x68, 0x7E, 0x44, 0x52,
+    0x30, 0x26, 0x1C, 0x0A, 0xD8, 0xCE, 0xF4, 0xE2, 0x80, 0x96, 0xAC, 0xBA,
+    0x8D, 0x9B, 0xA1, 0xB7, 0xD5, 0xC3, 0xF9, 0xEF, 0x3D, 0x2B, 0x11, 0x07,
+    0x65, 0x73, 0x49, 0x5F
+  },
+  {
+    0x00, 0xF7, 0x6B, 0x9C, 0xD6, 0x21, 0xBD, 0x4A, 0x29, 0xDE, 0x42, 0xB5,
+    0xFF, 0x08, 0x94, 0x63, 0x52, 0xA5, 0x39, 0xCE, 0x84, 0x73, 0xEF, 0x18,
+    0x7B, 0x8C, 0x10, 0xE7, 0xAD, 0x5A, 0xC6, 0x31, 0xA4, 0x53, 0xCF, 0x38,
+    0x72, 0x85, 0x19, 0xEE, 0x8D, 0x7A, 0xE6, 0x11, 0x5B, 0xAC, 0x30, 0xC7,
+    0xF6, 0x01, 0x9D, 0x6A, 0x20, 0xD7, 0x4B, 0xBC, 0xDF, 0x28, 0xB4, 0x43,
+    0x09, 0xFE, 0x62, 0x95, 0xCD, 0x3A, 0xA6, 0x51, 0x1B, 0xEC, 0x70, 0x87,
+    0xE4, 0x13, 0x8F, 0x78, 0x32, 0xC5, 0x59, 0xAE, 0x9F, 0x68, 0xF4, 0x03,
+    0x49, 0xBE, 0x22, 0xD5, 0xB6, 0x41, 0xDD, 0x2A, 0x60, 0x97, 0x0B, 0xFC,
+    0x69, 0x9E, 0x02, 0xF5, 0xBF, 0x48, 0xD4, 0x23, 0x40, 0xB7, 0x2B, 0xDC,
+    0x96, 0x61, 0xFD, 0x0A, 0x3B, 0xCC, 0x50, 0xA7, 0xED, 0x1A, 0x86, 0x71,
+    0x12, 0xE5, 0x79, 0x8E, 0xC4, 0x33, 0xAF, 0x58, 0x1F, 0xE8, 0x74, 0x83,
+    0xC9, 0x3E, 0xA2, 0x55, 0x36, 0xC1, 0x5D, 0xAA, 0xE0, 0x17, 0x8B, 0x7C,
+    0x4D, 0xBA, 0x26, 0xD1, 0x9B, 0x6C, 0xF0, 0x07, 0x64, 0x93, 0x0F, 0xF8,
+    0xB2, 0x45, 0xD9, 0x2E, 0xBB, 0x4C, 0xD0, 0x27, 0x6D, 0x9A, 0x06, 0xF1,
+    0x92, 0x65, 0xF9, 0x0E, 0x44, 0xB3, 0x2F, 0xD8, 0xE9, 0x1E, 0x82, 0x75,
+    0x3F, 0xC8, 0x54, 0xA3, 0xC0, 0x37, 0xAB, 0x5C, 0x16, 0xE1, 0x7D, 0x8A,
+    0xD2, 0x25, 0xB9, 0x4E, 0x04, 0xF3, 0x6F, 0x98, 0xFB, 0x0C, 0x90, 0x67,
+    0x2D, 0xDA, 0x46, 0xB1, 0x80, 0x77, 0xEB, 0x1C, 0x56, 0xA1, 0x3D, 0xCA,
+    0xA9, 0x5E, 0xC2, 0x35, 0x7F, 0x88, 0x14, 0xE3, 0x76, 0x81, 0x1D, 0xEA,
+    0xA0, 0x57, 0xCB, 0x3C, 0x5F, 0xA8, 0x34, 0xC3, 0x89, 0x7E, 0xE2, 0x15,
+    0x24, 0xD3, 0x4F, 0xB8, 0xF2, 0x05, 0x99, 0x6E, 0x0D, 0xFA, 0x66, 0x91,
+    0xDB, 0x2C, 0xB0, 0x47
+  },
+  {
+    0x00, 0x3E, 0x7C, 0x42, 0xF8, 0xC6, 0x84, 0xBA, 0x75, 0x4B, 0x09, 0x37,
+    0x8D, 0xB3, 0xF1, 0xCF, 0xEA, 0xD4, 0x96, 0xA8, 0x12, 0x2C, 0x6E, 0x50,
+    0x9F, 0xA1, 0xE3, 0xDD, 0x67, 0x59, 0x1B, 0x25, 0x51, 0x6F, 0x2D, 0x13,
+    0xA9, 0x97, 0xD5, 0xEB, 0x24, 0x1A, 0x58, 0x66, 0xDC, 0xE2, 0xA0, 0x9E,
+    0xBB, 0x85, 0xC7, 0xF9, 0x43, 0x7D, 0x3F, 0x01, 0xCE, 0xF0, 0xB2, 0x8C,
+    0x36, 0x08, 0x4A, 0x74, 0xA2, 0x9C, 0xDE, 0xE0, 0x5A, 0x64, 0x26, 0x18,
+    0xD7, 0xE9, 0xAB, 0x95, 0x2F, 0x11, 0x53, 0x6D, 0x48, 0x76, 0x34, 0x0A,
+    0xB0, 0x8E, 0xCC, 0xF2, 0x3D, 0x03, 0x41, 0x7F, 0xC5, 0xFB, 0xB9, 0x87,
+    0xF3, 0xCD, 0x8F, 0xB1, 0x0B, 0x35, 0x77, 0x49, 0x86, 0xB8, 0xFA, 0xC4,
+    0x7E, 0x40, 0x02, 0x3C, 0x19, 0x27, 0x65, 0x5B, 0xE1, 0xDF, 0x9D, 0xA3,
+    0x6C, 0x52, 0x10, 0x2E, 0x94, 0xAA, 0xE8, 0xD6, 0xC1, 0xFF, 0xBD, 0x83,
+    0x39, 0x07, 0x45, 0x7B, 0xB4, 0x8A, 0xC8, 0xF6, 0x4C, 0x72, 0x30, 0x0E,
+    0x2B, 0x15, 0x57, 0x69, 0xD3, 0xED, 0xAF, 0x91, 0x5E, 0x60, 0x22, 0x1C,
+    0xA6, 0x98, 0xDA, 0xE4, 0x90, 0xAE, 0xEC, 0xD2, 0x68, 0x56, 0x14, 0x2A,
+    0xE5, 0xDB, 0x99, 0xA7, 0x1D, 0x23, 0x61, 0x5F, 0x7A, 0x44, 0x06, 0x38,
+    0x82, 0xBC, 0xFE, 0xC0, 0x0F, 0x31, 0x73, 0x4D, 0xF7, 0xC9, 0x8B, 0xB5,
+    0x63, 0x5D, 0x1F, 0x21, 0x9B, 0xA5, 0xE7, 0xD9, 0x16, 0x28, 0x6A, 0x54,
+    0xEE, 0xD0, 0x92, 0xAC, 0x89, 0xB7, 0xF5, 0xCB, 0x71, 0x4F, 0x0D, 0x33,
+    0xFC, 0xC2, 0x80, 0xBE, 0x04, 0x3A, 0x78, 0x46, 0x32, 0x0C, 0x4E, 0x70,
+    0xCA, 0xF4, 0xB6, 0x88, 0x47, 0x79, 0x3B, 0x05, 0xBF, 0x81, 0xC3, 0xFD,
+    0xD8, 0xE6, 0xA4, 0x9A, 0x20, 0x1E, 0x5C, 0x62, 0xAD, 0x93, 0xD1, 0xEF,
+    0x55, 0x6B, 0x29, 0x17
+  },
+  {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31,
+    0x24, 0x23, 0x2A, 0x2D, 0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65,
+    0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D, 0xE0, 0xE7, 0xEE, 0xE9,
+    0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1,
+    0xB4, 0xB3, 0xBA, 0xBD, 0x45, 0x42, 0x4B, 0x4C, 0x59, 0x5E, 0x57, 0x50,
+    0x7D, 0x7A, 0x73, 0x74, 0x61, 0x66, 0x6F, 0x68, 0x35, 0x32, 0x3B, 0x3C,
+    0x29, 0x2E, 0x27, 0x20, 0x0D, 0x0A, 0x03, 0x04, 0x11, 0x16, 0x1F, 0x18,
+    0xA5, 0xA2, 0xAB, 0xAC, 0xB9, 0xBE, 0xB7, 0xB0, 0x9D, 0x9A, 0x93, 0x94,
+    0x81, 0x86, 0x8F, 0x88, 0xD5, 0xD2, 0xDB, 0xDC, 0xC9, 0xCE, 0xC7, 0xC0,
+    0xED, 0xEA, 0xE3, 0xE4, 0xF1, 0xF6, 0xFF, 0xF8, 0x8A, 0x8D, 0x84, 0x83,
+    0x96, 0x91, 0x98, 0x9F, 0xB2, 0xB5, 0xBC, 0xBB, 0xAE, 0xA9, 0xA0, 0xA7,
+    0xFA, 0xFD, 0xF4, 0xF3, 0xE6, 0xE1, 0xE8, 0xEF, 0xC2, 0xC5, 0xCC, 0xCB,
+    0xDE, 0xD9, 0xD0, 0xD7, 0x6A, 0x6D, 0x64, 0x63, 0x76, 0x71, 0x78, 0x7F,
+    0x52, 0x55, 0x5C, 0x5B, 0x4E, 0x49, 0x40, 0x47, 0x1A, 0x1D, 0x14, 0x13,
+    0x06, 0x01, 0x08, 0x0F, 0x22, 0x25, 0x2C, 0x2B, 0x3E, 0x39, 0x30, 0x37,
+    0xCF, 0xC8, 0xC1, 0xC6, 0xD3, 0xD4, 0xDD, 0xDA, 0xF7, 0xF0, 0xF9, 0xFE,
+    0xEB, 0xEC, 0xE5, 0xE2, 0xBF, 0xB8, 0xB1, 0xB6, 0xA3, 0xA4, 0xAD, 0xAA,
+    0x87, 0x80, 0x89, 0x8E, 0x9B, 0x9C, 0x95, 0x92, 0x2F, 0x28, 0x21, 0x26,
+    0x33, 0x34, 0x3D, 0x3A, 0x17, 0x10, 0x19, 0x1E, 0x0B, 0x0C, 0x05, 0x02,
+    0x5F, 0x58, 0x51, 0x56, 0x43, 0x44, 0x4D, 0x4A, 0x67, 0x60, 0x69, 0x6E,
+    0x7B, 0x7C, 0x75, 0x72
+  },
+  {
+    0x00, 0x91, 0xA7, 0x36, 0xCB, 0x5A, 0x6C, 0xFD, 0x13, 0x82, 0xB4, 0x25,
+    0xD8, 0x49, 0x7F, 0xEE, 0x26, 0xB7, 0x81, 0x10, 0xED, 0x7C, 0x4A, 0xDB,
+    0x35, 0xA4, 0x92, 0x03, 0xFE, 0x6F, 0x59, 0xC8, 0x4C, 0xDD, 0xEB, 0x7A,
+    0x87, 0x16, 0x20, 0xB1, 0x5F, 0xCE, 0xF8, 0x69, 0x94, 0x05, 0x33, 0xA2,
+    0x6A, 0xFB, 0xCD, 0x5C, 0xA1, 0x30, 0x06, 0x97, 0x79, 0xE8, 0xDE, 0x4F,
+    0xB2, 0x23, 0x15, 0x84, 0x98, 0x09, 0x3F, 0xAE, 0x53, 0xC2, 0xF4, 0x65,
+    0x8B, 0x1A, 0x2C, 0xBD, 0x40, 0xD1, 0xE7, 0x76, 0xBE, 0x2F, 0x19, 0x88,
+    0x75, 0xE4, 0xD2, 0x43, 0xAD, 0x3C, 0x0A, 0x9B, 0x66, 0xF7, 0xC1, 0x50,
+    0xD4, 0x45, 0x73, 0xE2, 0x1F, 0x8E, 0xB8, 0x29, 0xC7, 0x56, 0x60, 0xF1,
+    0x0C, 0x9D, 0xAB, 0x3A, 0xF2, 0x63, 0x55, 0xC4, 0x39, 0xA8, 0x9E, 0x0F,
+    0xE1, 0x70, 0x46, 0xD7, 0x2A, 0xBB, 0x8D, 0x1C, 0xB5, 0x24, 0x12, 0x83,
+    0x7E, 0xEF, 0xD9, 0x48, 0xA6, 0x37, 0x01, 0x90, 0x6D, 0xFC, 0xCA, 0x5B,
+    0x93, 0x02, 0x34, 0xA5, 0x58, 0xC9, 0xFF, 0x6E, 0x80, 0x11, 0x27, 0xB6,
+    0x4B, 0xDA, 0xEC, 0x7D, 0xF9, 0x68, 0x5E, 0xCF, 0x32, 0xA3, 0x95, 0x04,
+    0xEA, 0x7B, 0x4D, 0xDC, 0x21, 0xB0, 0x86, 0x17, 0xDF, 0x4E, 0x78, 0xE9,
+    0x14, 0x85, 0xB3, 0x22, 0xCC, 0x5D, 0x6B, 0xFA, 0x07, 0x96, 0xA0, 0x31,
+    0x2D, 0xBC, 0x8A, 0x1B, 0xE6, 0x77, 0x41, 0xD0, 0x3E, 0xAF, 0x99, 0x08,
+    0xF5, 0x64, 0x52, 0xC3, 0x0B, 0x9A, 0xAC, 0x3D, 0xC0, 0x51, 0x67, 0xF6,
+    0x18, 0x89, 0xBF, 0x2E, 0xD3, 0x42, 0x74, 0xE5, 0x61, 0xF0, 0xC6, 0x57,
+    0xAA, 0x3B, 0x0D, 0x9C, 0x72, 0xE3, 0xD5, 0x44, 0xB9, 0x28, 0x1E, 0x8F,
+    0x47, 0xD6, 0xE0, 0x71, 0x8C, 0x1D, 0x2B, 0xBA, 0x54, 0xC5, 0xF3, 0x62,
+    0x9F, 0x0E, 0x38, 0xA9
+  }
+};
+
+/* ============================================================================
+ *  BootCodeCRC: Calculates the CRC-32 (as in zlib) of cartridge boot code.
+ *
+ *  This only runs once per boot, so a nibble-wide table will do.
+ * ========================================================================= */
+uint32_t
+BootCodeCRC(const uint8_t *data, size_t size) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (size--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 0xF];
+    crc = (crc >> 4) ^ table[crc & 0xF];
+  }
+
+  return ~crc;
+}
+
+/* ============================================================================
+ *  MemPakCRC: Calculates the CRC of MemPak data, eight bytes at a time.
+ * ========================================================================= */
+uint8_t
+MemPakCRC(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+
+  for (; size >= 8; data += 8, size -= 8) {
+    crc =
+      MemPakCRCTable[7][data[0] ^ crc] ^ MemPakCRCTable[6][data[1]] ^
+      MemPakCRCTable[5][data[2]] ^ MemPakCRCTable[4][data[3]] ^
+      MemPakCRCTable[3][data[4]] ^ MemPakCRCTable[2][data[5]] ^
+      MemPakCRCTable[1][data[6]] ^ MemPakCRCTable[0][data[7]];
+  }
+
+  while (size--)
+    crc = MemPakCRCTable[0][*data++ ^ crc];
+
+  return crc;
+}
+
+/* ============================================================================
+ *  MemPakCRCBlocks: Calculates the CRCs of several 32-byte blocks.
+ *
+ *  Blocks are checksummed in pairs so that the two (otherwise serial)
+ *  table chains can be overlapped by the CPU.
+ * ========================================================================= */
+void
+MemPakCRCBlocks(const uint8_t *blocks, size_t count, uint8_t *crcs) {
+  for (; count >= 2; blocks += 2 * MEMPAK_BLOCK_SIZE, count -= 2) {
+    const uint8_t *a = blocks, *b = blocks + MEMPAK_BLOCK_SIZE;
+    uint8_t crcA = 0, crcB = 0;
+    unsigned i;
+
+    for (i = 0; i < MEMPAK_BLOCK_SIZE; i += 8) {
+      crcA =
+        MemPakCRCTable[7][a[i + 0] ^ crcA] ^ MemPakCRCTable[6][a[i + 1]] ^
+        MemPakCRCTable[5][a[i + 2]] ^ MemPakCRCTable[4][a[i + 3]] ^
+        MemPakCRCTable[3][a[i + 4]] ^ MemPakCRCTable[2][a[i + 5]] ^
+        MemPakCRCTable[1][a[i + 6]] ^ MemPakCRCTable[0][a[i + 7]];
+
+      crcB =
+        MemPakCRCTable[7][b[i + 0] ^ crcB] ^ MemPakCRCTable[6][b[i + 1]] ^
+        MemPakCRCTable[5][b[i + 2]] ^ MemPakCRCTable[4][b[i + 3]] ^
+        MemPakCRCTable[3][b[i + 4]] ^ MemPakCRCTable[2][b[i + 5]] ^
+        MemPakCRCTable[1][b[i + 6]] ^ MemPakCRCTable[0][b[i + 7]];
+    }
+
+    *crcs++ = crcA;
+    *crcs++ = crcB;
+  }
+
+  if (count)
+    *crcs = MemPakCRC(blocks, MEMPAK_BLOCK_SIZE);
+}
+
+/* ============================================================================
+ *  MemPakCRCReference: Calculates the CRC of MemPak data, one bit at a time.
+ *
+ *  This is the original (MAME/MESS) formulation: the message is shifted
+ *  through the register followed by eight zero bits. Kept as a reference
+ *  to cross-check the table-driven paths against.
+ * ========================================================================= */
+uint8_t
+MemPakCRCReference(const uint8_t *data, size_t size) {
+  uint32_t crc = 0;
+  size_t i;
+  int j;
+
+  for (i = 0; i <= size; i++) {
+    for (j = 7; j >= 0; j--) {
+      uint32_t temp = ((crc & 0x80) != 0) ? 0x85 : 0x00;
+
+      crc <<= 1;
+
+      if (i == size)
+        crc &= 0xFF;
+
+      else {
+        if ((data[i] & (1 << j)) != 0)
+          crc |= 0x1;
+      }
+
+      crc ^= temp;
+    }
+  }
+
+  return crc;
+}
+
@@ -0,0 +1,33 @@
+/* ============================================================================
+ *  CRC.h: Controller Pak (MemPak) CRC engine.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__CRC_H__
+#define __PIF__CRC_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+/* Pak commands always move data in 32-byte blocks. */
+#define MEMPAK_BLOCK_SIZE         32
+
+/* The CRC has a zero seed, so any all-zero block checksums to zero. */
+#define MEMPAK_ZERO_BLOCK_CRC     0x00
+
+uint32_t BootCodeCRC(const uint8_t *, size_t);
+uint8_t MemPakCRC(const uint8_t *, size_t);
+uint8_t MemPakCRCReference(const uint8_t *, size_t);
+void MemPakCRCBlocks(const uint8_t *, size_t, uint8_t *);
+
+#endif
+
@@ -14,6 +14,21 @@
 #include "Controller.h"
 #include "Definitions.h"
 #include "Externs.h"
+#include "FileMap.h"
+#include "Input.h"
+#include "InputMovie.h"
+#include "InputSampler.h"
+#include "MemPak.h"
+#include "PIFIdle.h"
+#include "PIFROMCache.h"
+#include "PIFStats.h"
+#include "PIFTrace.h"
+#include "PIFWorker.h"
+#include "SaveArchive.h"
+#include "SaveFlusher.h"
+#include "SICapture.h"
+#include "SITiming.h"
+#include "Thread.h"
 
 #ifdef __cplusplus
 #include <cassert>
@@ -27,18 +42,17 @@
 #include <string.h>
 #endif
 
-static void InitPIF(struct PIFController *, const uint8_t *);
+static void InitPIF(struct PIFController *, struct PIFROMImage *);
+static void SignalPIFRAMWrite(struct PIFController *);
 
 /* ============================================================================
  *  Mnemonics table.
  * ========================================================================= */
-#ifndef NDEBUG
 const char *SIRegisterMnemonics[NUM_SI_REGISTERS] = {
 #define Y(reg) #reg,
 #include "Registers.md"
 #undef Y
 };
-#endif
 
 /* ============================================================================
  *  ConnectPIFToBus: Connects a PIF instance to a Bus instance.
@@ -50,77 +64,161 @@ ConnectPIFToBus(struct PIFController *controller, struct BusController *bus) {
 
 /* ============================================================================
  *  CreatePIF: Creates and initializes an PIF instance.
+ *
+ *  The ROM image is shared with any other instance created from the same
+ *  file, so only the first instance reads it. Instances start on a cache
+ *  line of their own, so cores running different ones never share one.
  * ========================================================================= */
 struct PIFController *
 CreatePIF(const char *romPath) {
   struct PIFController *controller;
-  uint8_t *romImage;
-  size_t allocSize;
-  FILE *romFile;
-  long romSize;
-
-  /* Open image, determine image size. */
-  if ((romFile = fopen(romPath, "r")) == NULL) {
-    debug("Failed to open PIFROM image.");
+  struct PIFROMImage *romImage;
 
+  if ((romImage = AcquirePIFROM(romPath)) == NULL)
     return NULL;
-  }
 
-  if (fseek(romFile, 0, SEEK_END) == -1 || (romSize = ftell(romFile)) == -1) {
-    debug("Failed to determine PIFROM size.");
+  if ((controller = (struct PIFController*) AllocPIFAligned(
+    sizeof(*controller))) == NULL) {
+    debug("Failed to allocate memory for PIF.");
 
-    fclose(romFile);
+    ReleasePIFROM(romImage);
     return NULL;
   }
 
-  rewind(romFile);
+  InitPIF(controller, romImage);
+  return controller;
+}
 
-  /* Allocate memory for controller and image. */
-  allocSize = sizeof(struct PIFController) + romSize;
-  if ((controller = (struct PIFController*) malloc(allocSize)) == NULL) {
-    debug("Failed to allocate memory for PIFROM image.");
+/* ============================================================================
+ *  DestroyPIF: Releases any resources allocated for an PIF instance.
+ * ========================================================================= */
+void
+DestroyPIF(struct PIFController *controller) {
+  unsigned i;
 
-    fclose(romFile);
-    return NULL;
-  }
+  if (controller->worker)
+    DestroyPIFWorker(controller->worker);
 
-  romImage = (uint8_t*) controller + sizeof(*controller);
-  InitPIF(controller, romImage);
+  if (controller->sampler)
+    DestroyInputSampler(controller->sampler);
+
+  if (controller->movie)
+    DestroyInputMovie(controller->movie);
+
+  if (controller->capture)
+    DestroySICapture(controller->capture);
+
+  SetPIFStats(controller, false);
+
+  if (controller->trace)
+    DestroyPIFTrace(controller->trace);
+
+  /* A DMA still in flight is dropped. */
+  free(controller->timing);
+  free(controller->idle);
 
-  /* Read image into controller's memory. */
-  if (fread(romImage, romSize, 1, romFile) != 1) {
-    debug("Failed to read PIFROM image.");
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++)
+    DisconnectChannel(controller, i);
 
-    free(controller);
-    controller = NULL;
+  if (controller->flusher && DetachSaveFlusher(controller))
+    printf("Failed to write back the save files.\n");
+
+  if (controller->eepromFile.base || controller->archive) {
+    if (WriteEEPROMFile(controller))
+      printf("Failed to write the EEPROM file.\n");
+
+    CloseFileMap(&controller->eepromFile);
+    DetachSaveArchive(controller);
   }
 
-  fclose(romFile);
-  return controller;
+  for (i = 0; i < MEMPAK_NUM_CHANNELS; i++)
+    CloseMemPakFile(controller, i);
+
+  ReleasePIFROM(controller->romImage);
+  FreePIFAligned(controller);
 }
 
 /* ============================================================================
- *  DestroyPIF: Releases any resources allocated for an PIF instance.
+ *  FlushPIFRAMWrites: Raises the interrupt for any combined CPU writes.
+ *
+ *  SI register accesses and PIF RAM reads flush on their own. Hosts that
+ *  let the CPU observe MI_INTR_REG some other way call this first.
  * ========================================================================= */
 void
-DestroyPIF(struct PIFController *controller) {
-  if (controller->eepromFile) {
-    if (WriteEEPROMFile(controller))
-      printf("Failed to write the EEPROM file.\n");
+FlushPIFRAMWrites(struct PIFController *controller) {
+  if (controller->writesPending) {
+    controller->writesPending = false;
+
+    BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
+    controller->regs[SI_STATUS_REG] |= 0x1000;
   }
+}
 
-  free(controller);
+/* ============================================================================
+ *  GetPIFMemoryDescriptor: Describes a region so the host can read it inline.
+ *
+ *  Accesses that start at a special offset, and all writes, must still go
+ *  through the bus callbacks. While writes are combined or pipelined, SI
+ *  traffic is captured, or RAM is traced or counted, every RAM offset is
+ *  special, so reads still sync, flush and get logged; fetch the
+ *  descriptor again after changing any of these.
+ * ========================================================================= */
+int
+GetPIFMemoryDescriptor(const struct PIFController *controller,
+  enum PIFMemoryRegion region, struct PIFMemoryDescriptor *memory) {
+  if (region == PIF_MEMORY_ROM) {
+    memory->base = (const uint8_t*) controller->romShadow;
+    memory->address = PIF_ROM_BASE_ADDRESS;
+    memory->length = controller->romLength & ~3U;
+    memory->specialOffsets = 0;
+    memory->hostOrder = true;
+    return 0;
+  }
+
+  if (region == PIF_MEMORY_RAM) {
+    memory->base = controller->ram;
+    memory->address = PIF_RAM_BASE_ADDRESS;
+    memory->length = PIF_RAM_ADDRESS_LEN;
+    memory->hostOrder = false;
+
+    /* Reading 0x24 resets the status, and 0x3C returns it. */
+    memory->specialOffsets = (uint64_t) 1 << 0x24 |
+      (uint64_t) 1 << CIC_STATUS_BYTE;
+
+    if (controller->combineWrites || controller->worker ||
+      controller->capture || controller->stats ||
+      (controller->traceCategories & PIF_TRACE_RAM))
+      memory->specialOffsets = ~(uint64_t) 0;
+
+    return 0;
+  }
+
+  return -1;
 }
 
 /* ============================================================================
  *  InitPIF: Initializes the PIF controller.
  * ========================================================================= */
 static void
-InitPIF(struct PIFController *controller, const uint8_t *romImage) {
+InitPIF(struct PIFController *controller, struct PIFROMImage *romImage) {
+  unsigned i;
+
   debug("Initializing PIF.");
   memset(controller, 0, sizeof(*controller));
 
-  controller->rom = romImage;
+  controller->romImage = romImage;
+  controller->rom = romImage->map.base;
+  controller->romShadow = romImage->shadow;
+  controller->romLength = PIF_ROM_ADDRESS_LEN;
+  controller->eeprom = controller->eepromData;
+
+  /* Only the first port has a controller plugged in. */
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    controller->channels[i].accessory = PIF_ACCESSORY_MEMPAK;
+    DisconnectChannel(controller, i);
+  }
+
+  SetDeviceInput(controller, 0, KEYBOARD);
 }
 
 /* ============================================================================
@@ -130,21 +228,39 @@ int
 PIFRAMReadByte(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint8_t *data = (uint8_t*) _data, byte;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_READ8);
+
+  if (unlikely(controller->writesPending))
+    FlushPIFRAMWrites(controller);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMReadByte: Read from address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   if (address == 0x24)
     controller->status = 0x80;
 
-  else if (address == 0x3C) {
+  if (address == 0x3C)
     *data = controller->status;
-    return 0;
+
+  else {
+    memcpy(&byte, controller->ram + address, sizeof(byte));
+    *data = byte;
   }
 
-  memcpy(&byte, controller->ram + address, sizeof(byte));
-  *data = byte;
+  if (unlikely(controller->idle != NULL) &&
+    (address == 0x24 || address == 0x3C))
+    NotePIFStatusRead(controller, address, *data);
 
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_READ,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
+
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_READ, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_READ8, start);
   return 0;
 }
 
@@ -155,21 +271,39 @@ int
 PIFRAMReadHWord(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint16_t *data = (uint16_t*) _data, hword;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_READ16);
+
+  if (unlikely(controller->writesPending))
+    FlushPIFRAMWrites(controller);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMReadHWord: Read from address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   if (address == 0x24)
     controller->status = 0x80;
 
-  else if (address == 0x3C) {
+  if (address == 0x3C)
     *data = controller->status;
-    return 0;
+
+  else {
+    memcpy(&hword, controller->ram + address, sizeof(hword));
+    *data = ByteOrderSwap16(hword);
   }
 
-  memcpy(&hword, controller->ram + address, sizeof(hword));
-  *data = ByteOrderSwap16(hword);
+  if (unlikely(controller->idle != NULL) &&
+    (address == 0x24 || address == 0x3C))
+    NotePIFStatusRead(controller, address, *data);
+
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_READ,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
 
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_READ, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_READ16, start);
   return 0;
 }
 
@@ -180,21 +314,39 @@ int
 PIFRAMReadWord(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint32_t *data = (uint32_t*) _data, word;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_READ32);
+
+  if (unlikely(controller->writesPending))
+    FlushPIFRAMWrites(controller);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMReadWord: Read from address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   if (address == 0x24)
     controller->status = 0x80;
 
-  else if (address == 0x3C) {
+  if (address == 0x3C)
     *data = controller->status;
-    return 0;
+
+  else {
+    memcpy(&word, controller->ram + address, sizeof(word));
+    *data = ByteOrderSwap32(word);
   }
 
-  memcpy(&word, controller->ram + address, sizeof(word));
-  *data = ByteOrderSwap32(word);
+  if (unlikely(controller->idle != NULL) &&
+    (address == 0x24 || address == 0x3C))
+    NotePIFStatusRead(controller, address, *data);
+
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_READ,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
 
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_READ, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_READ32, start);
   return 0;
 }
 
@@ -205,15 +357,25 @@ int
 PIFRAMWriteByte(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint8_t *data = (uint8_t*) _data, byte;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_WRITE8);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMWriteByte: Write to address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   byte = *data;
   memcpy(controller->ram + address, &byte, sizeof(byte));
 
-  BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
-  controller->regs[SI_STATUS_REG] |= 0x1000;
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_WRITE,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
+
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_WRITE, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_WRITE8, start);
+  SignalPIFRAMWrite(controller);
   return 0;
 }
 
@@ -224,15 +386,25 @@ int
 PIFRAMWriteHWord(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint16_t *data = (uint16_t*) _data, hword;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_WRITE16);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMWriteHWord: Write to address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   hword = ByteOrderSwap16(*data);
   memcpy(controller->ram + address, &hword, sizeof(hword));
 
-  BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
-  controller->regs[SI_STATUS_REG] |= 0x1000;
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_WRITE,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
+
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_WRITE, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_WRITE16, start);
+  SignalPIFRAMWrite(controller);
   return 0;
 }
 
@@ -243,15 +415,25 @@ int
 PIFRAMWriteWord(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint32_t *data = (uint32_t*) _data, word;
+  uint64_t start = BeginPIFStats(controller, PIF_STATS_RAM_WRITE32);
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
 
-  debugarg("PIFRAMWriteWord: Write to address [0x%.8X]", address);
   address = address - PIF_RAM_BASE_ADDRESS;
 
   word = ByteOrderSwap32(*data);
   memcpy(controller->ram + address, &word, sizeof(word));
 
-  BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
-  controller->regs[SI_STATUS_REG] |= 0x1000;
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_RAM_WRITE,
+      sizeof(*data), PIF_RAM_BASE_ADDRESS + address, *data, NULL);
+  }
+
+  TracePIF(controller, PIF_TRACE_RAM, PIF_TRACE_RAM_WRITE, sizeof(*data),
+    PIF_RAM_BASE_ADDRESS + address, *data);
+  EndPIFStats(controller, PIF_STATS_RAM_WRITE32, start);
+  SignalPIFRAMWrite(controller);
   return 0;
 }
 
@@ -261,12 +443,10 @@ PIFRAMWriteWord(void *_controller, uint32_t address, void *_data) {
 int
 PIFROMRead(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
-	uint32_t *data = (uint32_t*) _data, word;
+	uint32_t *data = (uint32_t*) _data;
 
   address = address - PIF_ROM_BASE_ADDRESS;
-
-  memcpy(&word, controller->rom + address, sizeof(word));
-  *data = ByteOrderSwap32(word);
+  *data = controller->romShadow[address >> 2];
 
   return 0;
 }
@@ -290,9 +470,45 @@ PIFROMWrite(void *unused(controller), uint32_t address, void *unused(data)) {
  * ========================================================================= */
 void
 SetCICSeed(struct PIFController *pif, uint32_t seed) {
+  if (pif->worker)
+    SyncPIFWorker(pif->worker);
+
   seed = ByteOrderSwap32(seed);
 
   memcpy(pif->ram + 0x24, &seed, sizeof(seed));
+  pif->ramWritten = true;
+  ResetPIFIdle(pif);
+}
+
+/* ============================================================================
+ *  SetPIFWriteCombining: Defers the interrupt for CPU writes to PIF RAM.
+ *
+ *  The RAM is still written at once, but the SI interrupt (and status bit)
+ *  is raised only at the next flush, once for a run of stores.
+ * ========================================================================= */
+void
+SetPIFWriteCombining(struct PIFController *controller, bool enable) {
+  controller->combineWrites = enable;
+
+  if (!enable)
+    FlushPIFRAMWrites(controller);
+}
+
+/* ============================================================================
+ *  SignalPIFRAMWrite: Raises (or defers) the interrupt for a CPU write.
+ * ========================================================================= */
+static void
+SignalPIFRAMWrite(struct PIFController *controller) {
+  controller->ramWritten = true;
+  ResetPIFIdle(controller);
+
+  if (controller->combineWrites)
+    controller->writesPending = true;
+
+  else {
+    BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
+    controller->regs[SI_STATUS_REG] |= 0x1000;
+  }
 }
 
 /* ============================================================================
@@ -303,12 +519,17 @@ SIRegRead(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint32_t *data = (uint32_t*) _data;
 
+  if (unlikely(controller->writesPending))
+    FlushPIFRAMWrites(controller);
+
   address -= SI_REGS_BASE_ADDRESS;
   enum SIRegister reg = (enum SIRegister) (address / 4);
 
-  debugarg("SIRegRead: Reading from register [%s].", SIRegisterMnemonics[reg]);
   *data = controller->regs[reg];
 
+  TracePIF(controller, PIF_TRACE_SI, PIF_TRACE_REG_READ, sizeof(*data),
+    SI_REGS_BASE_ADDRESS + address, *data);
+
   return 0;
 }
 
@@ -320,10 +541,14 @@ SIRegWrite(void *_controller, uint32_t address, void *_data) {
 	struct PIFController *controller = (struct PIFController*) _controller;
 	uint32_t *data = (uint32_t*) _data;
 
+  if (unlikely(controller->writesPending))
+    FlushPIFRAMWrites(controller);
+
   address -= SI_REGS_BASE_ADDRESS;
   enum SIRegister reg = (enum SIRegister) (address / 4);
 
-  debugarg("SIRegWrite: Writing to register [%s].", SIRegisterMnemonics[reg]);
+  TracePIF(controller, PIF_TRACE_SI, PIF_TRACE_REG_WRITE, sizeof(*data),
+    SI_REGS_BASE_ADDRESS + address, *data);
 
   if (reg == SI_STATUS_REG) {
     BusClearRCPInterrupt(controller->bus, MI_INTR_SI);
@@ -338,6 +563,12 @@ SIRegWrite(void *_controller, uint32_t address, void *_data) {
   else
     controller->regs[reg] = *data;
 
+  /* Logged last, so the DMA it started (if any) comes first. */
+  if (unlikely(controller->capture != NULL)) {
+    CaptureSIEvent(controller->capture, SI_CAPTURE_REG_WRITE,
+      sizeof(*data), SI_REGS_BASE_ADDRESS + address, *data, NULL);
+  }
+
   return 0;
 }
 
@@ -12,11 +12,16 @@
 #define __PIF__CONTROLLER_H__
 #include "Address.h"
 #include "Common.h"
+#include "FileMap.h"
+#include "Input.h"
+#include "MemPak.h"
 
 #ifdef __cplusplus
 #include <cstdio>
+#include <cstring>
 #else
 #include <stdio.h>
+#include <string.h>
 #endif
 
 enum SIRegister {
@@ -26,6 +31,10 @@ enum SIRegister {
   NUM_SI_REGISTERS
 };
 
+/* 16 Kbit EEPROM, written in 8-byte blocks. */
+#define EEPROM_SIZE               2048
+#define EEPROM_BLOCK_SIZE         8
+
 typedef enum {
     INVALID = -1,
     KEYBOARD = 0,
@@ -35,30 +44,225 @@ typedef enum {
     WIIU = 4,
 } CONTROLTYPE;
 
-#ifndef NDEBUG
 extern const char *SIRegisterMnemonics[NUM_SI_REGISTERS];
-#endif
 
 struct BusController;
+struct InputMovie;
+struct InputSampler;
+struct PIFIdle;
+struct PIFROMImage;
+struct PIFStats;
+struct PIFTrace;
+struct PIFWorker;
+struct SaveArchive;
+struct SaveArchiveSlot;
+struct SaveFlusher;
+struct SaveImage;
+struct SICapture;
+struct SITiming;
+
+/* A command block, compiled into the commands it runs. */
+#define PIF_COMMAND_CACHE_SIZE    8
+#define PIF_MAX_COMMAND_OPS       (PIF_RAM_ADDRESS_LEN / 3)
+
+struct PIFCommandOp {
+  uint8_t channel;
+  uint8_t sendOffset;
+  uint8_t sendBytes;
+  uint8_t recvOffset;
+  uint8_t recvBytes;
+  uint8_t result;
+};
+
+struct PIFCommandBlock {
+  uint64_t hash;
+  uint8_t block[PIF_RAM_ADDRESS_LEN];
+  struct PIFCommandOp ops[PIF_MAX_COMMAND_OPS];
+  uint8_t numOps;
+  bool valid;
+
+  /* Channels read from (0x01) or queried (0x00/0xFF), and whether any
+   * save media is written. */
+  uint8_t polledChannels;
+  uint8_t statusChannels;
+  bool writesMedia;
+};
+
+/* The last response, for reuse while nothing it depends on changes. */
+#define PIF_NUM_CONTROLLERS       4
+
+struct PIFResponseMemo {
+  uint8_t command[PIF_RAM_ADDRESS_LEN];
+  uint8_t response[PIF_RAM_ADDRESS_LEN];
+  uint32_t inputGeneration[PIF_NUM_CONTROLLERS];
+  struct PIFCommandOp ops[PIF_MAX_COMMAND_OPS];
+  uint8_t numOps;
+  uint8_t polledChannels;
+  uint8_t statusChannels;
+  bool valid;
+};
+
+/* A joybus port and whatever is plugged into it. */
+enum PIFAccessory {
+  PIF_ACCESSORY_NONE,
+  PIF_ACCESSORY_MEMPAK,
+};
+
+/* A port is connected while it has a backend and its device is present.
+ * Its status (0x00) response is rebuilt whenever either changes. */
+struct PIFChannel {
+  struct PIFInputBackend backend;
+  CONTROLTYPE type;
+  enum PIFAccessory accessory;
+  uint8_t lastState[4];
+  uint8_t status[3];
+  bool attached;
+  bool present;
+  bool connected;
+};
+
+struct PIFChannelStats {
+  uint64_t polls;
+  uint64_t statusPolls;
+  bool connected;
+};
+
+/* A region the host may read directly; see GetPIFMemoryDescriptor. */
+enum PIFMemoryRegion {
+  PIF_MEMORY_ROM,
+  PIF_MEMORY_RAM,
+};
+
+struct PIFMemoryDescriptor {
+  const uint8_t *base;
+  uint32_t address;
+  uint32_t length;
+
+  /* Bit n is set if accesses starting at offsets n (mod 64) have side
+   * effects; a region without any has none set. */
+  uint64_t specialOffsets;
+
+  /* The ROM is shadowed as host order words; RAM stays big-endian. */
+  bool hostOrder;
+};
 
 struct PIFController {
   struct BusController *bus;
 
+  /* The ROM as mapped, and swapped to host order once up front; both
+   * are shared by every controller using the same image. */
+  struct PIFROMImage *romImage;
   const uint8_t *rom;
-  FILE *eepromFile;
+  const uint32_t *romShadow;
+  uint32_t romLength;
+
   uint32_t regs[NUM_SI_REGISTERS];
   uint32_t status;
 
   uint8_t command[PIF_RAM_ADDRESS_LEN];
   uint8_t ram[PIF_RAM_ADDRESS_LEN];
-  uint8_t eeprom[2048];
-  CONTROLTYPE input;
+  struct PIFChannel channels[PIF_NUM_CONTROLLERS];
+  struct PIFChannelStats channelStats[PIF_NUM_CONTROLLERS];
+
+  /* Channels the game has read from; only these are sampled. */
+  volatile uint32_t activeChannels;
+
+  /* Set while input is sampled off the emulation thread. */
+  struct InputSampler *sampler;
+
+  /* Set while controller reads are recorded or replayed. */
+  struct InputMovie *movie;
+
+  /* Set while SI traffic is logged. */
+  struct SICapture *capture;
+
+  /* Set while stats are collected (PIF_STATS builds only). */
+  struct PIFStats *stats;
+
+  /* Set while events are traced; see PIFTrace.h. */
+  struct PIFTrace *trace;
+  uint32_t traceCategories;
+
+  /* Set while DMAs complete through the host's scheduler. */
+  struct SITiming *timing;
+
+  /* Set while command blocks run on a worker; see PIFWorker.c. */
+  struct PIFWorker *worker;
+
+  /* Set while spinning on the status is detected; see PIFIdle.h. */
+  struct PIFIdle *idle;
+
+  struct PIFCommandBlock commandCache[PIF_COMMAND_CACHE_SIZE];
+  uint64_t commandCacheHits;
+  uint64_t commandCacheMisses;
+
+  struct PIFResponseMemo memo;
+  uint32_t inputGeneration[PIF_NUM_CONTROLLERS];
+  uint64_t memoHits;
+  bool memoizeResponses;
+  bool ramWritten;
+
+  /* Set to defer the interrupt for CPU writes until the next flush. */
+  bool combineWrites;
+  bool writesPending;
+
+  /* Points into eepromFile when mapped, else at eepromData. */
+  uint8_t *eeprom;
+  struct FileMap eepromFile;
+  uint64_t eepromDirty[EEPROM_SIZE / EEPROM_BLOCK_SIZE / 64];
+  uint8_t eepromData[EEPROM_SIZE];
+
+  /* Set while save media are handed to a background flusher. */
+  struct SaveFlusher *flusher;
+  struct SaveImage *eepromImage;
+
+  /* Set while save media live in a save archive slot. */
+  struct SaveArchive *archive;
+  struct SaveArchiveSlot *archiveSlot;
+  uint8_t archiveShared;
+
+  struct MemPak paks[MEMPAK_NUM_CHANNELS];
 };
 
 struct PIFController *CreatePIF(const char *);
 void DestroyPIF(struct PIFController *);
+void FlushPIFRAMWrites(struct PIFController *);
+int GetPIFMemoryDescriptor(const struct PIFController *,
+  enum PIFMemoryRegion, struct PIFMemoryDescriptor *);
+void SetCICSeed(struct PIFController *, uint32_t);
 void SetEEPROMFilename(struct PIFController *, const char *);
+void SetPIFWriteCombining(struct PIFController *, bool);
 void SetControlType(struct PIFController *, const char *);
+void SetChannelAccessory(struct PIFController *, unsigned,
+  enum PIFAccessory);
+int SetDeviceInput(struct PIFController *, unsigned, CONTROLTYPE);
+
+/* ============================================================================
+ *  ReadPIFMemoryWord: Loads an aligned word without calling into the PIF.
+ *
+ *  The address must lie in the region, as the host's bus has already
+ *  decoded it. Returns -1 for words with side effects; the host must then
+ *  fall back to the region's bus callback.
+ * ========================================================================= */
+static inline int
+ReadPIFMemoryWord(const struct PIFMemoryDescriptor *memory,
+  uint32_t address, uint32_t *data) {
+  uint32_t offset = address - memory->address;
+  const uint8_t *bytes = memory->base + offset;
+
+  if (memory->specialOffsets >> (offset & 63) & 1)
+    return -1;
+
+  if (memory->hostOrder)
+    memcpy(data, bytes, sizeof(*data));
+
+  else {
+    *data = (uint32_t) bytes[0] << 24 | bytes[1] << 16 |
+      bytes[2] << 8 | bytes[3];
+  }
+
+  return 0;
+}
 
 #endif
 
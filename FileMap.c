@@ -0,0 +1,341 @@
+/* ============================================================================
+ *  FileMap.c: Memory-mapped backing files.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "Common.h"
+#include "FileMap.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* ============================================================================
+ *  CloseFileMap: Unmaps a previously mapped file.
+ * ========================================================================= */
+void
+CloseFileMap(struct FileMap *map) {
+  if (map->base == NULL)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(map->base);
+#else
+  munmap(map->base, map->size);
+#endif
+
+  free(map->path);
+  memset(map, 0, sizeof(*map));
+}
+
+/* ============================================================================
+ *  OpenFileMap: Maps size bytes of a file into memory.
+ *
+ *  Writable mappings create the file if needed and grow it (zero-filled)
+ *  to size bytes. A size of zero maps the entire (existing) file.
+ * ========================================================================= */
+int
+OpenFileMap(struct FileMap *map, const char *path,
+  size_t size, enum FileMapMode mode) {
+  bool writable = mode != FILEMAP_READ_ONLY;
+  size_t pathLength = strlen(path) + 1;
+  void *base;
+
+#ifdef _WIN32
+  HANDLE file, mapping;
+  LARGE_INTEGER fileSize;
+  DWORD protect = mode == FILEMAP_SHARED ? PAGE_READWRITE
+    : mode == FILEMAP_PRIVATE ? PAGE_WRITECOPY : PAGE_READONLY;
+  DWORD access = mode == FILEMAP_SHARED ? FILE_MAP_WRITE
+    : mode == FILEMAP_PRIVATE ? FILE_MAP_COPY : FILE_MAP_READ;
+
+  memset(map, 0, sizeof(*map));
+
+  if ((file = CreateFileA(path, GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, writable ? OPEN_ALWAYS
+    : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE) {
+    debug("FileMap: Failed to open backing file.");
+    return -1;
+  }
+
+  if (!GetFileSizeEx(file, &fileSize)) {
+    CloseHandle(file);
+    return -1;
+  }
+
+  map->fileSize = (size_t) fileSize.QuadPart;
+  if (size == 0 && (size = map->fileSize) == 0) {
+    CloseHandle(file);
+    return -1;
+  }
+
+  /* Mapping objects larger than the file extend it. */
+  if (mode == FILEMAP_PRIVATE && map->fileSize < size) {
+    CloseHandle(CreateFileMappingA(file, NULL, PAGE_READWRITE,
+      (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL));
+  }
+
+  mapping = CreateFileMappingA(file, NULL, protect,
+    (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+
+  CloseHandle(file);
+
+  if (mapping == NULL) {
+    debug("FileMap: Failed to create file mapping.");
+    return -1;
+  }
+
+  base = MapViewOfFile(mapping, access, 0, 0, size);
+  CloseHandle(mapping);
+
+  if (base == NULL) {
+    debug("FileMap: Failed to map view of file.");
+    return -1;
+  }
+#else
+  struct stat st;
+  int fd;
+
+  memset(map, 0, sizeof(*map));
+
+  if ((fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0) {
+    debug("FileMap: Failed to open backing file.");
+    return -1;
+  }
+
+  if (fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+
+  map->fileSize = (size_t) st.st_size;
+  if (size == 0 && (size = map->fileSize) == 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (writable && map->fileSize < size && ftruncate(fd, (off_t) size)) {
+    debug("FileMap: Failed to resize backing file.");
+
+    close(fd);
+    return -1;
+  }
+
+  base = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+    mode == FILEMAP_PRIVATE ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+
+  /* The mapping holds its own reference to the file. */
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    debug("FileMap: Failed to map backing file.");
+    return -1;
+  }
+#endif
+
+  if ((map->path = (char *) malloc(pathLength)) != NULL)
+    memcpy(map->path, path, pathLength);
+
+  map->base = (uint8_t *) base;
+  map->size = size;
+  return 0;
+}
+
+/* ============================================================================
+ *  SyncFileMap: Writes a range of a shared mapping back to its file.
+ * ========================================================================= */
+int
+SyncFileMap(struct FileMap *map, size_t offset, size_t length) {
+#ifdef _WIN32
+  return FlushViewOfFile(map->base + offset, length) ? 0 : -1;
+#else
+  size_t pageMask = (size_t) sysconf(_SC_PAGESIZE) - 1;
+  size_t start = offset & ~pageMask;
+
+  return msync(map->base + start, offset - start + length, MS_SYNC);
+#endif
+}
+
+/* ============================================================================
+ *  WriteFileAtomic: Replaces a file's contents in a crash-consistent way.
+ *
+ *  The data goes to a temporary file beside the target, is forced to disk,
+ *  and is then renamed over the target; readers see either the old or the
+ *  new contents, never a mix of the two.
+ * ========================================================================= */
+int
+WriteFileAtomic(const char *path, const void *data, size_t size) {
+  size_t pathLength = strlen(path);
+  const uint8_t *cur = (const uint8_t *) data;
+  char *temp;
+  int status = -1;
+
+#ifdef _WIN32
+  HANDLE file;
+#else
+  char *slash;
+  int fd;
+#endif
+
+  if ((temp = (char *) malloc(pathLength + sizeof(".tmp"))) == NULL)
+    return -1;
+
+  memcpy(temp, path, pathLength);
+  memcpy(temp + pathLength, ".tmp", sizeof(".tmp"));
+
+#ifdef _WIN32
+  if ((file = CreateFileA(temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE) {
+    free(temp);
+    return -1;
+  }
+
+  while (size > 0) {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD) size, written;
+
+    if (!WriteFile(file, cur, chunk, &written, NULL) || written == 0)
+      break;
+
+    cur += written;
+    size -= written;
+  }
+
+  if (size == 0 && FlushFileBuffers(file))
+    status = 0;
+
+  CloseHandle(file);
+
+  if (status == 0 && !MoveFileExA(temp, path,
+    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    status = -1;
+#else
+  if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    free(temp);
+    return -1;
+  }
+
+  while (size > 0) {
+    ssize_t written = write(fd, cur, size);
+
+    if (written <= 0)
+      break;
+
+    cur += written;
+    size -= (size_t) written;
+  }
+
+  if (size == 0 && fsync(fd) == 0)
+    status = 0;
+
+  close(fd);
+
+  if (status == 0 && rename(temp, path))
+    status = -1;
+
+  /* Make the rename itself durable. */
+  if (status == 0) {
+    if ((slash = strrchr(temp, '/')) != NULL) {
+      *slash = '\0';
+      fd = open(slash == temp ? "/" : temp, O_RDONLY);
+    }
+
+    else
+      fd = open(".", O_RDONLY);
+
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
+    }
+  }
+#endif
+
+  if (status)
+    remove(temp);
+
+  free(temp);
+  return status;
+}
+
+/* ============================================================================
+ *  WriteFileInPlace: Overwrites a file's contents and forces them to disk.
+ *
+ *  Unlike WriteFileAtomic, this works on Windows while the file is mapped
+ *  (a mapped file cannot be replaced there), at the cost of leaving a mix
+ *  of old and new contents should the host crash midway.
+ * ========================================================================= */
+int
+WriteFileInPlace(const char *path, const void *data, size_t size) {
+  const uint8_t *cur = (const uint8_t *) data;
+  int status = -1;
+
+#ifdef _WIN32
+  HANDLE file;
+
+  if ((file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ |
+    FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+    NULL)) == INVALID_HANDLE_VALUE)
+    return -1;
+
+  while (size > 0) {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD) size, written;
+
+    if (!WriteFile(file, cur, chunk, &written, NULL) || written == 0)
+      break;
+
+    cur += written;
+    size -= written;
+  }
+
+  if (size == 0 && FlushFileBuffers(file))
+    status = 0;
+
+  CloseHandle(file);
+#else
+  int fd;
+
+  if ((fd = open(path, O_WRONLY)) < 0)
+    return -1;
+
+  while (size > 0) {
+    ssize_t written = write(fd, cur, size);
+
+    if (written <= 0)
+      break;
+
+    cur += written;
+    size -= (size_t) written;
+  }
+
+  if (size == 0 && fsync(fd) == 0)
+    status = 0;
+
+  close(fd);
+#endif
+
+  return status;
+}
+
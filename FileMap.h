@@ -0,0 +1,45 @@
+/* ============================================================================
+ *  FileMap.h: Memory-mapped backing files.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__FILEMAP_H__
+#define __PIF__FILEMAP_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+enum FileMapMode {
+  FILEMAP_READ_ONLY,
+  FILEMAP_SHARED,
+
+  /* Copy-on-write: changes never reach the file. */
+  FILEMAP_PRIVATE,
+};
+
+struct FileMap {
+  uint8_t *base;
+  size_t size;
+  char *path;
+
+  /* Length of the file before it was mapped. */
+  size_t fileSize;
+};
+
+int OpenFileMap(struct FileMap *, const char *, size_t, enum FileMapMode);
+void CloseFileMap(struct FileMap *);
+int SyncFileMap(struct FileMap *, size_t, size_t);
+int WriteFileAtomic(const char *, const void *, size_t);
+int WriteFileInPlace(const char *, const void *, size_t);
+
+#endif
+
@@ -0,0 +1,250 @@
+/* ============================================================================
+ *  HeadlessInput.c: Scripted controller input without a window system.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Actions.h"
+#include "Common.h"
+#include "Controller.h"
+#include "HeadlessInput.h"
+#include "Input.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  Each channel holds a list of state changes, keyed by the number of
+ *  times the channel has been polled. A state holds until the next event
+ *  for its channel, so a script only needs to list presses and releases.
+ * ========================================================================= */
+struct HeadlessInputEvent {
+  uint64_t poll;
+  uint32_t state;
+};
+
+struct HeadlessInputChannel {
+  struct HeadlessInputEvent *events;
+  size_t count, capacity, next;
+
+  uint64_t polls;
+  uint32_t state;
+};
+
+struct HeadlessInput {
+  struct PIFController *controller;
+  struct HeadlessInputChannel channels[PIF_NUM_CONTROLLERS];
+};
+
+static void PollHeadlessInput(void *, unsigned, uint8_t *);
+static uint32_t PackHeadlessInput(uint16_t, int8_t, int8_t);
+
+/* ============================================================================
+ *  AddHeadlessInputEvent: Sets a channel's state from its poll'th read on.
+ *
+ *  Events for a channel must be added in order of poll.
+ * ========================================================================= */
+int
+AddHeadlessInputEvent(struct HeadlessInput *input, unsigned channel,
+  uint64_t poll, uint16_t buttons, int8_t x, int8_t y) {
+  struct HeadlessInputChannel *ch;
+
+  if (channel >= PIF_NUM_CONTROLLERS)
+    return -1;
+
+  ch = input->channels + channel;
+
+  if (ch->count && ch->events[ch->count - 1].poll > poll) {
+    debug("HeadlessInput: Events must be added in order.");
+    return -1;
+  }
+
+  if (ch->count == ch->capacity) {
+    size_t capacity = ch->capacity ? ch->capacity * 2 : 64;
+    struct HeadlessInputEvent *events;
+
+    if ((events = (struct HeadlessInputEvent *) realloc(ch->events,
+      capacity * sizeof(*events))) == NULL)
+      return -1;
+
+    ch->events = events;
+    ch->capacity = capacity;
+  }
+
+  ch->events[ch->count].poll = poll;
+  ch->events[ch->count].state = PackHeadlessInput(buttons, x, y);
+  ch->count++;
+  return 0;
+}
+
+/* ============================================================================
+ *  AttachHeadlessInput: Plugs scripted controllers into a mask of ports.
+ *
+ *  The caller keeps ownership; disconnect the ports or destroy the
+ *  controller before destroying the input.
+ * ========================================================================= */
+void
+AttachHeadlessInput(struct PIFController *controller,
+  struct HeadlessInput *input, unsigned channels) {
+  struct PIFInputBackend backend;
+  unsigned i;
+
+  memset(&backend, 0, sizeof(backend));
+  backend.poll = PollHeadlessInput;
+  backend.opaque = input;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (channels & (1 << i))
+      SetInputBackend(controller, i, &backend);
+  }
+
+  input->controller = controller;
+}
+
+/* ============================================================================
+ *  CreateHeadlessInput: Creates an idle, empty input script.
+ * ========================================================================= */
+struct HeadlessInput *
+CreateHeadlessInput(void) {
+  return (struct HeadlessInput *) calloc(1, sizeof(struct HeadlessInput));
+}
+
+/* ============================================================================
+ *  DestroyHeadlessInput: Releases an input script.
+ * ========================================================================= */
+void
+DestroyHeadlessInput(struct HeadlessInput *input) {
+  unsigned i;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++)
+    free(input->channels[i].events);
+
+  free(input);
+}
+
+/* ============================================================================
+ *  LoadHeadlessInputScript: Appends the events listed in a text file.
+ *
+ *  One event per line: "<poll> <channel> <buttons> <x> <y>", where buttons
+ *  is the 16-bit button mask in hex (see BUTTON_* in Definitions.h) and
+ *  x/y are signed stick positions. Blank lines and '#' comments are
+ *  skipped. For example, "120 0 8000 0 0" presses A on the 120th poll.
+ * ========================================================================= */
+int
+LoadHeadlessInputScript(struct HeadlessInput *input, const char *path) {
+  unsigned long long poll;
+  unsigned line = 0;
+  char buffer[256];
+  FILE *script;
+
+  if ((script = fopen(path, "r")) == NULL) {
+    debug("HeadlessInput: Failed to open the script.");
+    return -1;
+  }
+
+  while (fgets(buffer, sizeof(buffer), script)) {
+    unsigned channel, buttons;
+    int x, y;
+    char *c;
+
+    line++;
+
+    for (c = buffer; *c == ' ' || *c == '\t'; c++);
+
+    if (*c == '#' || *c == '\n' || *c == '\r' || *c == '\0')
+      continue;
+
+    if (sscanf(c, "%llu %u %x %d %d",
+      &poll, &channel, &buttons, &x, &y) != 5 || buttons > 0xFFFF ||
+      x < -128 || x > 127 || y < -128 || y > 127 ||
+      AddHeadlessInputEvent(input, channel, poll, buttons, x, y)) {
+      debugarg("HeadlessInput: Bad event on line %u.", line);
+
+      fclose(script);
+      return -1;
+    }
+  }
+
+  fclose(script);
+  return 0;
+}
+
+/* ============================================================================
+ *  PackHeadlessInput: Lays out a state as a joybus 0x01 response.
+ * ========================================================================= */
+static uint32_t
+PackHeadlessInput(uint16_t buttons, int8_t x, int8_t y) {
+  uint8_t state[4];
+  uint32_t word;
+
+  state[0] = buttons >> 8;
+  state[1] = buttons;
+  state[2] = x;
+  state[3] = y;
+
+  memcpy(&word, state, sizeof(word));
+  return word;
+}
+
+/* ============================================================================
+ *  PollHeadlessInput: Applies any events that are due and reads a state.
+ * ========================================================================= */
+static void
+PollHeadlessInput(void *opaque, unsigned channel, uint8_t *state) {
+  struct HeadlessInput *input = (struct HeadlessInput *) opaque;
+  struct HeadlessInputChannel *ch = input->channels + channel;
+
+  while (ch->next < ch->count && ch->events[ch->next].poll <= ch->polls)
+    ch->state = ch->events[ch->next++].state;
+
+  ch->polls++;
+  memcpy(state, &ch->state, sizeof(ch->state));
+
+  /* Keep memoized responses from skipping polls the script counts. */
+  if (ch->next < ch->count && input->controller)
+    NotifyPIFInputChanged(input->controller, channel);
+}
+
+/* ============================================================================
+ *  RewindHeadlessInput: Starts the script over from the first poll.
+ * ========================================================================= */
+void
+RewindHeadlessInput(struct HeadlessInput *input) {
+  unsigned i;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    input->channels[i].next = 0;
+    input->channels[i].polls = 0;
+    input->channels[i].state = 0;
+
+    if (input->controller)
+      NotifyPIFInputChanged(input->controller, i);
+  }
+}
+
+/* ============================================================================
+ *  SetHeadlessInput: Sets a channel's state until its next event.
+ * ========================================================================= */
+void
+SetHeadlessInput(struct HeadlessInput *input, unsigned channel,
+  uint16_t buttons, int8_t x, int8_t y) {
+  if (channel >= PIF_NUM_CONTROLLERS)
+    return;
+
+  input->channels[channel].state = PackHeadlessInput(buttons, x, y);
+
+  if (input->controller)
+    NotifyPIFInputChanged(input->controller, channel);
+}
+
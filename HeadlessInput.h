@@ -0,0 +1,31 @@
+/* ============================================================================
+ *  HeadlessInput.h: Scripted controller input without a window system.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__HEADLESSINPUT_H__
+#define __PIF__HEADLESSINPUT_H__
+#include "Common.h"
+
+struct HeadlessInput;
+struct PIFController;
+
+struct HeadlessInput *CreateHeadlessInput(void);
+void DestroyHeadlessInput(struct HeadlessInput *);
+void AttachHeadlessInput(struct PIFController *, struct HeadlessInput *,
+  unsigned);
+
+int AddHeadlessInputEvent(struct HeadlessInput *, unsigned, uint64_t,
+  uint16_t, int8_t, int8_t);
+int LoadHeadlessInputScript(struct HeadlessInput *, const char *);
+void RewindHeadlessInput(struct HeadlessInput *);
+void SetHeadlessInput(struct HeadlessInput *, unsigned,
+  uint16_t, int8_t, int8_t);
+
+#endif
+
@@ -0,0 +1,406 @@
+/* ============================================================================
+ *  Input.c: Host input devices.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Actions.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Input.h"
+#include "InputMapping.h"
+#include "InputSampler.h"
+#include "PIFWorker.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#ifndef PIF_NO_GLFW
+#ifdef GLFW3
+#include <GLFW/glfw3.h>
+#else
+#include <GL/glfw.h>
+#endif
+#endif
+
+/* ============================================================================
+ *  A device backend reads the keys, buttons and axes named by a compiled
+ *  mapping and runs them through its tables. The mapping can be swapped
+ *  while the emulator runs; the one it replaces is only freed once the
+ *  worker and the sampler, which poll on threads of their own, are done
+ *  with it.
+ * ========================================================================= */
+struct InputMapper {
+  void *volatile map;
+};
+
+static void PollNoInput(void *, unsigned, uint8_t *);
+static void RefreshChannel(struct PIFController *, unsigned);
+
+#ifndef PIF_NO_GLFW
+/* Profile names in mapping files, indexed by CONTROLTYPE. */
+static const char *const InputDeviceNames[] = {
+  "keyboard",
+  "mayflash64",
+  "retrolink",
+  "x360",
+  "wiiu",
+};
+
+static bool IsJoystickPresent(unsigned);
+static void PollMappedDevice(void *, unsigned, uint8_t *);
+static void ReadJoystick(unsigned, float *, unsigned, uint8_t *, unsigned);
+static void ReleaseInputMapper(void *);
+#endif
+
+/* ============================================================================
+ *  DisconnectChannel: Unplugs whatever is connected to a joybus port.
+ * ========================================================================= */
+void
+DisconnectChannel(struct PIFController *controller, unsigned channel) {
+  struct PIFChannel *port;
+
+  if (channel >= PIF_NUM_CONTROLLERS)
+    return;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  port = controller->channels + channel;
+
+  if (port->backend.release)
+    port->backend.release(port->backend.opaque);
+
+  memset(&port->backend, 0, sizeof(port->backend));
+
+  port->backend.poll = PollNoInput;
+  port->type = INVALID;
+  port->attached = false;
+
+  RefreshChannel(controller, channel);
+}
+
+#ifndef PIF_NO_GLFW
+/* ============================================================================
+ *  IsJoystickPresent: Asks GLFW whether a joystick is plugged in.
+ * ========================================================================= */
+static bool
+IsJoystickPresent(unsigned joystick) {
+#ifdef GLFW3
+  return glfwJoystickPresent(GLFW_JOYSTICK_1 + joystick) == GL_TRUE;
+#else
+  return glfwGetJoystickParam(GLFW_JOYSTICK_1 + joystick, GLFW_PRESENT) != 0;
+#endif
+}
+#endif
+
+/* ============================================================================
+ *  LoadInputMapping: (Re)loads a port's device mapping from a file.
+ *
+ *  Safe to call while the emulator runs, from the emulation thread. The
+ *  current mapping is kept if the file does not parse.
+ * ========================================================================= */
+int
+LoadInputMapping(struct PIFController *controller, unsigned channel,
+  const char *path) {
+#ifndef PIF_NO_GLFW
+  struct InputMapper *mapper;
+  struct InputMap *map, *old;
+  struct PIFChannel *port;
+
+  if (channel >= PIF_NUM_CONTROLLERS)
+    return -1;
+
+  port = controller->channels + channel;
+
+  if (port->backend.poll != PollMappedDevice)
+    return -1;
+
+  mapper = (struct InputMapper *) port->backend.opaque;
+
+  if ((map = LoadInputMap(path, InputDeviceNames[port->type])) == NULL)
+    return -1;
+
+  old = (struct InputMap *) mapper->map;
+  StorePIFAtomicPointer(&mapper->map, map);
+
+  /* A poll started before the swap may still be reading the old one. */
+  if (controller->worker)
+    SyncPIFWorker(controller->worker);
+
+  if (controller->sampler)
+    SyncInputSampler(controller->sampler);
+
+  free(old);
+
+  NotifyPIFInputChanged(controller, channel);
+  return 0;
+#else
+  (void) controller;
+  (void) channel;
+  (void) path;
+
+  return -1;
+#endif
+}
+
+/* ============================================================================
+ *  NotifyJoystickHotplug: Plugs or unplugs the ports reading a joystick.
+ *
+ *  Hosts call this from their window system's joystick events (e.g., a
+ *  glfwSetJoystickCallback handler), so unplugged joysticks are neither
+ *  polled nor asked whether they are there.
+ * ========================================================================= */
+void
+NotifyJoystickHotplug(struct PIFController *controller, unsigned joystick,
+  bool present) {
+  unsigned i;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    const struct PIFChannel *port = controller->channels + i;
+
+    if (port->attached && port->type > KEYBOARD && i == joystick)
+      SetChannelPresent(controller, i, present);
+  }
+}
+
+#ifndef PIF_NO_GLFW
+/* ============================================================================
+ *  PollMappedDevice: Reads a host device through GLFW and its mapping.
+ *
+ *  On most platforms, this must be called from the thread that pumps the
+ *  window system's events.
+ * ========================================================================= */
+static void
+PollMappedDevice(void *opaque, unsigned channel, uint8_t *state) {
+  struct InputMapper *mapper = (struct InputMapper *) opaque;
+  const struct InputMap *map = (const struct InputMap *)
+    LoadPIFAtomicPointer(&mapper->map);
+
+  uint8_t buttons[INPUT_MAX_SOURCES];
+  float axes[INPUT_MAX_AXES];
+  uint64_t sources = 0;
+  unsigned i;
+
+  if (map->numKeys) {
+    for (i = 0; i < map->numKeys; i++) {
+#ifdef GLFW3
+      sources |= (uint64_t) (glfwGetKey(glfwGetCurrentContext(),
+        map->keys[i]) == GLFW_PRESS) << i;
+#else
+      sources |= (uint64_t) (glfwGetKey(map->keys[i]) == GLFW_PRESS) << i;
+#endif
+    }
+  }
+
+  else {
+    ReadJoystick(channel, axes, map->numAxes, buttons, map->numButtons);
+
+    for (i = 0; i < map->numButtons; i++)
+      sources |= (uint64_t) (buttons[i] != 0) << i;
+  }
+
+  ApplyInputMap(map, sources, axes, state);
+}
+#endif
+
+/* ============================================================================
+ *  PollNoInput: Reports a controller with nothing pressed.
+ * ========================================================================= */
+static void
+PollNoInput(void *opaque, unsigned channel, uint8_t *state) {
+  (void) opaque;
+  (void) channel;
+
+  memset(state, 0, 4);
+}
+
+/* ============================================================================
+ *  RefreshChannel: Rebuilds a port's state after a device or pak change.
+ * ========================================================================= */
+static void
+RefreshChannel(struct PIFController *controller, unsigned channel) {
+  struct PIFChannel *port = controller->channels + channel;
+
+  port->connected = port->attached && port->present;
+
+  port->status[0] = 0x05;
+  port->status[1] = 0x00;
+  port->status[2] = port->accessory == PIF_ACCESSORY_NONE ? 0x02 : 0x01;
+
+  if (!port->connected)
+    memset(port->lastState, 0, sizeof(port->lastState));
+
+  controller->memo.valid = false;
+  NotifyPIFInputChanged(controller, channel);
+}
+
+#ifndef PIF_NO_GLFW
+/* ============================================================================
+ *  ReadJoystick: Reads a joystick's axes and buttons; missing ones read 0.
+ * ========================================================================= */
+static void
+ReadJoystick(unsigned channel, float *axes, unsigned numAxes,
+  uint8_t *buttons, unsigned numButtons) {
+#ifdef GLFW3
+  const unsigned char *joyButtons;
+  const float *joyAxes;
+  int count;
+#endif
+
+  memset(axes, 0, numAxes * sizeof(*axes));
+  memset(buttons, 0, numButtons);
+
+#ifdef GLFW3
+  if ((joyAxes = glfwGetJoystickAxes(GLFW_JOYSTICK_1 + channel, &count))) {
+    memcpy(axes, joyAxes, ((unsigned) count < numAxes
+      ? (unsigned) count : numAxes) * sizeof(*axes));
+  }
+
+  if ((joyButtons = glfwGetJoystickButtons(GLFW_JOYSTICK_1 + channel,
+    &count))) {
+    memcpy(buttons, joyButtons, (unsigned) count < numButtons
+      ? (unsigned) count : numButtons);
+  }
+#else
+  if (numAxes)
+    glfwGetJoystickPos(GLFW_JOYSTICK_1 + channel, axes, numAxes);
+
+  if (numButtons)
+    glfwGetJoystickButtons(GLFW_JOYSTICK_1 + channel, buttons, numButtons);
+#endif
+}
+
+/* ============================================================================
+ *  ReleaseInputMapper: Frees a device backend and its mappings.
+ * ========================================================================= */
+static void
+ReleaseInputMapper(void *opaque) {
+  struct InputMapper *mapper = (struct InputMapper *) opaque;
+
+  free(mapper->map);
+  free(mapper);
+}
+#endif
+
+/* ============================================================================
+ *  SetChannelAccessory: Plugs an accessory into a port's controller.
+ * ========================================================================= */
+void
+SetChannelAccessory(struct PIFController *controller, unsigned channel,
+  enum PIFAccessory accessory) {
+  if (channel < PIF_NUM_CONTROLLERS) {
+    if (unlikely(controller->worker != NULL))
+      SyncPIFWorker(controller->worker);
+
+    controller->channels[channel].accessory = accessory;
+    RefreshChannel(controller, channel);
+  }
+}
+
+/* ============================================================================
+ *  SetChannelPresent: Handles a hotplug event for a port's device.
+ *
+ *  A port whose device is gone answers as an empty port until it comes
+ *  back, without calling into its backend. Must be called from the thread
+ *  that runs the PIF.
+ * ========================================================================= */
+void
+SetChannelPresent(struct PIFController *controller, unsigned channel,
+  bool present) {
+  if (channel < PIF_NUM_CONTROLLERS &&
+    controller->channels[channel].present != present) {
+    if (unlikely(controller->worker != NULL))
+      SyncPIFWorker(controller->worker);
+
+    controller->channels[channel].present = present;
+    RefreshChannel(controller, channel);
+  }
+}
+
+/* ============================================================================
+ *  SetDeviceInput: Connects a host device (through GLFW) to a port.
+ *
+ *  The device starts out with its built-in mapping. Without GLFW
+ *  (PIF_NO_GLFW), the port is left disconnected and -1 is returned.
+ * ========================================================================= */
+int
+SetDeviceInput(struct PIFController *controller, unsigned channel,
+  CONTROLTYPE type) {
+#ifndef PIF_NO_GLFW
+  struct PIFInputBackend backend;
+
+  if (type >= KEYBOARD && type <= WIIU) {
+    struct InputMapper *mapper;
+
+    if ((mapper = (struct InputMapper *) calloc(1, sizeof(*mapper))) &&
+      (mapper->map = CompileInputMap(GetDefaultInputMappings(),
+      InputDeviceNames[type])) != NULL) {
+      memset(&backend, 0, sizeof(backend));
+      backend.poll = PollMappedDevice;
+      backend.release = ReleaseInputMapper;
+      backend.opaque = mapper;
+
+      if (SetInputBackend(controller, channel, &backend)) {
+        ReleaseInputMapper(mapper);
+        return -1;
+      }
+
+      controller->channels[channel].type = type;
+
+      /* Joysticks come and go through NotifyJoystickHotplug from here. */
+      if (type != KEYBOARD)
+        SetChannelPresent(controller, channel, IsJoystickPresent(channel));
+
+      return 0;
+    }
+
+    free(mapper);
+  }
+
+  debug("Input: Failed to set up the input device.");
+#else
+  (void) type;
+#endif
+
+  DisconnectChannel(controller, channel);
+  return -1;
+}
+
+/* ============================================================================
+ *  SetInputBackend: Connects a controller read through backend to a port.
+ *
+ *  The previous backend's release function, if any, is called. Backends
+ *  should be set before an input sampler is created for the controller.
+ * ========================================================================= */
+int
+SetInputBackend(struct PIFController *controller, unsigned channel,
+  const struct PIFInputBackend *backend) {
+  struct PIFChannel *port;
+
+  if (channel >= PIF_NUM_CONTROLLERS)
+    return -1;
+
+  DisconnectChannel(controller, channel);
+  port = controller->channels + channel;
+
+  if (backend->poll)
+    port->backend = *backend;
+
+  port->attached = true;
+  port->present = true;
+
+  RefreshChannel(controller, channel);
+  return 0;
+}
+
@@ -0,0 +1,32 @@
+/* ============================================================================
+ *  Input.h: Host input devices.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__INPUT_H__
+#define __PIF__INPUT_H__
+#include "Common.h"
+
+struct PIFController;
+
+/* Fills in a channel's 4-byte controller state (a joybus 0x01 response). */
+struct PIFInputBackend {
+  void (*poll)(void *, unsigned, uint8_t *);
+  void (*release)(void *);
+  void *opaque;
+};
+
+void DisconnectChannel(struct PIFController *, unsigned);
+int LoadInputMapping(struct PIFController *, unsigned, const char *);
+void NotifyJoystickHotplug(struct PIFController *, unsigned, bool);
+void SetChannelPresent(struct PIFController *, unsigned, bool);
+int SetInputBackend(struct PIFController *, unsigned,
+  const struct PIFInputBackend *);
+
+#endif
+
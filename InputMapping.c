@@ -0,0 +1,625 @@
+/* ============================================================================
+ *  InputMapping.c: Host input mappings, compiled into lookup tables.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "InputMapping.h"
+
+#ifdef __cplusplus
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#ifndef PIF_NO_GLFW
+#ifdef GLFW3
+#include <GLFW/glfw3.h>
+#else
+#include <GL/glfw.h>
+#endif
+#endif
+
+/* ============================================================================
+ *  Mapping files hold one or more profiles, each starting with a line
+ *  "device <name>" (keyboard, mayflash64, retrolink, x360 or wiiu). In a
+ *  profile, each line maps a source to a button:
+ *
+ *    <button> = key <name>           keyboard key, e.g. "key X", "key UP"
+ *    <button> = button <n>           joystick button n
+ *    <button> = axis+ <n> <t>        joystick axis n above +t
+ *    <button> = axis- <n> <t>        joystick axis n below -t
+ *
+ *  where <button> is one of A, B, Z, Start, DUp, DDown, DLeft, DRight, L,
+ *  R, CUp, CDown, CLeft, CRight, or StickUp, StickDown, StickLeft,
+ *  StickRight and Modifier, which only drive digital sticks. Several
+ *  sources may press the same button. Sticks are given by:
+ *
+ *    stick <X|Y> axis <n> [deadzone <d>] [range <r>] [invert]
+ *    stick <X|Y> digital <full> [<modified>]
+ *
+ *  Analog sticks scale |axis| beyond the deadzone onto [0, range];
+ *  digital sticks deflect by full, or by modified while Modifier is held.
+ *  Everything after a '#' is a comment.
+ * ========================================================================= */
+static const char DefaultInputMappings[] =
+  "device keyboard\n"
+  "Modifier = key LSHIFT\n"
+  "Modifier = key RSHIFT\n"
+  "StickRight = key RIGHT\n"
+  "StickLeft = key LEFT\n"
+  "StickUp = key UP\n"
+  "StickDown = key DOWN\n"
+  "stick X digital 114 38\n"
+  "stick Y digital 114 38\n"
+  "CUp = key HOME\n"
+  "CDown = key END\n"
+  "CLeft = key DEL\n"
+  "CRight = key PAGEDOWN\n"
+  "L = key A\n"
+  "R = key S\n"
+  "A = key X\n"
+  "B = key C\n"
+  "Z = key Z\n"
+  "Start = key ENTER\n"
+  "DUp = key KP_8\n"
+  "DDown = key KP_2\n"
+  "DLeft = key KP_4\n"
+  "DRight = key KP_6\n"
+
+  "device mayflash64\n"
+  "stick X axis 0\n"
+  "stick Y axis 1\n"
+  "CDown = axis+ 2 0.5\n"
+  "CUp = axis- 2 0.5\n"
+  "CLeft = axis+ 3 0.5\n"
+  "CRight = axis- 3 0.5\n"
+  "L = button 6\n"
+  "R = button 7\n"
+  "A = button 1\n"
+  "B = button 2\n"
+  "Z = button 8\n"
+  "Start = button 9\n"
+  "DUp = button 12\n"
+  "DDown = button 14\n"
+  "DLeft = button 15\n"
+  "DRight = button 13\n"
+
+  "device retrolink\n"
+  "stick X axis 0\n"
+  "stick Y axis 1\n"
+  "CUp = button 0\n"
+  "CRight = button 1\n"
+  "CDown = button 2\n"
+  "CLeft = button 3\n"
+  "L = button 4\n"
+  "R = button 5\n"
+  "A = button 6\n"
+  "Z = button 7\n"
+  "B = button 8\n"
+  "Start = button 9\n"
+
+  "device x360\n"
+  "stick X axis 0\n"
+  "stick Y axis 1\n"
+  "CDown = axis+ 3 0.75\n"
+  "CUp = axis- 3 0.75\n"
+  "CLeft = axis- 4 0.75\n"
+  "CRight = axis+ 4 0.75\n"
+  "L = button 4\n"
+  "R = axis- 2 0.75\n"
+  "A = button 0\n"
+  "B = button 1\n"
+  "Z = axis+ 2 0.75\n"
+  "Start = button 7\n"
+
+  "device wiiu\n"
+  "stick X axis 0\n"
+  "stick Y axis 1\n"
+  "CDown = axis- 3 0.75\n"
+  "CUp = axis+ 3 0.75\n"
+  "CLeft = axis- 2 0.75\n"
+  "CRight = axis+ 2 0.75\n"
+  "L = button 6\n"
+  "R = button 5\n"
+  "A = button 1\n"
+  "B = button 0\n"
+  "Z = button 4\n"
+  "Start = button 9\n"
+  "DUp = button 13\n"
+  "DDown = button 14\n"
+  "DLeft = button 15\n"
+  "DRight = button 16\n";
+
+/* Bits of a compiled mapping's output word. */
+#define INPUT_STICK_RIGHT         16
+#define INPUT_STICK_LEFT          17
+#define INPUT_STICK_UP            18
+#define INPUT_STICK_DOWN          19
+#define INPUT_MODIFIER            20
+
+struct InputName {
+  const char *name;
+  int value;
+};
+
+static const struct InputName InputButtonNames[] = {
+  {"A", 15}, {"B", 14}, {"Z", 13}, {"Start", 12},
+  {"DUp", 11}, {"DDown", 10}, {"DLeft", 9}, {"DRight", 8},
+  {"L", 5}, {"R", 4},
+  {"CUp", 3}, {"CDown", 2}, {"CLeft", 1}, {"CRight", 0},
+  {"StickRight", INPUT_STICK_RIGHT}, {"StickLeft", INPUT_STICK_LEFT},
+  {"StickUp", INPUT_STICK_UP}, {"StickDown", INPUT_STICK_DOWN},
+  {"Modifier", INPUT_MODIFIER},
+  {NULL, 0}
+};
+
+#ifndef PIF_NO_GLFW
+static const struct InputName InputKeyNames[] = {
+#ifdef GLFW3
+  {"LSHIFT", GLFW_KEY_LEFT_SHIFT}, {"RSHIFT", GLFW_KEY_RIGHT_SHIFT},
+  {"LCTRL", GLFW_KEY_LEFT_CONTROL}, {"RCTRL", GLFW_KEY_RIGHT_CONTROL},
+  {"LALT", GLFW_KEY_LEFT_ALT}, {"RALT", GLFW_KEY_RIGHT_ALT},
+  {"DEL", GLFW_KEY_DELETE}, {"INSERT", GLFW_KEY_INSERT},
+  {"PAGEUP", GLFW_KEY_PAGE_UP}, {"PAGEDOWN", GLFW_KEY_PAGE_DOWN},
+  {"ESC", GLFW_KEY_ESCAPE},
+#else
+  {"LSHIFT", GLFW_KEY_LSHIFT}, {"RSHIFT", GLFW_KEY_RSHIFT},
+  {"LCTRL", GLFW_KEY_LCTRL}, {"RCTRL", GLFW_KEY_RCTRL},
+  {"LALT", GLFW_KEY_LALT}, {"RALT", GLFW_KEY_RALT},
+  {"DEL", GLFW_KEY_DEL}, {"INSERT", GLFW_KEY_INSERT},
+  {"PAGEUP", GLFW_KEY_PAGEUP}, {"PAGEDOWN", GLFW_KEY_PAGEDOWN},
+  {"ESC", GLFW_KEY_ESC},
+#endif
+  {"RIGHT", GLFW_KEY_RIGHT}, {"LEFT", GLFW_KEY_LEFT},
+  {"UP", GLFW_KEY_UP}, {"DOWN", GLFW_KEY_DOWN},
+  {"HOME", GLFW_KEY_HOME}, {"END", GLFW_KEY_END},
+  {"ENTER", GLFW_KEY_ENTER}, {"TAB", GLFW_KEY_TAB},
+  {"BACKSPACE", GLFW_KEY_BACKSPACE}, {"SPACE", GLFW_KEY_SPACE},
+  {"KP_0", GLFW_KEY_KP_0}, {"KP_1", GLFW_KEY_KP_1}, {"KP_2", GLFW_KEY_KP_2},
+  {"KP_3", GLFW_KEY_KP_3}, {"KP_4", GLFW_KEY_KP_4}, {"KP_5", GLFW_KEY_KP_5},
+  {"KP_6", GLFW_KEY_KP_6}, {"KP_7", GLFW_KEY_KP_7}, {"KP_8", GLFW_KEY_KP_8},
+  {"KP_9", GLFW_KEY_KP_9},
+  {NULL, 0}
+};
+#endif
+
+static void AddInputMapping(struct InputMap *, unsigned, unsigned);
+static void CompileInputStick(struct InputStick *, unsigned, float, float,
+  bool);
+static unsigned InputAxisIndex(float);
+static int LookupInputName(const struct InputName *, const char *);
+static int ParseInputMapping(struct InputMap *, char **, unsigned);
+static int ParseInputSource(struct InputMap *, char **, unsigned);
+static int ParseInputStick(struct InputMap *, char **, unsigned);
+
+/* ============================================================================
+ *  AddInputMapping: Makes source bit 'source' press output bit 'button'.
+ * ========================================================================= */
+static void
+AddInputMapping(struct InputMap *map, unsigned source, unsigned button) {
+  unsigned byte = source >> 3, bit = source & 0x7;
+  unsigned i;
+
+  for (i = 0; i < 256; i++) {
+    if (i & (1 << bit))
+      map->gather[byte][i] |= 1U << button;
+  }
+
+  map->gatherBytes |= 1 << byte;
+}
+
+/* ============================================================================
+ *  ApplyInputMap: Turns raw sources and axes into a 4-byte state.
+ * ========================================================================= */
+void
+ApplyInputMap(const struct InputMap *map, uint64_t sources,
+  const float *axes, uint8_t *state) {
+  uint32_t buttons = 0;
+  int8_t stick[2];
+  unsigned i;
+
+  for (i = 0; map->thresholdAxes >> i; i++) {
+    if (map->thresholdAxes & (1 << i)) {
+      unsigned index = InputAxisIndex(axes[i]);
+
+      sources |= (uint64_t) (index < map->below[i]) << (32 + 2 * i);
+      sources |= (uint64_t) (index > map->above[i]) << (33 + 2 * i);
+    }
+  }
+
+  for (i = 0; i < 8; i++) {
+    if (map->gatherBytes & (1 << i))
+      buttons |= map->gather[i][(sources >> (i * 8)) & 0xFF];
+  }
+
+  for (i = 0; i < 2; i++) {
+    const struct InputStick *s = map->sticks + i;
+    unsigned shift = i ? INPUT_STICK_UP : INPUT_STICK_RIGHT;
+
+    if (s->analog)
+      stick[i] = s->lut[InputAxisIndex(axes[s->axis])];
+
+    else {
+      stick[i] = s->digital[((buttons >> shift) & 0x3) |
+        (((buttons >> INPUT_MODIFIER) & 0x1) << 2)];
+    }
+  }
+
+  state[0] = buttons >> 8;
+  state[1] = buttons;
+  state[2] = stick[0];
+  state[3] = stick[1];
+}
+
+/* ============================================================================
+ *  CompileInputMap: Compiles the profile for a device from mapping text.
+ *
+ *  Returns NULL if the device has no profile or the profile is invalid.
+ * ========================================================================= */
+struct InputMap *
+CompileInputMap(const char *text, const char *device) {
+  bool found = false, active = false;
+  unsigned line = 0, i;
+  struct InputMap *map;
+
+  if ((map = (struct InputMap *) calloc(1, sizeof(*map))) == NULL)
+    return NULL;
+
+  for (i = 0; i < INPUT_MAX_AXES; i++)
+    map->above[i] = INPUT_AXIS_LUT_SIZE - 1;
+
+  while (*text) {
+    char buffer[256], *tokens[16], *c;
+    size_t length = strcspn(text, "\n");
+    unsigned count = 0;
+
+    line++;
+
+    if (length >= sizeof(buffer)) {
+      debugarg("InputMapping: Line %u is too long.", line);
+      goto fail;
+    }
+
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    text += length + (text[length] == '\n');
+
+    if ((c = strchr(buffer, '#')) != NULL)
+      *c = '\0';
+
+    /* Split in place; strtok would share its state across instances. */
+    for (c = buffer + strspn(buffer, " \t\r"); *c; c += strspn(c, " \t\r")) {
+      if (count == sizeof(tokens) / sizeof(*tokens)) {
+        debugarg("InputMapping: Line %u is too long.", line);
+        goto fail;
+      }
+
+      tokens[count++] = c;
+      c += strcspn(c, " \t\r");
+
+      if (*c)
+        *c++ = '\0';
+    }
+
+    if (count == 0)
+      continue;
+
+    if (!strcmp(tokens[0], "device")) {
+      active = count == 2 && !strcmp(tokens[1], device);
+      found |= active;
+      continue;
+    }
+
+    if (!active)
+      continue;
+
+    if (!strcmp(tokens[0], "stick") ? ParseInputStick(map, tokens, count) :
+      ParseInputMapping(map, tokens, count)) {
+      debugarg("InputMapping: Bad mapping on line %u.", line);
+      goto fail;
+    }
+  }
+
+  if (!found) {
+    debug("InputMapping: No profile for the device.");
+    goto fail;
+  }
+
+  if (map->numKeys && (map->numButtons || map->numAxes)) {
+    debug("InputMapping: Profiles can't mix keys and joysticks.");
+    goto fail;
+  }
+
+  return map;
+
+fail:
+  free(map);
+  return NULL;
+}
+
+/* ============================================================================
+ *  CompileInputStick: Builds an analog stick's axis lookup table.
+ *
+ *  Each bucket is converted at its edge furthest from the centre, so
+ *  that a full deflection reaches the full range.
+ * ========================================================================= */
+static void
+CompileInputStick(struct InputStick *stick, unsigned axis, float deadzone,
+  float range, bool invert) {
+  unsigned i;
+
+  stick->analog = true;
+  stick->axis = axis;
+
+  for (i = 0; i < INPUT_AXIS_LUT_SIZE; i++) {
+    float position = (float) (i + (i >= INPUT_AXIS_LUT_SIZE / 2)) /
+      (INPUT_AXIS_LUT_SIZE / 2) - 1.0f;
+    float magnitude = position < 0 ? -position : position;
+    int value = 0;
+
+    if (magnitude > deadzone) {
+      float scaled = (magnitude - deadzone) / (1.0f - deadzone) * range;
+
+      value = scaled > 127.0f ? 127 : (int) scaled;
+    }
+
+    if ((position < 0) != invert)
+      value = -value;
+
+    stick->lut[i] = value;
+  }
+}
+
+/* ============================================================================
+ *  GetDefaultInputMappings: Returns the built-in mapping text.
+ * ========================================================================= */
+const char *
+GetDefaultInputMappings(void) {
+  return DefaultInputMappings;
+}
+
+/* ============================================================================
+ *  InputAxisIndex: Quantizes an axis position for the lookup tables.
+ * ========================================================================= */
+static unsigned
+InputAxisIndex(float position) {
+  int index = (int) ((position + 1.0f) * (INPUT_AXIS_LUT_SIZE / 2));
+
+  if (index < 0)
+    return 0;
+
+  return index < INPUT_AXIS_LUT_SIZE ? index : INPUT_AXIS_LUT_SIZE - 1;
+}
+
+/* ============================================================================
+ *  LoadInputMap: Compiles the profile for a device from a mapping file.
+ * ========================================================================= */
+struct InputMap *
+LoadInputMap(const char *path, const char *device) {
+  struct InputMap *map;
+  char *text;
+  FILE *file;
+  long size;
+
+  if ((file = fopen(path, "r")) == NULL) {
+    debug("InputMapping: Failed to open the mapping file.");
+    return NULL;
+  }
+
+  if (fseek(file, 0, SEEK_END) == -1 || (size = ftell(file)) == -1 ||
+    (text = (char *) malloc(size + 1)) == NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  rewind(file);
+  size = fread(text, 1, size, file);
+  text[size] = '\0';
+  fclose(file);
+
+  map = CompileInputMap(text, device);
+  free(text);
+  return map;
+}
+
+/* ============================================================================
+ *  LookupInputName: Looks up a name in a NULL-terminated table.
+ * ========================================================================= */
+static int
+LookupInputName(const struct InputName *names, const char *name) {
+  for (; names->name; names++) {
+    if (!strcmp(names->name, name))
+      return names->value;
+  }
+
+  return -1;
+}
+
+/* ============================================================================
+ *  ParseInputMapping: Parses "<button> = <source...>".
+ * ========================================================================= */
+static int
+ParseInputMapping(struct InputMap *map, char **tokens, unsigned count) {
+  int button, source;
+
+  if (count < 4 || strcmp(tokens[1], "=") ||
+    (button = LookupInputName(InputButtonNames, tokens[0])) < 0)
+    return -1;
+
+  if ((source = ParseInputSource(map, tokens + 2, count - 2)) < 0)
+    return -1;
+
+  AddInputMapping(map, source, button);
+  return 0;
+}
+
+/* ============================================================================
+ *  ParseInputSource: Parses a source and returns its source bit.
+ * ========================================================================= */
+static int
+ParseInputSource(struct InputMap *map, char **tokens, unsigned count) {
+  bool positive;
+  char *end;
+  long index;
+  float threshold;
+
+  if (!strcmp(tokens[0], "key")) {
+    int key = -1;
+    unsigned i;
+
+    if (count != 2)
+      return -1;
+
+#ifndef PIF_NO_GLFW
+    if (tokens[1][0] && !tokens[1][1] && isalnum((unsigned char) tokens[1][0]))
+      key = toupper((unsigned char) tokens[1][0]);
+
+    else
+      key = LookupInputName(InputKeyNames, tokens[1]);
+#endif
+
+    if (key < 0)
+      return -1;
+
+    for (i = 0; i < map->numKeys; i++) {
+      if (map->keys[i] == key)
+        return i;
+    }
+
+    if (map->numKeys == INPUT_MAX_SOURCES)
+      return -1;
+
+    map->keys[map->numKeys] = key;
+    return map->numKeys++;
+  }
+
+  index = strtol(tokens[1], &end, 10);
+
+  if (!strcmp(tokens[0], "button")) {
+    if (count != 2 || *end || index < 0 || index >= INPUT_MAX_SOURCES)
+      return -1;
+
+    if (index >= map->numButtons)
+      map->numButtons = index + 1;
+
+    return index;
+  }
+
+  if (strcmp(tokens[0], "axis+") && strcmp(tokens[0], "axis-"))
+    return -1;
+
+  if (count != 3 || *end || index < 0 || index >= INPUT_MAX_AXES)
+    return -1;
+
+  threshold = (float) strtod(tokens[2], &end);
+  positive = tokens[0][4] == '+';
+
+  if (*end || threshold < 0 || threshold >= 1.0f)
+    return -1;
+
+  if (index >= map->numAxes)
+    map->numAxes = index + 1;
+
+  map->thresholdAxes |= 1 << index;
+
+  if (positive)
+    map->above[index] = InputAxisIndex(threshold);
+  else
+    map->below[index] = InputAxisIndex(-threshold);
+
+  return 32 + 2 * index + positive;
+}
+
+/* ============================================================================
+ *  ParseInputStick: Parses "stick <X|Y> ...".
+ * ========================================================================= */
+static int
+ParseInputStick(struct InputMap *map, char **tokens, unsigned count) {
+  struct InputStick *stick;
+  char *end;
+  unsigned i;
+
+  if (count < 3 || (strcmp(tokens[1], "X") && strcmp(tokens[1], "Y")))
+    return -1;
+
+  stick = map->sticks + (tokens[1][0] == 'Y');
+
+  if (!strcmp(tokens[2], "digital")) {
+    long full, modified;
+
+    if (count != 4 && count != 5)
+      return -1;
+
+    full = strtol(tokens[3], &end, 10);
+    modified = count == 5 ? strtol(tokens[4], &end, 10) : full;
+
+    if (*end || full < 0 || full > 127 || modified < 0 || modified > 127)
+      return -1;
+
+    /* Index: positive | negative << 1 | modifier << 2. */
+    for (i = 0; i < 8; i++) {
+      long magnitude = (i & 0x4) ? modified : full;
+
+      stick->digital[i] = (i & 0x1) ? magnitude :
+        (i & 0x2) ? -magnitude : 0;
+    }
+
+    stick->analog = false;
+    return 0;
+  }
+
+  if (!strcmp(tokens[2], "axis")) {
+    float deadzone = 0.0f, range = 127.0f;
+    bool invert = false;
+    long axis;
+
+    if (count < 4)
+      return -1;
+
+    axis = strtol(tokens[3], &end, 10);
+
+    if (*end || axis < 0 || axis >= INPUT_MAX_AXES)
+      return -1;
+
+    for (i = 4; i < count; i++) {
+      if (!strcmp(tokens[i], "invert"))
+        invert = true;
+
+      else if (i + 1 < count && !strcmp(tokens[i], "deadzone"))
+        deadzone = (float) strtod(tokens[++i], &end);
+
+      else if (i + 1 < count && !strcmp(tokens[i], "range"))
+        range = (float) strtod(tokens[++i], &end);
+
+      else
+        return -1;
+
+      if (*end)
+        return -1;
+    }
+
+    if (deadzone < 0 || deadzone >= 1.0f || range < 0 || range > 127.0f)
+      return -1;
+
+    if (axis >= map->numAxes)
+      map->numAxes = axis + 1;
+
+    CompileInputStick(stick, axis, deadzone, range, invert);
+    return 0;
+  }
+
+  return -1;
+}
+
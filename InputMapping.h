@@ -0,0 +1,56 @@
+/* ============================================================================
+ *  InputMapping.h: Host input mappings, compiled into lookup tables.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__INPUTMAPPING_H__
+#define __PIF__INPUTMAPPING_H__
+#include "Common.h"
+
+/* Keys or buttons read per poll, and axes. */
+#define INPUT_MAX_SOURCES         32
+#define INPUT_MAX_AXES            16
+
+/* Axis positions in [-1, 1] are quantized to this many steps. */
+#define INPUT_AXIS_LUT_SIZE       4096
+
+struct InputStick {
+  int8_t lut[INPUT_AXIS_LUT_SIZE];
+  int8_t digital[8];
+  uint8_t axis;
+  bool analog;
+};
+
+/* ============================================================================
+ *  A compiled mapping. Every key or button is a bit in the low 32 bits of
+ *  a source word, and every axis direction used as a button is a bit in
+ *  the high 32 (two per axis); gather[i] maps byte i of that word to the
+ *  buttons it presses. Sticks are read through a per-axis LUT or, for
+ *  keyboards, from the 8 combinations of two directions and a modifier.
+ * ========================================================================= */
+struct InputMap {
+  uint32_t gather[8][256];
+  struct InputStick sticks[2];
+
+  uint16_t below[INPUT_MAX_AXES];
+  uint16_t above[INPUT_MAX_AXES];
+  uint16_t thresholdAxes;
+
+  int keys[INPUT_MAX_SOURCES];
+  uint8_t numKeys, numButtons, numAxes;
+  uint8_t gatherBytes;
+};
+
+void ApplyInputMap(const struct InputMap *, uint64_t, const float *,
+  uint8_t *);
+struct InputMap *CompileInputMap(const char *, const char *);
+const char *GetDefaultInputMappings(void);
+struct InputMap *LoadInputMap(const char *, const char *);
+
+#endif
+
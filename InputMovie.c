@@ -0,0 +1,378 @@
+/* ============================================================================
+ *  InputMovie.c: Records and replays what the game reads from controllers.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Actions.h"
+#include "Common.h"
+#include "Controller.h"
+#include "FileMap.h"
+#include "Input.h"
+#include "InputMovie.h"
+#include "PIFWorker.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  A movie is an 8-byte header ("PIFM", a version and the mask of ports
+ *  that were connected) followed by one event per change in what a port
+ *  returned to the game. An event is a tag byte (the channel in bits 0-1
+ *  and a mask of the state bytes that changed in bits 2-5), the number of
+ *  reads of that port since its previous event (LEB128), then the bytes
+ *  that changed. Ports hold their state between events, so a movie only
+ *  grows when the game sees a press, a release or the stick move.
+ * ========================================================================= */
+#define INPUT_MOVIE_HEADER_SIZE   8
+#define INPUT_MOVIE_BUFFER_SIZE   4096
+#define INPUT_MOVIE_VERSION       1
+
+static const uint8_t InputMovieMagic[4] = {'P', 'I', 'F', 'M'};
+
+struct InputMovie {
+  struct PIFController *controller;
+  enum InputMovieMode mode;
+
+  uint64_t polls[PIF_NUM_CONTROLLERS];
+  uint64_t lastEvent[PIF_NUM_CONTROLLERS];
+  uint8_t states[PIF_NUM_CONTROLLERS][4];
+  uint64_t events;
+  uint8_t channels;
+
+  /* Recording: events are buffered and streamed out. */
+  FILE *file;
+  uint8_t buffer[INPUT_MOVIE_BUFFER_SIZE];
+  size_t buffered;
+  bool failed;
+
+  /* Playback: the next event is decoded ahead of the read it applies to. */
+  struct FileMap map;
+  const uint8_t *cursor, *end;
+  const uint8_t *nextBytes;
+  uint64_t nextPoll;
+  uint8_t nextChannel, nextMask;
+  bool pending;
+};
+
+static void AppendInputMovie(struct InputMovie *, const uint8_t *, size_t);
+static void DecodeInputMovieEvent(struct InputMovie *);
+static void FlushInputMovie(struct InputMovie *);
+static int OpenInputMoviePlayback(struct InputMovie *, const char *);
+static int OpenInputMovieRecording(struct InputMovie *, const char *);
+static void PollInputMovie(void *, unsigned, uint8_t *);
+
+/* ============================================================================
+ *  AppendInputMovie: Buffers bytes for the movie file.
+ * ========================================================================= */
+static void
+AppendInputMovie(struct InputMovie *movie, const uint8_t *data,
+  size_t length) {
+  if (movie->buffered + length > sizeof(movie->buffer))
+    FlushInputMovie(movie);
+
+  memcpy(movie->buffer + movie->buffered, data, length);
+  movie->buffered += length;
+}
+
+/* ============================================================================
+ *  CreateInputMovie: Starts recording or replaying a controller's input.
+ *
+ *  While recording, every controller read is appended to the file at
+ *  path. Playback needs no host devices at all: the ports connected when
+ *  the movie was recorded are served from the file, and the others are
+ *  disconnected. Either way, the movie belongs to the controller from
+ *  here on, and memoized responses never skip a read it counts.
+ * ========================================================================= */
+struct InputMovie *
+CreateInputMovie(struct PIFController *controller, const char *path,
+  enum InputMovieMode mode) {
+  struct InputMovie *movie;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->movie) {
+    debug("InputMovie: A movie is already attached.");
+    return NULL;
+  }
+
+  /* A sampler thread would poll the movie out of order. */
+  if (mode == INPUT_MOVIE_PLAYBACK && controller->sampler) {
+    debug("InputMovie: Cannot replay with an input sampler attached.");
+    return NULL;
+  }
+
+  if ((movie = (struct InputMovie *) calloc(1, sizeof(*movie))) == NULL)
+    return NULL;
+
+  movie->controller = controller;
+  movie->mode = mode;
+
+  if ((mode == INPUT_MOVIE_RECORD ?
+    OpenInputMovieRecording(movie, path) :
+    OpenInputMoviePlayback(movie, path))) {
+    free(movie);
+    return NULL;
+  }
+
+  controller->movie = movie;
+  return movie;
+}
+
+/* ============================================================================
+ *  DecodeInputMovieEvent: Reads the next event, if there is one.
+ * ========================================================================= */
+static void
+DecodeInputMovieEvent(struct InputMovie *movie) {
+  const uint8_t *cursor = movie->cursor;
+  uint64_t delta = 0;
+  unsigned shift, count, i;
+  uint8_t tag;
+
+  movie->pending = false;
+
+  if (cursor >= movie->end)
+    return;
+
+  tag = *cursor++;
+
+  for (shift = 0; cursor < movie->end && shift < 64; shift += 7) {
+    uint8_t byte = *cursor++;
+
+    delta |= (uint64_t) (byte & 0x7F) << shift;
+
+    if (!(byte & 0x80))
+      break;
+  }
+
+  for (i = 0, count = 0; i < 4; i++)
+    count += (tag >> (2 + i)) & 1;
+
+  if (cursor + count > movie->end || (tag & 0xC0)) {
+    debug("InputMovie: Movie is truncated or corrupt.");
+    return;
+  }
+
+  movie->nextChannel = tag & 0x3;
+  movie->nextMask = (tag >> 2) & 0xF;
+  movie->nextPoll = movie->lastEvent[movie->nextChannel] + delta;
+  movie->nextBytes = cursor;
+  movie->cursor = cursor + count;
+  movie->pending = true;
+}
+
+/* ============================================================================
+ *  DestroyInputMovie: Finishes a movie and detaches it from its controller.
+ * ========================================================================= */
+void
+DestroyInputMovie(struct InputMovie *movie) {
+  struct PIFController *controller = movie->controller;
+  unsigned i;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  controller->movie = NULL;
+
+  if (movie->mode == INPUT_MOVIE_RECORD) {
+    FlushInputMovie(movie);
+
+    if (fclose(movie->file) || movie->failed)
+      printf("InputMovie: Failed to write the movie file.\n");
+  }
+
+  else {
+    for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+      if (controller->channels[i].backend.opaque == movie)
+        DisconnectChannel(controller, i);
+    }
+
+    CloseFileMap(&movie->map);
+  }
+
+  free(movie);
+}
+
+/* ============================================================================
+ *  FlushInputMovie: Writes out any buffered events.
+ * ========================================================================= */
+static void
+FlushInputMovie(struct InputMovie *movie) {
+  if (movie->buffered && fwrite(movie->buffer, 1,
+    movie->buffered, movie->file) != movie->buffered) {
+    debug("InputMovie: Failed to write to the movie file.");
+    movie->failed = true;
+  }
+
+  movie->buffered = 0;
+}
+
+/* ============================================================================
+ *  GetInputMovieEvents: Returns the number of events recorded or replayed.
+ * ========================================================================= */
+uint64_t
+GetInputMovieEvents(const struct InputMovie *movie) {
+  return movie->events;
+}
+
+/* ============================================================================
+ *  OpenInputMoviePlayback: Maps a movie and plugs it into its ports.
+ * ========================================================================= */
+static int
+OpenInputMoviePlayback(struct InputMovie *movie, const char *path) {
+  struct PIFController *controller = movie->controller;
+  struct PIFInputBackend backend;
+  const uint8_t *header;
+  unsigned i;
+
+  if (OpenFileMap(&movie->map, path, 0, FILEMAP_READ_ONLY)) {
+    debug("InputMovie: Failed to open the movie.");
+    return -1;
+  }
+
+  header = movie->map.base;
+
+  if (movie->map.size < INPUT_MOVIE_HEADER_SIZE ||
+    memcmp(header, InputMovieMagic, sizeof(InputMovieMagic)) ||
+    header[4] != INPUT_MOVIE_VERSION) {
+    debug("InputMovie: Not a movie, or an unsupported version.");
+
+    CloseFileMap(&movie->map);
+    return -1;
+  }
+
+  movie->channels = header[5] & 0xF;
+  movie->cursor = header + INPUT_MOVIE_HEADER_SIZE;
+  movie->end = header + movie->map.size;
+  DecodeInputMovieEvent(movie);
+
+  memset(&backend, 0, sizeof(backend));
+  backend.poll = PollInputMovie;
+  backend.opaque = movie;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (movie->channels & (1 << i))
+      SetInputBackend(controller, i, &backend);
+
+    else
+      DisconnectChannel(controller, i);
+  }
+
+  return 0;
+}
+
+/* ============================================================================
+ *  OpenInputMovieRecording: Creates a movie file and writes its header.
+ * ========================================================================= */
+static int
+OpenInputMovieRecording(struct InputMovie *movie, const char *path) {
+  uint8_t header[INPUT_MOVIE_HEADER_SIZE];
+  unsigned i;
+
+  if ((movie->file = fopen(path, "wb")) == NULL) {
+    debug("InputMovie: Failed to create the movie.");
+    return -1;
+  }
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (movie->controller->channels[i].connected)
+      movie->channels |= 1 << i;
+  }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, InputMovieMagic, sizeof(InputMovieMagic));
+  header[4] = INPUT_MOVIE_VERSION;
+  header[5] = movie->channels;
+
+  AppendInputMovie(movie, header, sizeof(header));
+  return 0;
+}
+
+/* ============================================================================
+ *  PollInputMovie: Serves a controller read from the movie.
+ * ========================================================================= */
+static void
+PollInputMovie(void *opaque, unsigned channel, uint8_t *state) {
+  struct InputMovie *movie = (struct InputMovie *) opaque;
+  uint8_t *current = movie->states[channel];
+
+  if (movie->pending && movie->nextChannel == channel &&
+    movie->nextPoll == movie->polls[channel]) {
+    const uint8_t *bytes = movie->nextBytes;
+    unsigned i;
+
+    for (i = 0; i < 4; i++) {
+      if (movie->nextMask & (1 << i))
+        current[i] = *bytes++;
+    }
+
+    movie->lastEvent[channel] = movie->nextPoll;
+    movie->events++;
+
+    DecodeInputMovieEvent(movie);
+  }
+
+  movie->polls[channel]++;
+  memcpy(state, current, 4);
+
+  if (movie->pending)
+    NotifyPIFInputChanged(movie->controller, channel);
+}
+
+/* ============================================================================
+ *  RecordInputMovie: Notes what a controller read returned to the game.
+ * ========================================================================= */
+void
+RecordInputMovie(struct InputMovie *movie, unsigned channel,
+  const uint8_t *state) {
+  uint8_t *current = movie->states[channel];
+  uint64_t poll;
+  unsigned i;
+  uint8_t mask;
+
+  if (movie->mode != INPUT_MOVIE_RECORD)
+    return;
+
+  poll = movie->polls[channel]++;
+
+  for (i = 0, mask = 0; i < 4; i++)
+    mask |= (current[i] != state[i]) << i;
+
+  if (mask) {
+    uint8_t event[1 + 10 + 4];
+    uint64_t delta = poll - movie->lastEvent[channel];
+    size_t length = 0;
+
+    event[length++] = channel | mask << 2;
+
+    do {
+      event[length++] = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0x00);
+      delta >>= 7;
+    } while (delta);
+
+    for (i = 0; i < 4; i++) {
+      if (mask & (1 << i))
+        event[length++] = current[i] = state[i];
+    }
+
+    AppendInputMovie(movie, event, length);
+    movie->lastEvent[channel] = poll;
+    movie->events++;
+  }
+
+  /* Keep memoized responses from skipping reads the movie counts. */
+  NotifyPIFInputChanged(movie->controller, channel);
+}
+
@@ -0,0 +1,31 @@
+/* ============================================================================
+ *  InputMovie.h: Records and replays what the game reads from controllers.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__INPUTMOVIE_H__
+#define __PIF__INPUTMOVIE_H__
+#include "Common.h"
+
+struct InputMovie;
+struct PIFController;
+
+enum InputMovieMode {
+  INPUT_MOVIE_RECORD,
+  INPUT_MOVIE_PLAYBACK,
+};
+
+struct InputMovie *CreateInputMovie(struct PIFController *, const char *,
+  enum InputMovieMode);
+void DestroyInputMovie(struct InputMovie *);
+
+uint64_t GetInputMovieEvents(const struct InputMovie *);
+void RecordInputMovie(struct InputMovie *, unsigned, const uint8_t *);
+
+#endif
+
@@ -0,0 +1,335 @@
+/* ============================================================================
+ *  InputSampler.c: Samples host input off the emulation thread.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "Input.h"
+#include "InputSampler.h"
+#include "PIFWorker.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  Controller states are packed into one word per channel, in the byte
+ *  order of a joybus 0x01 response, and published under a seqlock: the
+ *  sequence is odd while the sampler is storing. A single channel can be
+ *  read with one atomic load; GetSampledInput uses the sequence to get a
+ *  consistent view of every channel at once.
+ * ========================================================================= */
+struct InputSampler {
+  struct PIFController *controller;
+
+  volatile uint32_t sequence;
+  volatile uint32_t states[PIF_NUM_CONTROLLERS];
+  uint32_t published[PIF_NUM_CONTROLLERS];
+
+  struct PIFMutex lock;
+  struct PIFCond wake;
+  struct PIFCond idle;
+  struct PIFThread thread;
+  struct InputSamplerStats stats;
+  uint64_t period;
+  bool threaded, stopping, sampling;
+
+  /* Only touched by the emulation thread. */
+  uint64_t polls, profiledPolls, pollTime;
+  bool profiling;
+};
+
+static void PublishInputStates(struct InputSampler *, const uint32_t *);
+static void *InputSamplerThread(void *);
+
+/* ============================================================================
+ *  CreateInputSampler: Starts sampling a controller's input at rate Hz.
+ *
+ *  With a rate of 0, no thread is started and the host is expected to
+ *  call SampleInput from its event thread (e.g., after pumping events),
+ *  which is what windowing libraries that are not thread-safe require.
+ * ========================================================================= */
+struct InputSampler *
+CreateInputSampler(struct PIFController *controller, unsigned rate) {
+  struct InputSampler *sampler;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->sampler)
+    DestroyInputSampler(controller->sampler);
+
+  if ((sampler = (struct InputSampler *) calloc(1, sizeof(*sampler))) == NULL)
+    return NULL;
+
+  sampler->controller = controller;
+
+  InitPIFMutex(&sampler->lock);
+  InitPIFCond(&sampler->wake);
+  InitPIFCond(&sampler->idle);
+
+  if (rate) {
+    sampler->period = 1000000000ULL / rate;
+    sampler->threaded = true;
+
+    if (StartPIFThread(&sampler->thread, InputSamplerThread, sampler)) {
+      debug("InputSampler: Failed to start the sampler thread.");
+
+      DestroyPIFCond(&sampler->idle);
+      DestroyPIFCond(&sampler->wake);
+      DestroyPIFMutex(&sampler->lock);
+      free(sampler);
+      return NULL;
+    }
+  }
+
+  controller->sampler = sampler;
+  return sampler;
+}
+
+/* ============================================================================
+ *  DestroyInputSampler: Stops sampling; the device is polled directly again.
+ * ========================================================================= */
+void
+DestroyInputSampler(struct InputSampler *sampler) {
+  if (unlikely(sampler->controller->worker != NULL))
+    SyncPIFWorker(sampler->controller->worker);
+
+  if (sampler->threaded) {
+    LockPIFMutex(&sampler->lock);
+    sampler->stopping = true;
+    SignalPIFCond(&sampler->wake);
+    UnlockPIFMutex(&sampler->lock);
+
+    JoinPIFThread(&sampler->thread);
+  }
+
+  if (sampler->controller->sampler == sampler)
+    sampler->controller->sampler = NULL;
+
+  DestroyPIFCond(&sampler->idle);
+  DestroyPIFCond(&sampler->wake);
+  DestroyPIFMutex(&sampler->lock);
+  free(sampler);
+}
+
+/* ============================================================================
+ *  GetInputSamplerStats: Copies out the sampler's counters.
+ *
+ *  The poll counters belong to the emulation thread and are only exact
+ *  when read from it.
+ * ========================================================================= */
+void
+GetInputSamplerStats(struct InputSampler *sampler,
+  struct InputSamplerStats *stats) {
+  LockPIFMutex(&sampler->lock);
+  memcpy(stats, &sampler->stats, sizeof(*stats));
+  UnlockPIFMutex(&sampler->lock);
+
+  stats->polls = sampler->polls;
+  stats->profiledPolls = sampler->profiledPolls;
+  stats->totalPollTime = sampler->pollTime;
+}
+
+/* ============================================================================
+ *  GetSampledInput: Copies out a consistent snapshot of every channel.
+ * ========================================================================= */
+void
+GetSampledInput(struct InputSampler *sampler, uint32_t *states) {
+  uint32_t sequence;
+  unsigned i;
+
+  do {
+    sequence = LoadPIFAtomic(&sampler->sequence);
+
+    for (i = 0; i < PIF_NUM_CONTROLLERS; i++)
+      states[i] = LoadPIFAtomic(&sampler->states[i]);
+
+    PIFAcquireFence();
+  } while ((sequence & 1) || LoadPIFAtomic(&sampler->sequence) != sequence);
+}
+
+/* ============================================================================
+ *  InputSamplerThread: Samples the host devices once per period.
+ * ========================================================================= */
+static void *
+InputSamplerThread(void *opaque) {
+  struct InputSampler *sampler = (struct InputSampler *) opaque;
+  uint64_t deadline = PIFMonotonicTime();
+
+  LockPIFMutex(&sampler->lock);
+
+  while (!sampler->stopping) {
+    uint64_t now;
+
+    UnlockPIFMutex(&sampler->lock);
+    SampleInput(sampler);
+    LockPIFMutex(&sampler->lock);
+
+    /* Don't try to catch up on samples missed while descheduled. */
+    deadline += sampler->period;
+
+    if (deadline < (now = PIFMonotonicTime()))
+      deadline = now;
+
+    while (!sampler->stopping && PIFMonotonicTime() < deadline)
+      TimedWaitPIFCond(&sampler->wake, &sampler->lock, deadline);
+  }
+
+  UnlockPIFMutex(&sampler->lock);
+  return NULL;
+}
+
+/* ============================================================================
+ *  PublishInputStates: Stores any states that changed since last time.
+ * ========================================================================= */
+static void
+PublishInputStates(struct InputSampler *sampler, const uint32_t *states) {
+  uint32_t sequence = sampler->sequence;
+  unsigned i;
+
+  StorePIFAtomic(&sampler->sequence, sequence + 1);
+  PIFReleaseFence();
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (states[i] != sampler->published[i]) {
+      sampler->published[i] = states[i];
+
+      StorePIFAtomic(&sampler->states[i], states[i]);
+      AddPIFAtomic(&sampler->controller->inputGeneration[i], 1);
+    }
+  }
+
+  StorePIFAtomic(&sampler->sequence, sequence + 2);
+}
+
+/* ============================================================================
+ *  ReadSampledInput: Serves a joybus controller read from the last sample.
+ * ========================================================================= */
+void
+ReadSampledInput(struct InputSampler *sampler, unsigned channel,
+  uint8_t *state) {
+  uint32_t word;
+
+  sampler->polls++;
+
+  if (unlikely(sampler->profiling)) {
+    uint64_t start = PIFMonotonicTime();
+
+    word = LoadPIFAtomic(&sampler->states[channel]);
+    sampler->pollTime += PIFMonotonicTime() - start;
+    sampler->profiledPolls++;
+  }
+
+  else
+    word = LoadPIFAtomic(&sampler->states[channel]);
+
+  memcpy(state, &word, sizeof(word));
+}
+
+/* ============================================================================
+ *  SampleInput: Reads the host devices and publishes any changes.
+ *
+ *  Must only be called from one thread at a time: the sampler thread if
+ *  a rate was given, otherwise the host's event thread.
+ * ========================================================================= */
+void
+SampleInput(struct InputSampler *sampler) {
+  const struct PIFChannel *channels = sampler->controller->channels;
+  uint32_t states[PIF_NUM_CONTROLLERS];
+  uint64_t start, elapsed;
+  bool changed = false;
+  uint32_t active;
+  unsigned i;
+
+  LockPIFMutex(&sampler->lock);
+  sampler->sampling = true;
+  UnlockPIFMutex(&sampler->lock);
+
+  start = PIFMonotonicTime();
+  active = LoadPIFAtomic(&sampler->controller->activeChannels);
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    uint8_t state[4];
+
+    /* Nothing is asked of the host for empty ports, or for ports the
+     * game has yet to read from. */
+    if (channels[i].connected && (active & (1 << i))) {
+      channels[i].backend.poll(channels[i].backend.opaque, i, state);
+      memcpy(states + i, state, sizeof(states[i]));
+    }
+
+    else
+      states[i] = 0;
+
+    changed |= states[i] != sampler->published[i];
+  }
+
+  if (changed)
+    PublishInputStates(sampler, states);
+
+  elapsed = PIFMonotonicTime() - start;
+
+  LockPIFMutex(&sampler->lock);
+  sampler->sampling = false;
+  BroadcastPIFCond(&sampler->idle);
+
+  sampler->stats.samples++;
+  sampler->stats.publishes += changed;
+  sampler->stats.lastSampleTime = elapsed;
+  sampler->stats.totalSampleTime += elapsed;
+
+  if (elapsed > sampler->stats.maxSampleTime)
+    sampler->stats.maxSampleTime = elapsed;
+
+  UnlockPIFMutex(&sampler->lock);
+}
+
+/* ============================================================================
+ *  SetInputSamplerProfiling: Times each joybus read (emulation thread only).
+ * ========================================================================= */
+void
+SetInputSamplerProfiling(struct InputSampler *sampler, bool enable) {
+  sampler->profiling = enable;
+}
+
+/* ============================================================================
+ *  SetInputSamplerRate: Changes the sampling rate of a threaded sampler.
+ * ========================================================================= */
+void
+SetInputSamplerRate(struct InputSampler *sampler, unsigned rate) {
+  if (!sampler->threaded || !rate)
+    return;
+
+  LockPIFMutex(&sampler->lock);
+  sampler->period = 1000000000ULL / rate;
+  UnlockPIFMutex(&sampler->lock);
+}
+
+/* ============================================================================
+ *  SyncInputSampler: Waits for a sample under way on another thread.
+ *
+ *  Once it returns, no poll started before the call is still running, so
+ *  whatever a backend polled with before then may be freed.
+ * ========================================================================= */
+void
+SyncInputSampler(struct InputSampler *sampler) {
+  LockPIFMutex(&sampler->lock);
+
+  while (sampler->sampling)
+    WaitPIFCond(&sampler->idle, &sampler->lock);
+
+  UnlockPIFMutex(&sampler->lock);
+}
+
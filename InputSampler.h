@@ -0,0 +1,45 @@
+/* ============================================================================
+ *  InputSampler.h: Samples host input off the emulation thread.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__INPUTSAMPLER_H__
+#define __PIF__INPUTSAMPLER_H__
+#include "Common.h"
+
+struct InputSampler;
+struct PIFController;
+
+struct InputSamplerStats {
+  uint64_t samples;
+  uint64_t publishes;
+
+  /* Time spent reading the host devices once (ns). */
+  uint64_t lastSampleTime;
+  uint64_t maxSampleTime;
+  uint64_t totalSampleTime;
+
+  /* Joybus reads served; timed only while profiling is enabled (ns). */
+  uint64_t polls;
+  uint64_t profiledPolls;
+  uint64_t totalPollTime;
+};
+
+struct InputSampler *CreateInputSampler(struct PIFController *, unsigned);
+void DestroyInputSampler(struct InputSampler *);
+void GetInputSamplerStats(struct InputSampler *, struct InputSamplerStats *);
+void SetInputSamplerProfiling(struct InputSampler *, bool);
+void SetInputSamplerRate(struct InputSampler *, unsigned);
+
+void GetSampledInput(struct InputSampler *, uint32_t *);
+void ReadSampledInput(struct InputSampler *, unsigned, uint8_t *);
+void SampleInput(struct InputSampler *);
+void SyncInputSampler(struct InputSampler *);
+
+#endif
+
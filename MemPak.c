@@ -0,0 +1,64 @@
+/* ============================================================================
+ *  MemPak.c: Controller Pak (MemPak) emulation.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "FileMap.h"
+#include "MemPak.h"
+#include "PIFWorker.h"
+
+/* ============================================================================
+ *  CloseMemPakFile: Detaches the backing file from a channel's pak.
+ * ========================================================================= */
+void
+CloseMemPakFile(struct PIFController *controller, unsigned channel) {
+  if (channel >= MEMPAK_NUM_CHANNELS)
+    return;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  CloseFileMap(&controller->paks[channel].map);
+  controller->paks[channel].data = NULL;
+  controller->memo.valid = false;
+}
+
+/* ============================================================================
+ *  SetMemPakFile: Sets the backing file for a channel's pak.
+ *
+ *  The file is mapped (and created or grown to 32 KiB as needed) right
+ *  away; nothing is read up front, so attaching costs the same regardless
+ *  of how large the pak is or how many other paks live beside it.
+ * ========================================================================= */
+int
+SetMemPakFile(struct PIFController *controller,
+  unsigned channel, const char *filename) {
+  struct MemPak *pak;
+
+  if (channel >= MEMPAK_NUM_CHANNELS)
+    return -1;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  pak = &controller->paks[channel];
+  CloseFileMap(&pak->map);
+  pak->data = NULL;
+
+  if (OpenFileMap(&pak->map, filename, MEMPAK_SIZE, FILEMAP_SHARED)) {
+    debug("MemPak | Failed to map the pak file.");
+    return -1;
+  }
+
+  pak->data = pak->map.base;
+  controller->memo.valid = false;
+  return 0;
+}
+
@@ -0,0 +1,51 @@
+/* ============================================================================
+ *  MemPak.h: Controller Pak (MemPak) emulation.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__MEMPAK_H__
+#define __PIF__MEMPAK_H__
+#include "Common.h"
+#include "CRC.h"
+#include "FileMap.h"
+
+/* 32 KiB of SRAM, followed by the accessory (probe) region. */
+#define MEMPAK_SIZE               0x8000
+#define MEMPAK_NUM_CHANNELS       4
+
+struct PIFController;
+struct SaveImage;
+
+struct MemPak {
+  uint8_t *data;
+  struct FileMap map;
+  struct SaveImage *image;
+};
+
+/* ============================================================================
+ *  MemPakBlock: Returns the 32-byte block backing a pak address, or NULL.
+ *
+ *  NULL is returned for the accessory region (0x8000 and up), which reads
+ *  back as zeros and ignores writes on a memory pak, and for channels that
+ *  have no backing storage attached.
+ * ========================================================================= */
+static inline uint8_t *
+MemPakBlock(struct MemPak *pak, uint16_t address) {
+  address &= ~(MEMPAK_BLOCK_SIZE - 1);
+
+  if (address >= MEMPAK_SIZE || pak->data == NULL)
+    return NULL;
+
+  return pak->data + address;
+}
+
+void CloseMemPakFile(struct PIFController *, unsigned);
+int SetMemPakFile(struct PIFController *, unsigned, const char *);
+
+#endif
+
@@ -0,0 +1,198 @@
+/* ============================================================================
+ *  PIFBoot.c: High-level boot, without running the PIF ROM.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "CRC.h"
+#include "PIFBoot.h"
+#include "PIFWorker.h"
+
+#ifdef __cplusplus
+#include <cstring>
+#else
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  Each CIC is paired with its own boot code, so the CRC-32 of the boot
+ *  code identifies it. The seed is what the CIC hands the PIF, and what
+ *  the PIF ROM leaves in PIF RAM at 0x24.
+ * ========================================================================= */
+struct PIFCICInfo {
+  const char *name;
+  uint32_t crc;
+  uint32_t seed;
+};
+
+static const struct PIFCICInfo PIFCICs[NUM_PIF_CICS] = {
+  {"unknown",       0x00000000, 0x00000000},
+  {"NUS-CIC-5101",  0x587BD543, 0x0000AC00},
+  {"NUS-CIC-6101",  0x6170A4A1, 0x00043F3F},
+  {"NUS-CIC-6102",  0x90BB6CB5, 0x00003F3F},
+  {"NUS-CIC-6103",  0x0B050EE0, 0x0000783F},
+  {"NUS-CIC-6105",  0x98BC2C86, 0x0000913F},
+  {"NUS-CIC-6106",  0xACC8580A, 0x0000853F},
+  {"NUS-CIC-7102",  0x009E9EA3, 0x00043F3F},
+  {"NUS-CIC-8303",  0x0E018159, 0x0000DD00},
+};
+
+/* Left in RSP IMEM by the PIF ROM; the 6105 boot code relies on it. */
+static const uint32_t PIFBootIMEM6105[PIF_BOOT_IMEM_WORDS] = {
+  0x3C0DBFC0, 0x8DA807FC, 0x25AD07C0, 0x31080080,
+  0x5500FFFC, 0x3C0DBFC0, 0x8DA80024, 0x3C0BB000
+};
+
+static int ReadBootCode(const uint8_t *, size_t, uint8_t *);
+
+/* ============================================================================
+ *  SignExtend: Widens a 32-bit address the way the CPU would.
+ * ========================================================================= */
+static inline uint64_t
+SignExtend(uint32_t word) {
+  return (uint64_t) (int64_t) (int32_t) word;
+}
+
+/* ============================================================================
+ *  BootPIF: Puts the PIF in its post-IPL state and reports the CPU's.
+ *
+ *  The cartridge image may be in any of the usual byte orders. Returns -1
+ *  (and leaves the PIF alone) if the boot code is not recognised, in
+ *  which case the host should boot from the PIF ROM as usual.
+ * ========================================================================= */
+int
+BootPIF(struct PIFController *controller, const uint8_t *cart, size_t size,
+  enum PIFTVType tvType, struct PIFBootState *state) {
+  memset(state, 0, sizeof(*state));
+
+  if ((state->cic = DetectPIFCIC(cart, size)) == PIF_CIC_UNKNOWN) {
+    debug("PIFBoot: Unrecognised boot code; use the PIF ROM instead.");
+    return -1;
+  }
+
+  if (controller->worker)
+    SyncPIFWorker(controller->worker);
+
+  /* The PIF ROM leaves the seed in PIF RAM, and reads it back once. */
+  memset(controller->ram, 0, sizeof(controller->ram));
+  memset(controller->command, 0, sizeof(controller->command));
+  controller->memo.valid = false;
+
+  state->seed = GetPIFCICSeed(state->cic);
+  SetCICSeed(controller, state->seed);
+  controller->status = 0x80;
+
+  /* s3-s7: cartridge boot, TV type, cold reset, seed and version. */
+  state->gpr[6] = SignExtend(0xA4001F0C);
+  state->gpr[7] = SignExtend(0xA4001F08);
+  state->gpr[8] = 0xC0;
+  state->gpr[10] = 0x40;
+  state->gpr[11] = SignExtend(0xA4000040);
+  state->gpr[19] = 0;
+  state->gpr[20] = tvType;
+  state->gpr[21] = 0;
+  state->gpr[22] = (state->seed >> 8) & 0xFF;
+  state->gpr[23] = 0;
+  state->gpr[29] = SignExtend(0xA4001FF0);
+  state->gpr[31] = SignExtend(0xA4001550);
+
+  state->pc = SignExtend(0xA4000040);
+  state->cp0Status = 0x34000000;
+  state->cp0Config = 0x0006E463;
+  state->dmemOffset = PIF_BOOT_CODE_OFFSET;
+
+  if (state->cic == PIF_CIC_6105) {
+    memcpy(state->imem, PIFBootIMEM6105, sizeof(PIFBootIMEM6105));
+    state->imemWords = PIF_BOOT_IMEM_WORDS;
+  }
+
+  return 0;
+}
+
+/* ============================================================================
+ *  DetectPIFCIC: Identifies the CIC a cartridge image was made for.
+ * ========================================================================= */
+enum PIFCIC
+DetectPIFCIC(const uint8_t *cart, size_t size) {
+  uint8_t bootCode[PIF_BOOT_CODE_END];
+  uint32_t crc;
+  unsigned i;
+
+  if (ReadBootCode(cart, size, bootCode))
+    return PIF_CIC_UNKNOWN;
+
+  crc = BootCodeCRC(bootCode + PIF_BOOT_CODE_OFFSET,
+    PIF_BOOT_CODE_END - PIF_BOOT_CODE_OFFSET);
+
+  for (i = PIF_CIC_UNKNOWN + 1; i < NUM_PIF_CICS; i++) {
+    if (PIFCICs[i].crc == crc)
+      return (enum PIFCIC) i;
+  }
+
+  debugarg("PIFBoot: No CIC has boot code with CRC 0x%.8X.", crc);
+  return PIF_CIC_UNKNOWN;
+}
+
+/* ============================================================================
+ *  GetPIFCICName: Returns a CIC's part number.
+ * ========================================================================= */
+const char *
+GetPIFCICName(enum PIFCIC cic) {
+  return PIFCICs[cic < NUM_PIF_CICS ? cic : PIF_CIC_UNKNOWN].name;
+}
+
+/* ============================================================================
+ *  GetPIFCICSeed: Returns the seed a CIC hands the PIF (for SetCICSeed).
+ * ========================================================================= */
+uint32_t
+GetPIFCICSeed(enum PIFCIC cic) {
+  return PIFCICs[cic < NUM_PIF_CICS ? cic : PIF_CIC_UNKNOWN].seed;
+}
+
+/* ============================================================================
+ *  ReadBootCode: Copies the header and boot code out in big-endian order.
+ *
+ *  Images are big-endian (.z64), byte-swapped (.v64) or word-swapped
+ *  (.n64); the first word of the header tells which.
+ * ========================================================================= */
+static int
+ReadBootCode(const uint8_t *cart, size_t size, uint8_t *bootCode) {
+  unsigned i;
+
+  if (size < PIF_BOOT_CODE_END)
+    return -1;
+
+  if (cart[0] == 0x80 && cart[1] == 0x37)
+    memcpy(bootCode, cart, PIF_BOOT_CODE_END);
+
+  else if (cart[0] == 0x37 && cart[1] == 0x80) {
+    for (i = 0; i < PIF_BOOT_CODE_END; i += 2) {
+      bootCode[i + 0] = cart[i + 1];
+      bootCode[i + 1] = cart[i + 0];
+    }
+  }
+
+  else if (cart[0] == 0x40 && cart[3] == 0x80) {
+    for (i = 0; i < PIF_BOOT_CODE_END; i += 4) {
+      bootCode[i + 0] = cart[i + 3];
+      bootCode[i + 1] = cart[i + 2];
+      bootCode[i + 2] = cart[i + 1];
+      bootCode[i + 3] = cart[i + 0];
+    }
+  }
+
+  else {
+    debug("PIFBoot: Not a cartridge image (bad header).");
+    return -1;
+  }
+
+  return 0;
+}
+
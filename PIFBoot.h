@@ -0,0 +1,75 @@
+/* ============================================================================
+ *  PIFBoot.h: High-level boot, without running the PIF ROM.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFBOOT_H__
+#define __PIF__PIFBOOT_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+struct PIFController;
+
+/* The boot code (IPL3) follows the 64-byte cartridge header. */
+#define PIF_BOOT_CODE_OFFSET      0x40
+#define PIF_BOOT_CODE_END         0x1000
+#define PIF_BOOT_IMEM_WORDS       8
+
+enum PIFCIC {
+  PIF_CIC_UNKNOWN,
+  PIF_CIC_5101,
+  PIF_CIC_6101,
+  PIF_CIC_6102,
+  PIF_CIC_6103,
+  PIF_CIC_6105,
+  PIF_CIC_6106,
+  PIF_CIC_7102,
+  PIF_CIC_8303,
+  NUM_PIF_CICS
+};
+
+enum PIFTVType {
+  PIF_TV_PAL,
+  PIF_TV_NTSC,
+  PIF_TV_MPAL,
+};
+
+/* ============================================================================
+ *  What the CPU and RSP look like when the PIF ROM (IPL1/IPL2) hands over
+ *  to the cartridge's boot code. GPRs are sign-extended, as the CPU sees
+ *  them. Cartridge bytes [dmemOffset, PIF_BOOT_CODE_END) belong at the
+ *  same offset in RSP DMEM, in big-endian order, and the first imemWords
+ *  words of RSP IMEM hold the given words. RDRAM is left to the boot code.
+ * ========================================================================= */
+struct PIFBootState {
+  enum PIFCIC cic;
+  uint32_t seed;
+
+  uint64_t gpr[32];
+  uint64_t pc;
+  uint32_t cp0Status;
+  uint32_t cp0Config;
+
+  uint32_t dmemOffset;
+  uint32_t imem[PIF_BOOT_IMEM_WORDS];
+  unsigned imemWords;
+};
+
+int BootPIF(struct PIFController *, const uint8_t *, size_t, enum PIFTVType,
+  struct PIFBootState *);
+enum PIFCIC DetectPIFCIC(const uint8_t *, size_t);
+const char *GetPIFCICName(enum PIFCIC);
+uint32_t GetPIFCICSeed(enum PIFCIC);
+
+#endif
+
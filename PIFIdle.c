@@ -0,0 +1,77 @@
+/* ============================================================================
+ *  PIFIdle.c: Detects the guest spinning on the PIF's status.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "PIFIdle.h"
+#include "PIFStats.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#else
+#include <stdlib.h>
+#endif
+
+/* ============================================================================
+ *  GetPIFIdleDetections: Returns how many idle loops have been reported.
+ * ========================================================================= */
+uint64_t
+GetPIFIdleDetections(const struct PIFController *controller) {
+  return controller->idle ? controller->idle->detections : 0;
+}
+
+/* ============================================================================
+ *  ReportPIFIdle: Tells the host the guest is idling, and counts it.
+ * ========================================================================= */
+void
+ReportPIFIdle(struct PIFController *controller) {
+  struct PIFIdle *idle = controller->idle;
+
+  idle->reads = 1;
+  idle->detections++;
+  EndPIFStats(controller, PIF_STATS_IDLE_WAIT, 0);
+
+  idle->idle(idle->opaque, PIF_RAM_BASE_ADDRESS + idle->address,
+    idle->value);
+}
+
+/* ============================================================================
+ *  SetPIFIdleDetection: Starts (or, given no callback, stops) detection.
+ *
+ *  A threshold of 0 picks PIF_IDLE_THRESHOLD. Reads of 0x24 and 0x3C are
+ *  never served inline (see GetPIFMemoryDescriptor), so every poll is
+ *  seen. Stopping forgets the count of detections.
+ * ========================================================================= */
+int
+SetPIFIdleDetection(struct PIFController *controller, unsigned threshold,
+  PIFIdleFunction callback, void *opaque) {
+  struct PIFIdle *idle = controller->idle;
+
+  if (callback == NULL) {
+    controller->idle = NULL;
+    free(idle);
+    return 0;
+  }
+
+  if (idle == NULL) {
+    if ((idle = (struct PIFIdle *) calloc(1, sizeof(*idle))) == NULL)
+      return -1;
+
+    controller->idle = idle;
+  }
+
+  idle->idle = callback;
+  idle->opaque = opaque;
+  idle->threshold = threshold ? threshold : PIF_IDLE_THRESHOLD;
+  idle->reads = 0;
+  return 0;
+}
+
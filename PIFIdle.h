@@ -0,0 +1,80 @@
+/* ============================================================================
+ *  PIFIdle.h: Detects the guest spinning on the PIF's status.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFIDLE_H__
+#define __PIF__PIFIDLE_H__
+#include "Common.h"
+#include "Controller.h"
+
+/* ============================================================================
+ *  While booting, the guest polls PIF RAM 0x24 and 0x3C until the status
+ *  changes. A run of threshold reads of the same word, returning the same
+ *  value with the same status and nothing written or DMAed in between, is
+ *  taken as the guest idling; the host is told, so it can skip ahead to
+ *  its next event instead of emulating the loop. The callback fires again
+ *  for every further threshold reads for as long as the loop lasts.
+ * ========================================================================= */
+#define PIF_IDLE_THRESHOLD        8
+
+/* Called with the address polled and the value it keeps returning. */
+typedef void (*PIFIdleFunction)(void *, uint32_t, uint32_t);
+
+struct PIFIdle {
+  PIFIdleFunction idle;
+  void *opaque;
+  unsigned threshold;
+
+  /* The read the current run repeats, and how long it is so far. */
+  uint32_t address;
+  uint32_t value;
+  uint32_t status;
+  unsigned reads;
+
+  uint64_t detections;
+};
+
+uint64_t GetPIFIdleDetections(const struct PIFController *);
+void ReportPIFIdle(struct PIFController *);
+int SetPIFIdleDetection(struct PIFController *, unsigned, PIFIdleFunction,
+  void *);
+
+/* ============================================================================
+ *  NotePIFStatusRead: Extends or restarts the run of identical reads.
+ * ========================================================================= */
+static inline void
+NotePIFStatusRead(struct PIFController *controller, uint32_t address,
+  uint32_t value) {
+  struct PIFIdle *idle = controller->idle;
+
+  if (idle->reads && idle->address == address && idle->value == value &&
+    idle->status == controller->status) {
+    if (++idle->reads >= idle->threshold)
+      ReportPIFIdle(controller);
+
+    return;
+  }
+
+  idle->address = address;
+  idle->value = value;
+  idle->status = controller->status;
+  idle->reads = 1;
+}
+
+/* ============================================================================
+ *  ResetPIFIdle: Ends the run; the PIF's state has changed.
+ * ========================================================================= */
+static inline void
+ResetPIFIdle(struct PIFController *controller) {
+  if (unlikely(controller->idle != NULL))
+    controller->idle->reads = 0;
+}
+
+#endif
+
@@ -0,0 +1,187 @@
+/* ============================================================================
+ *  PIFROMCache.c: PIF ROM images, mapped once and shared process-wide.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "FileMap.h"
+#include "PIFROMCache.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  The cache is a list of images, guarded by a spin lock: it is only held
+ *  for list walks (files are mapped and hashed outside it), and a static
+ *  lock needs no setup. A ROM replaced on disk is not noticed until its
+ *  last user lets go.
+ * ========================================================================= */
+static struct PIFROMImage *PIFROMCacheHead;
+static volatile uint32_t PIFROMCacheLock;
+
+static struct PIFROMImage *CreatePIFROMImage(const char *);
+static uint64_t HashPIFROM(const uint8_t *);
+
+/* ============================================================================
+ *  LockPIFROMCache/UnlockPIFROMCache: Guard the list of images.
+ * ========================================================================= */
+static inline void
+LockPIFROMCache(void) {
+  while (ExchangePIFAtomic(&PIFROMCacheLock, 1))
+    PIFCpuRelax();
+}
+
+static inline void
+UnlockPIFROMCache(void) {
+  StorePIFAtomic(&PIFROMCacheLock, 0);
+}
+
+/* ============================================================================
+ *  AcquirePIFROM: Returns a reference to the ROM image at path.
+ *
+ *  Only the first reference to a path touches the file; later ones are a
+ *  list walk. Returns NULL if the file is missing or too short.
+ * ========================================================================= */
+struct PIFROMImage *
+AcquirePIFROM(const char *path) {
+  struct PIFROMImage *image, *other;
+
+  LockPIFROMCache();
+
+  for (image = PIFROMCacheHead; image; image = image->next) {
+    if (image->map.path && !strcmp(image->map.path, path)) {
+      image->references++;
+      UnlockPIFROMCache();
+      return image;
+    }
+  }
+
+  UnlockPIFROMCache();
+
+  if ((image = CreatePIFROMImage(path)) == NULL)
+    return NULL;
+
+  /* Another thread may have beaten us to it; same ROM, other name too. */
+  LockPIFROMCache();
+
+  for (other = PIFROMCacheHead; other; other = other->next) {
+    if ((other->map.path && !strcmp(other->map.path, path)) ||
+      (other->hash == image->hash && !memcmp(other->map.base,
+      image->map.base, PIF_ROM_ADDRESS_LEN))) {
+      other->references++;
+      UnlockPIFROMCache();
+
+      CloseFileMap(&image->map);
+      free(image->shadow);
+      free(image);
+      return other;
+    }
+  }
+
+  image->references = 1;
+  image->next = PIFROMCacheHead;
+  PIFROMCacheHead = image;
+
+  UnlockPIFROMCache();
+  return image;
+}
+
+/* ============================================================================
+ *  CreatePIFROMImage: Maps a ROM and builds its host order shadow.
+ * ========================================================================= */
+static struct PIFROMImage *
+CreatePIFROMImage(const char *path) {
+  struct PIFROMImage *image;
+  unsigned i;
+
+  if ((image = (struct PIFROMImage *) calloc(1, sizeof(*image))) == NULL)
+    return NULL;
+
+  if (OpenFileMap(&image->map, path, 0, FILEMAP_READ_ONLY)) {
+    debug("Failed to open PIFROM image.");
+
+    free(image);
+    return NULL;
+  }
+
+  /* Anything past the ROM (e.g., a dump that includes PIF RAM) is unused. */
+  if (image->map.size < PIF_ROM_ADDRESS_LEN) {
+    debugarg("PIFROM image is too short (%lu bytes).",
+      (unsigned long) image->map.size);
+
+    CloseFileMap(&image->map);
+    free(image);
+    return NULL;
+  }
+
+  if ((image->shadow = (uint32_t *) malloc(PIF_ROM_ADDRESS_LEN)) == NULL) {
+    debug("Failed to allocate memory for PIFROM image.");
+
+    CloseFileMap(&image->map);
+    free(image);
+    return NULL;
+  }
+
+  /* Swap the image once, so reads are plain loads. */
+  memcpy(image->shadow, image->map.base, PIF_ROM_ADDRESS_LEN);
+
+  for (i = 0; i < PIF_ROM_ADDRESS_LEN / sizeof(uint32_t); i++)
+    image->shadow[i] = ByteOrderSwap32(image->shadow[i]);
+
+  image->hash = HashPIFROM(image->map.base);
+  return image;
+}
+
+/* ============================================================================
+ *  HashPIFROM: Hashes the ROM's contents.
+ * ========================================================================= */
+static uint64_t
+HashPIFROM(const uint8_t *rom) {
+  uint64_t hash = 0;
+  uint32_t word;
+  unsigned i;
+
+  for (i = 0; i < PIF_ROM_ADDRESS_LEN; i += sizeof(word)) {
+    memcpy(&word, rom + i, sizeof(word));
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+  }
+
+  return hash;
+}
+
+/* ============================================================================
+ *  ReleasePIFROM: Drops a reference; the last one unmaps the image.
+ * ========================================================================= */
+void
+ReleasePIFROM(struct PIFROMImage *image) {
+  struct PIFROMImage **link;
+
+  LockPIFROMCache();
+
+  if (--image->references) {
+    UnlockPIFROMCache();
+    return;
+  }
+
+  for (link = &PIFROMCacheHead; *link != image; link = &(*link)->next);
+  *link = image->next;
+
+  UnlockPIFROMCache();
+
+  CloseFileMap(&image->map);
+  free(image->shadow);
+  free(image);
+}
+
@@ -0,0 +1,34 @@
+/* ============================================================================
+ *  PIFROMCache.h: PIF ROM images, mapped once and shared process-wide.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFROMCACHE_H__
+#define __PIF__PIFROMCACHE_H__
+#include "Common.h"
+#include "FileMap.h"
+
+/* ============================================================================
+ *  An image is the file mapped read-only, plus its words swapped to host
+ *  order. Images are found by path first, and by content hash when the
+ *  same ROM is opened under another path; either way, every controller
+ *  using it shares one copy, which goes away with the last reference.
+ * ========================================================================= */
+struct PIFROMImage {
+  struct PIFROMImage *next;
+  struct FileMap map;
+  uint32_t *shadow;
+  uint64_t hash;
+  uint32_t references;
+};
+
+struct PIFROMImage *AcquirePIFROM(const char *);
+void ReleasePIFROM(struct PIFROMImage *);
+
+#endif
+
@@ -0,0 +1,166 @@
+/* ============================================================================
+ *  PIFStats.c: Optional per-command counters and latency histograms.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "PIFStats.h"
+#include "PIFWorker.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+static const char *const PIFStatsNames[NUM_PIF_STATS_COUNTERS] = {
+  "cmd_status",
+  "cmd_read",
+  "cmd_pak_read",
+  "cmd_pak_write",
+  "cmd_eeprom_read",
+  "cmd_eeprom_write",
+  "cmd_other",
+  "dma_write",
+  "dma_read",
+  "ram_read8",
+  "ram_read16",
+  "ram_read32",
+  "ram_write8",
+  "ram_write16",
+  "ram_write32",
+  "input_poll",
+  "idle_wait",
+};
+
+/* ============================================================================
+ *  GetPIFStats: Copies out the counters, or returns -1 if disabled.
+ *
+ *  Counters are updated without locks, so this should be called from the
+ *  thread that runs the PIF (e.g., once a frame).
+ * ========================================================================= */
+int
+GetPIFStats(const struct PIFController *controller, struct PIFStats *stats) {
+  if (controller->stats == NULL)
+    return -1;
+
+  memcpy(stats, controller->stats, sizeof(*stats));
+  return 0;
+}
+
+/* ============================================================================
+ *  GetPIFStatsName: Returns a short, machine-readable name for a counter.
+ * ========================================================================= */
+const char *
+GetPIFStatsName(enum PIFStatsCounter counter) {
+  return counter < NUM_PIF_STATS_COUNTERS ? PIFStatsNames[counter] : NULL;
+}
+
+/* ============================================================================
+ *  RecordPIFStats: Adds a timed event that took ticks to a counter.
+ * ========================================================================= */
+void
+RecordPIFStats(struct PIFStats *stats, enum PIFStatsCounter counter,
+  uint64_t ticks) {
+  struct PIFStatsHistogram *histogram = stats->counters + counter;
+  unsigned bucket;
+
+#ifdef __GNUC__
+  bucket = ticks ? 63 - __builtin_clzll(ticks) : 0;
+#else
+  for (bucket = 0; ticks >> (bucket + 1); bucket++);
+#endif
+
+  if (bucket >= PIF_STATS_BUCKETS)
+    bucket = PIF_STATS_BUCKETS - 1;
+
+  histogram->samples++;
+  histogram->totalTicks += ticks;
+  histogram->buckets[bucket]++;
+
+  if (ticks > histogram->maxTicks)
+    histogram->maxTicks = ticks;
+}
+
+/* ============================================================================
+ *  ResetPIFStats: Zeroes every counter.
+ * ========================================================================= */
+void
+ResetPIFStats(struct PIFController *controller) {
+  struct PIFStats *stats = controller->stats;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (stats) {
+    memset(stats->counters, 0, sizeof(stats->counters));
+    SetPIFStatsSamplePeriod(controller, stats->samplePeriod);
+  }
+}
+
+/* ============================================================================
+ *  SetPIFStats: Starts or stops collecting stats.
+ *
+ *  Stats are only collected in builds with PIF_STATS defined (make
+ *  STATS=1); otherwise, enabling them fails and the hooks cost nothing.
+ *  Disabling them frees the counters.
+ * ========================================================================= */
+int
+SetPIFStats(struct PIFController *controller, bool enable) {
+#ifdef PIF_STATS
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (!enable) {
+    free(controller->stats);
+    controller->stats = NULL;
+  }
+
+  else if (controller->stats == NULL) {
+    if ((controller->stats = (struct PIFStats *)
+      calloc(1, sizeof(*controller->stats))) == NULL)
+      return -1;
+
+    SetPIFStatsSamplePeriod(controller, PIF_STATS_SAMPLE_PERIOD);
+  }
+
+  return 0;
+#else
+  (void) controller;
+
+  if (enable) {
+    debug("PIFStats: Stats were not compiled in (PIF_STATS).");
+    return -1;
+  }
+
+  return 0;
+#endif
+}
+
+/* ============================================================================
+ *  SetPIFStatsSamplePeriod: Times one event in every period (1 = all).
+ *
+ *  Counts are always exact; timing fewer events keeps the overhead low
+ *  enough to leave stats on.
+ * ========================================================================= */
+void
+SetPIFStatsSamplePeriod(struct PIFController *controller, unsigned period) {
+  struct PIFStats *stats = controller->stats;
+  unsigned i;
+
+  if (stats && period) {
+    stats->samplePeriod = period;
+
+    for (i = 0; i < NUM_PIF_STATS_COUNTERS; i++)
+      stats->counters[i].countdown = period;
+  }
+}
+
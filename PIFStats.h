@@ -0,0 +1,155 @@
+/* ============================================================================
+ *  PIFStats.h: Optional per-command counters and latency histograms.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFSTATS_H__
+#define __PIF__PIFSTATS_H__
+#include "Common.h"
+#include "Controller.h"
+
+#if defined(PIF_STATS) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#elif defined(PIF_STATS)
+#include "Thread.h"
+#endif
+
+enum PIFStatsCounter {
+  PIF_STATS_CMD_STATUS,
+  PIF_STATS_CMD_READ,
+  PIF_STATS_CMD_PAK_READ,
+  PIF_STATS_CMD_PAK_WRITE,
+  PIF_STATS_CMD_EEPROM_READ,
+  PIF_STATS_CMD_EEPROM_WRITE,
+  PIF_STATS_CMD_OTHER,
+  PIF_STATS_DMA_WRITE,
+  PIF_STATS_DMA_READ,
+  PIF_STATS_RAM_READ8,
+  PIF_STATS_RAM_READ16,
+  PIF_STATS_RAM_READ32,
+  PIF_STATS_RAM_WRITE8,
+  PIF_STATS_RAM_WRITE16,
+  PIF_STATS_RAM_WRITE32,
+  PIF_STATS_INPUT_POLL,
+  PIF_STATS_IDLE_WAIT,
+  NUM_PIF_STATS_COUNTERS
+};
+
+/* ============================================================================
+ *  Each counter keeps a count of its events. One of its events in every
+ *  samplePeriod is also timed, and goes into the
+ *  counter's total and log2 histogram: bucket i holds events that took
+ *  [2^i, 2^(i+1)) ticks, where a tick is a TSC cycle on x86 and a
+ *  nanosecond elsewhere. A DMA read includes the commands it ran.
+ *  Commands answered from a memoized response are counted, never timed.
+ * ========================================================================= */
+#define PIF_STATS_BUCKETS         32
+#define PIF_STATS_SAMPLE_PERIOD   64
+
+struct PIFStatsHistogram {
+  uint64_t count;
+  uint64_t samples;
+  uint64_t totalTicks;
+  uint64_t maxTicks;
+  uint64_t buckets[PIF_STATS_BUCKETS];
+  unsigned countdown;
+};
+
+struct PIFStats {
+  struct PIFStatsHistogram counters[NUM_PIF_STATS_COUNTERS];
+  unsigned samplePeriod;
+};
+
+const char *GetPIFStatsName(enum PIFStatsCounter);
+int GetPIFStats(const struct PIFController *, struct PIFStats *);
+void RecordPIFStats(struct PIFStats *, enum PIFStatsCounter, uint64_t);
+void ResetPIFStats(struct PIFController *);
+int SetPIFStats(struct PIFController *, bool);
+void SetPIFStatsSamplePeriod(struct PIFController *, unsigned);
+
+/* ============================================================================
+ *  BeginPIFStats/EndPIFStats: Count and maybe time an event.
+ *
+ *  Without PIF_STATS, both compile away to nothing. BeginPIFStats returns
+ *  0 for events that are not timed.
+ * ========================================================================= */
+#ifdef PIF_STATS
+static inline uint64_t
+ReadPIFStatsTicks(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  return PIFMonotonicTime();
+#endif
+}
+
+static inline uint64_t
+BeginPIFStats(const struct PIFController *controller,
+  enum PIFStatsCounter counter) {
+  struct PIFStats *stats = controller->stats;
+
+  if (likely(stats == NULL) || --stats->counters[counter].countdown)
+    return 0;
+
+  stats->counters[counter].countdown = stats->samplePeriod;
+  return ReadPIFStatsTicks();
+}
+
+static inline void
+EndPIFStats(struct PIFController *controller,
+  enum PIFStatsCounter counter, uint64_t start) {
+  struct PIFStats *stats = controller->stats;
+
+  if (likely(stats == NULL))
+    return;
+
+  stats->counters[counter].count++;
+
+  if (unlikely(start != 0))
+    RecordPIFStats(stats, counter, ReadPIFStatsTicks() - start);
+}
+#else
+static inline uint64_t
+BeginPIFStats(const struct PIFController *controller,
+  enum PIFStatsCounter counter) {
+  (void) controller;
+  (void) counter;
+  return 0;
+}
+
+static inline void
+EndPIFStats(struct PIFController *controller,
+  enum PIFStatsCounter counter, uint64_t start) {
+  (void) controller;
+  (void) counter;
+  (void) start;
+}
+#endif
+
+/* ============================================================================
+ *  PIFStatsCommand: Maps a joybus command byte to its counter.
+ * ========================================================================= */
+static inline enum PIFStatsCounter
+PIFStatsCommand(uint8_t command) {
+  switch (command) {
+  case 0x00:
+  case 0xFF:
+    return PIF_STATS_CMD_STATUS;
+
+  case 0x01: return PIF_STATS_CMD_READ;
+  case 0x02: return PIF_STATS_CMD_PAK_READ;
+  case 0x03: return PIF_STATS_CMD_PAK_WRITE;
+  case 0x04: return PIF_STATS_CMD_EEPROM_READ;
+  case 0x05: return PIF_STATS_CMD_EEPROM_WRITE;
+  }
+
+  return PIF_STATS_CMD_OTHER;
+}
+
+#endif
+
@@ -0,0 +1,220 @@
+/* ============================================================================
+ *  PIFTrace.c: Binary event tracing into a per-instance ring buffer.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "PIFTrace.h"
+#include "PIFWorker.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  Writers (the emulation thread, and the PIF worker when pipelining)
+ *  claim a slot by bumping the head, then fill it in under a per-record
+ *  seqlock: the sequence is invalid while the record is being written.
+ *  Once full, the oldest records are overwritten. Readers keep only the
+ *  records whose sequence was what they expected both before and after
+ *  copying; neither side ever blocks.
+ * ========================================================================= */
+#define PIF_TRACE_WRITING         0xFFFFFFFFU
+
+struct PIFTrace {
+  struct PIFController *controller;
+  struct PIFTraceRecord *records;
+  uint32_t mask;
+
+  volatile uint32_t head;
+};
+
+/* ============================================================================
+ *  AppendPIFTrace: Adds an event to the ring.
+ * ========================================================================= */
+void
+AppendPIFTrace(struct PIFTrace *trace, enum PIFTraceEvent event,
+  unsigned size, uint32_t address, uint32_t value) {
+  uint32_t head = AddPIFAtomic(&trace->head, 1) - 1;
+  struct PIFTraceRecord *record = trace->records + (head & trace->mask);
+  volatile uint32_t *sequence = (volatile uint32_t *) &record->sequence;
+
+  StorePIFAtomic(sequence, PIF_TRACE_WRITING);
+  PIFReleaseFence();
+
+  record->time = PIFMonotonicTime();
+  record->address = address;
+  record->value = value;
+  record->event = event;
+  record->size = size;
+  record->reserved = 0;
+
+  StorePIFAtomic(sequence, head);
+}
+
+/* ============================================================================
+ *  CreatePIFTrace: Attaches a ring of at least the given number of records.
+ *
+ *  Every category starts out enabled. The trace belongs to the controller
+ *  from here on.
+ * ========================================================================= */
+struct PIFTrace *
+CreatePIFTrace(struct PIFController *controller, size_t records) {
+  struct PIFTrace *trace;
+  size_t capacity = 64;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->trace) {
+    debug("PIFTrace: A trace is already attached.");
+    return NULL;
+  }
+
+  while (capacity < records && capacity < ((size_t) 1 << 31))
+    capacity <<= 1;
+
+  if ((trace = (struct PIFTrace *) calloc(1, sizeof(*trace))) == NULL)
+    return NULL;
+
+  if ((trace->records = (struct PIFTraceRecord *) calloc(capacity,
+    sizeof(*trace->records))) == NULL) {
+    free(trace);
+    return NULL;
+  }
+
+  trace->controller = controller;
+  trace->mask = capacity - 1;
+
+  controller->trace = trace;
+  SetPIFTraceCategories(controller, PIF_TRACE_ALL);
+  return trace;
+}
+
+/* ============================================================================
+ *  DestroyPIFTrace: Detaches a trace from its controller and frees it.
+ * ========================================================================= */
+void
+DestroyPIFTrace(struct PIFTrace *trace) {
+  if (unlikely(trace->controller->worker != NULL))
+    SyncPIFWorker(trace->controller->worker);
+
+  trace->controller->traceCategories = 0;
+  trace->controller->trace = NULL;
+
+  free(trace->records);
+  free(trace);
+}
+
+/* ============================================================================
+ *  ReadPIFTrace: Copies out up to max of the latest records, oldest first.
+ *
+ *  Safe to call from any thread while the PIF runs. Records that are
+ *  being written, or were overwritten while they were copied, are left
+ *  out, so fewer than max may be returned even when the ring is full.
+ * ========================================================================= */
+size_t
+ReadPIFTrace(struct PIFTrace *trace, struct PIFTraceRecord *records,
+  size_t max) {
+  uint32_t head = LoadPIFAtomic(&trace->head), first, i;
+  size_t count = trace->mask + (size_t) 1, kept = 0;
+
+  if (count > head)
+    count = head;
+
+  if (count > max)
+    count = max;
+
+  first = head - (uint32_t) count;
+
+  for (i = 0; i < count; i++) {
+    const struct PIFTraceRecord *record =
+      trace->records + ((first + i) & trace->mask);
+    const volatile uint32_t *sequence =
+      (const volatile uint32_t *) &record->sequence;
+
+    if (LoadPIFAtomic(sequence) != first + i)
+      continue;
+
+    records[kept] = *record;
+
+    /* Drop the copy if the writer got to the record meanwhile. */
+    PIFAcquireFence();
+
+    if (LoadPIFAtomic(sequence) == first + i)
+      records[kept++].sequence = first + i;
+  }
+
+  return kept;
+}
+
+/* ============================================================================
+ *  SetPIFTraceCategories: Selects the categories (PIF_TRACE_*) to record.
+ * ========================================================================= */
+void
+SetPIFTraceCategories(struct PIFController *controller, uint32_t categories) {
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  controller->traceCategories = controller->trace ? categories : 0;
+}
+
+/* ============================================================================
+ *  WritePIFTrace: Saves the records in the ring to a trace file.
+ * ========================================================================= */
+int
+WritePIFTrace(struct PIFTrace *trace, const char *path) {
+  struct PIFTraceRecord *records;
+  uint8_t header[PIF_TRACE_HEADER_SIZE];
+  size_t count, capacity = (size_t) trace->mask + 1;
+  uint32_t dropped, length;
+  FILE *file;
+  int status;
+
+  if ((records = (struct PIFTraceRecord *) malloc(
+    capacity * sizeof(*records))) == NULL)
+    return -1;
+
+  /* Everything older than the last record kept, and not kept, was lost. */
+  count = ReadPIFTrace(trace, records, capacity);
+  dropped = count ? records[count - 1].sequence + 1 - (uint32_t) count :
+    LoadPIFAtomic(&trace->head);
+  length = (uint32_t) count;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, "PIFT", 4);
+  header[4] = PIF_TRACE_VERSION;
+  header[5] = sizeof(*records);
+  memcpy(header + 8, &length, sizeof(length));
+  memcpy(header + 12, &dropped, sizeof(dropped));
+
+  if ((file = fopen(path, "wb")) == NULL) {
+    debug("PIFTrace: Failed to create the trace file.");
+
+    free(records);
+    return -1;
+  }
+
+  status = fwrite(header, sizeof(header), 1, file) == 1 &&
+    fwrite(records, sizeof(*records), count, file) == count ? 0 : -1;
+
+  if (fclose(file))
+    status = -1;
+
+  free(records);
+  return status;
+}
+
@@ -0,0 +1,86 @@
+/* ============================================================================
+ *  PIFTrace.h: Binary event tracing into a per-instance ring buffer.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFTRACE_H__
+#define __PIF__PIFTRACE_H__
+#include "Common.h"
+#include "Controller.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+struct PIFTrace;
+
+/* Categories, which can be enabled and disabled while running. */
+#define PIF_TRACE_SI              0x1
+#define PIF_TRACE_DMA             0x2
+#define PIF_TRACE_RAM             0x4
+#define PIF_TRACE_JOYBUS          0x8
+#define PIF_TRACE_ALL             0xF
+
+enum PIFTraceEvent {
+  PIF_TRACE_REG_READ,
+  PIF_TRACE_REG_WRITE,
+  PIF_TRACE_DMA_TO_PIF,
+  PIF_TRACE_DMA_FROM_PIF,
+  PIF_TRACE_RAM_READ,
+  PIF_TRACE_RAM_WRITE,
+  PIF_TRACE_COMMAND,
+  NUM_PIF_TRACE_EVENTS
+};
+
+/* ============================================================================
+ *  Every event is one fixed-size record. For register and RAM accesses,
+ *  address and value are the bus address and the data; for DMA, address
+ *  is the DRAM address; for joybus commands, address is the channel and
+ *  value holds the command byte, send length and receive length (bits
+ *  0-7, 8-15 and 16-23) and whether the command failed (bit 24).
+ *
+ *  A trace file is a 16-byte header ("PIFT", the version, the record
+ *  size, the number of records and the number dropped), then records,
+ *  oldest first, in the byte order of the host that wrote them.
+ * ========================================================================= */
+#define PIF_TRACE_HEADER_SIZE     16
+#define PIF_TRACE_VERSION         1
+
+struct PIFTraceRecord {
+  uint64_t time;
+  uint32_t sequence;
+  uint32_t address;
+  uint32_t value;
+  uint8_t event;
+  uint8_t size;
+  uint16_t reserved;
+};
+
+void AppendPIFTrace(struct PIFTrace *, enum PIFTraceEvent, unsigned,
+  uint32_t, uint32_t);
+struct PIFTrace *CreatePIFTrace(struct PIFController *, size_t);
+void DestroyPIFTrace(struct PIFTrace *);
+size_t ReadPIFTrace(struct PIFTrace *, struct PIFTraceRecord *, size_t);
+void SetPIFTraceCategories(struct PIFController *, uint32_t);
+int WritePIFTrace(struct PIFTrace *, const char *);
+
+/* ============================================================================
+ *  TracePIF: Records an event, if its category is enabled.
+ * ========================================================================= */
+static inline void
+TracePIF(struct PIFController *controller, uint32_t category,
+  enum PIFTraceEvent event, unsigned size, uint32_t address,
+  uint32_t value) {
+  if (unlikely(controller->traceCategories & category))
+    AppendPIFTrace(controller->trace, event, size, address, value);
+}
+
+#endif
+
@@ -0,0 +1,273 @@
+/* ============================================================================
+ *  PIFWorker.c: Runs joybus command blocks on a worker thread.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Actions.h"
+#include "Common.h"
+#include "Controller.h"
+#include "PIFWorker.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  The emulation thread is the only producer and the worker the only
+ *  consumer: head counts jobs queued and tail jobs finished, each stored
+ *  by one side only. Whoever finds nothing to do spins for a while, then
+ *  sleeps on a condition; the lock is only there for sleeping and waking.
+ *
+ *  Between queueing a block and syncing, the worker owns the PIF's state
+ *  (PIF RAM, the command caches, save media, the input path, timing,
+ *  traces and stats). The RAM and DMA handlers sync first, as does every
+ *  call that sets up, swaps or frees any of it (ports and backends, the
+ *  sampler and movie, pak and EEPROM files, the flusher and archive,
+ *  memoization, SI timing, traces and stats).
+ * ========================================================================= */
+#define PIF_WORKER_QUEUE_SIZE     4
+#define PIF_WORKER_SPINS          256
+
+enum PIFWorkerJob {
+  PIF_WORKER_PROCESS,
+  PIF_WORKER_STOP,
+};
+
+struct PIFWorker {
+  struct PIFController *controller;
+
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint8_t jobs[PIF_WORKER_QUEUE_SIZE];
+
+  struct PIFMutex lock;
+  struct PIFCond wake;
+  struct PIFCond done;
+  struct PIFThread thread;
+  bool workerWaiting;
+  bool syncWaiting;
+
+  /* Only touched by the emulation thread. */
+  struct PIFWorkerStats stats;
+  bool fresh;
+};
+
+static void *PIFWorkerThread(void *);
+static void PushPIFWorkerJob(struct PIFWorker *, enum PIFWorkerJob);
+
+/* ============================================================================
+ *  ClaimPIFWorkerResponse: Waits for the queued block to finish running.
+ *
+ *  Returns true if a block was run since the last claim, in which case
+ *  PIF RAM holds its response; otherwise, the caller runs it itself.
+ * ========================================================================= */
+bool
+ClaimPIFWorkerResponse(struct PIFWorker *worker) {
+  bool fresh = worker->fresh;
+
+  SyncPIFWorker(worker);
+  worker->fresh = false;
+  return fresh;
+}
+
+/* ============================================================================
+ *  CreatePIFWorker: Starts running a controller's command blocks early.
+ *
+ *  From here on, a block is handed to the worker as soon as it is written
+ *  (WR64B), and its response is collected when it is read back (RD64B);
+ *  the emulation thread only waits if the worker has not finished yet.
+ *  Input is read on the worker, so hosts whose input backends must run
+ *  on one thread (e.g., GLFW) should pair this with an InputSampler.
+ *
+ *  Returns NULL on a single processor: the two threads would only take
+ *  turns, and every block would cost a pair of context switches, so the
+ *  controller is better off running its blocks in place.
+ * ========================================================================= */
+struct PIFWorker *
+CreatePIFWorker(struct PIFController *controller) {
+  struct PIFWorker *worker;
+
+  if (controller->worker) {
+    debug("PIFWorker: A worker is already attached.");
+    return NULL;
+  }
+
+  if (CountPIFProcessors() == 1) {
+    debug("PIFWorker: Only one processor; running blocks in place.");
+    return NULL;
+  }
+
+  if ((worker = (struct PIFWorker *) calloc(1, sizeof(*worker))) == NULL)
+    return NULL;
+
+  worker->controller = controller;
+
+  InitPIFMutex(&worker->lock);
+  InitPIFCond(&worker->wake);
+  InitPIFCond(&worker->done);
+
+  if (StartPIFThread(&worker->thread, PIFWorkerThread, worker)) {
+    debug("PIFWorker: Failed to start the worker thread.");
+
+    DestroyPIFCond(&worker->done);
+    DestroyPIFCond(&worker->wake);
+    DestroyPIFMutex(&worker->lock);
+    free(worker);
+    return NULL;
+  }
+
+  controller->worker = worker;
+  return worker;
+}
+
+/* ============================================================================
+ *  DestroyPIFWorker: Finishes any queued block and stops the worker.
+ * ========================================================================= */
+void
+DestroyPIFWorker(struct PIFWorker *worker) {
+  SyncPIFWorker(worker);
+  PushPIFWorkerJob(worker, PIF_WORKER_STOP);
+  JoinPIFThread(&worker->thread);
+
+  /* A block run but never read back stays in PIF RAM, as before. */
+  worker->controller->worker = NULL;
+
+  DestroyPIFCond(&worker->done);
+  DestroyPIFCond(&worker->wake);
+  DestroyPIFMutex(&worker->lock);
+  free(worker);
+}
+
+/* ============================================================================
+ *  GetPIFWorkerStats: Copies out the worker's counters.
+ * ========================================================================= */
+void
+GetPIFWorkerStats(const struct PIFWorker *worker,
+  struct PIFWorkerStats *stats) {
+  memcpy(stats, &worker->stats, sizeof(*stats));
+}
+
+/* ============================================================================
+ *  PIFWorkerThread: Runs queued command blocks until told to stop.
+ * ========================================================================= */
+static void *
+PIFWorkerThread(void *opaque) {
+  struct PIFWorker *worker = (struct PIFWorker *) opaque;
+  uint32_t tail = worker->tail;
+
+  for (;;) {
+    unsigned spins = 0;
+
+    while (LoadPIFAtomic(&worker->head) == tail) {
+      if (spins++ < PIF_WORKER_SPINS) {
+        PIFCpuRelax();
+        continue;
+      }
+
+      LockPIFMutex(&worker->lock);
+      worker->workerWaiting = true;
+
+      while (LoadPIFAtomic(&worker->head) == tail)
+        WaitPIFCond(&worker->wake, &worker->lock);
+
+      worker->workerWaiting = false;
+      UnlockPIFMutex(&worker->lock);
+    }
+
+    if (worker->jobs[tail % PIF_WORKER_QUEUE_SIZE] == PIF_WORKER_STOP)
+      break;
+
+    PIFProcess(worker->controller);
+    StorePIFAtomic(&worker->tail, ++tail);
+
+    LockPIFMutex(&worker->lock);
+
+    if (worker->syncWaiting)
+      SignalPIFCond(&worker->done);
+
+    UnlockPIFMutex(&worker->lock);
+  }
+
+  return NULL;
+}
+
+/* ============================================================================
+ *  PushPIFWorkerJob: Queues a job and wakes the worker if it is asleep.
+ * ========================================================================= */
+static void
+PushPIFWorkerJob(struct PIFWorker *worker, enum PIFWorkerJob job) {
+  uint32_t head = worker->head;
+
+  if (head - LoadPIFAtomic(&worker->tail) == PIF_WORKER_QUEUE_SIZE)
+    SyncPIFWorker(worker);
+
+  worker->jobs[head % PIF_WORKER_QUEUE_SIZE] = job;
+  StorePIFAtomic(&worker->head, head + 1);
+
+  LockPIFMutex(&worker->lock);
+
+  if (worker->workerWaiting)
+    SignalPIFCond(&worker->wake);
+
+  UnlockPIFMutex(&worker->lock);
+}
+
+/* ============================================================================
+ *  QueuePIFWorker: Hands the command block just written to the worker.
+ * ========================================================================= */
+void
+QueuePIFWorker(struct PIFWorker *worker) {
+  PushPIFWorkerJob(worker, PIF_WORKER_PROCESS);
+
+  worker->stats.blocks++;
+  worker->fresh = true;
+}
+
+/* ============================================================================
+ *  SyncPIFWorker: Waits until every queued block has finished running.
+ *
+ *  Afterwards, the PIF's state belongs to the emulation thread again,
+ *  until the next block is queued. Hosts call this before changing the
+ *  controller's configuration (save media, ports, and so on).
+ * ========================================================================= */
+void
+SyncPIFWorker(struct PIFWorker *worker) {
+  uint32_t head = worker->head;
+  unsigned spins = 0;
+  uint64_t start;
+
+  if (likely(LoadPIFAtomic(&worker->tail) == head))
+    return;
+
+  start = PIFMonotonicTime();
+
+  while (LoadPIFAtomic(&worker->tail) != head) {
+    if (spins++ < PIF_WORKER_SPINS) {
+      PIFCpuRelax();
+      continue;
+    }
+
+    LockPIFMutex(&worker->lock);
+    worker->syncWaiting = true;
+
+    while (LoadPIFAtomic(&worker->tail) != head)
+      WaitPIFCond(&worker->done, &worker->lock);
+
+    worker->syncWaiting = false;
+    UnlockPIFMutex(&worker->lock);
+  }
+
+  worker->stats.waits++;
+  worker->stats.totalWaitTime += PIFMonotonicTime() - start;
+}
+
@@ -0,0 +1,34 @@
+/* ============================================================================
+ *  PIFWorker.h: Runs joybus command blocks on a worker thread.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__PIFWORKER_H__
+#define __PIF__PIFWORKER_H__
+#include "Common.h"
+
+struct PIFController;
+struct PIFWorker;
+
+struct PIFWorkerStats {
+  uint64_t blocks;
+
+  /* Blocks the emulation thread had to wait for, and for how long (ns). */
+  uint64_t waits;
+  uint64_t totalWaitTime;
+};
+
+bool ClaimPIFWorkerResponse(struct PIFWorker *);
+struct PIFWorker *CreatePIFWorker(struct PIFController *);
+void DestroyPIFWorker(struct PIFWorker *);
+void GetPIFWorkerStats(const struct PIFWorker *, struct PIFWorkerStats *);
+void QueuePIFWorker(struct PIFWorker *);
+void SyncPIFWorker(struct PIFWorker *);
+
+#endif
+
@@ -0,0 +1,193 @@
+/* ============================================================================
+ *  SICapture.c: Logs the SI traffic a PIF sees, for offline replay.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "SICapture.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#define SI_CAPTURE_BUFFER_SIZE    16384
+
+static const uint8_t SICaptureMagic[4] = {'P', 'I', 'F', 'S'};
+
+struct SICapture {
+  struct PIFController *controller;
+  FILE *file;
+
+  uint8_t buffer[SI_CAPTURE_BUFFER_SIZE];
+  size_t buffered;
+  bool failed;
+};
+
+static void FlushSICapture(struct SICapture *);
+static void StoreLE32(uint8_t *, uint32_t);
+
+/* ============================================================================
+ *  CaptureSIEvent: Appends an event to the log.
+ *
+ *  block is only used (and must hold 64 bytes) for DMA events.
+ * ========================================================================= */
+void
+CaptureSIEvent(struct SICapture *capture, enum SICaptureEventType type,
+  unsigned size, uint32_t address, uint32_t value, const uint8_t *block) {
+  size_t length = SI_CAPTURE_RECORD_SIZE;
+  uint8_t *record;
+
+  if (type == SI_CAPTURE_DMA_WRITE || type == SI_CAPTURE_DMA_READ) {
+    length += PIF_RAM_ADDRESS_LEN;
+    size = PIF_RAM_ADDRESS_LEN;
+  }
+
+  if (capture->buffered + length > sizeof(capture->buffer))
+    FlushSICapture(capture);
+
+  record = capture->buffer + capture->buffered;
+  record[0] = type;
+  record[1] = size;
+  record[2] = 0;
+  record[3] = 0;
+  StoreLE32(record + 4, address);
+  StoreLE32(record + 8, value);
+
+  if (length > SI_CAPTURE_RECORD_SIZE)
+    memcpy(record + SI_CAPTURE_RECORD_SIZE, block, PIF_RAM_ADDRESS_LEN);
+
+  capture->buffered += length;
+}
+
+/* ============================================================================
+ *  CreateSICapture: Starts logging a controller's SI traffic to a file.
+ *
+ *  The capture belongs to the controller from here on.
+ * ========================================================================= */
+struct SICapture *
+CreateSICapture(struct PIFController *controller, const char *path) {
+  struct SICapture *capture;
+  unsigned i;
+
+  if (controller->capture) {
+    debug("SICapture: A capture is already attached.");
+    return NULL;
+  }
+
+  if ((capture = (struct SICapture *) calloc(1, sizeof(*capture))) == NULL)
+    return NULL;
+
+  if ((capture->file = fopen(path, "wb")) == NULL) {
+    debug("SICapture: Failed to create the log.");
+
+    free(capture);
+    return NULL;
+  }
+
+  memcpy(capture->buffer, SICaptureMagic, sizeof(SICaptureMagic));
+  memset(capture->buffer + 4, 0, SI_CAPTURE_HEADER_SIZE - 4);
+  capture->buffer[4] = SI_CAPTURE_VERSION;
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (controller->channels[i].connected)
+      capture->buffer[5] |= 1 << i;
+  }
+
+  capture->buffered = SI_CAPTURE_HEADER_SIZE;
+  capture->controller = controller;
+  controller->capture = capture;
+  return capture;
+}
+
+/* ============================================================================
+ *  DecodeSICaptureEvent: Reads the event at *cursor and steps past it.
+ *
+ *  Returns 1 at the end of the log, and -1 if the log is corrupt.
+ * ========================================================================= */
+int
+DecodeSICaptureEvent(const uint8_t **cursor, const uint8_t *end,
+  struct SICaptureEvent *event) {
+  const uint8_t *record = *cursor;
+
+  if (record >= end)
+    return 1;
+
+  if (end - record < SI_CAPTURE_RECORD_SIZE ||
+    record[0] < SI_CAPTURE_REG_WRITE || record[0] > SI_CAPTURE_RAM_WRITE)
+    return -1;
+
+  event->type = (enum SICaptureEventType) record[0];
+  event->size = record[1];
+  event->address = record[4] | record[5] << 8 |
+    record[6] << 16 | (uint32_t) record[7] << 24;
+  event->value = record[8] | record[9] << 8 |
+    record[10] << 16 | (uint32_t) record[11] << 24;
+  event->block = NULL;
+
+  record += SI_CAPTURE_RECORD_SIZE;
+
+  if (event->type == SI_CAPTURE_DMA_WRITE ||
+    event->type == SI_CAPTURE_DMA_READ) {
+    if (end - record < PIF_RAM_ADDRESS_LEN)
+      return -1;
+
+    event->block = record;
+    record += PIF_RAM_ADDRESS_LEN;
+  }
+
+  *cursor = record;
+  return 0;
+}
+
+/* ============================================================================
+ *  DestroySICapture: Finishes the log and detaches it from its controller.
+ * ========================================================================= */
+void
+DestroySICapture(struct SICapture *capture) {
+  capture->controller->capture = NULL;
+  FlushSICapture(capture);
+
+  if (fclose(capture->file) || capture->failed)
+    printf("SICapture: Failed to write the log.\n");
+
+  free(capture);
+}
+
+/* ============================================================================
+ *  FlushSICapture: Writes out any buffered events.
+ * ========================================================================= */
+static void
+FlushSICapture(struct SICapture *capture) {
+  if (capture->buffered && fwrite(capture->buffer, 1,
+    capture->buffered, capture->file) != capture->buffered) {
+    debug("SICapture: Failed to write to the log.");
+    capture->failed = true;
+  }
+
+  capture->buffered = 0;
+}
+
+/* ============================================================================
+ *  StoreLE32: Stores a word in little endian byte order.
+ * ========================================================================= */
+static void
+StoreLE32(uint8_t *dest, uint32_t word) {
+  dest[0] = word;
+  dest[1] = word >> 8;
+  dest[2] = word >> 16;
+  dest[3] = word >> 24;
+}
+
@@ -0,0 +1,64 @@
+/* ============================================================================
+ *  SICapture.h: Logs the SI traffic a PIF sees, for offline replay.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__SICAPTURE_H__
+#define __PIF__SICAPTURE_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+struct PIFController;
+struct SICapture;
+
+enum SICaptureEventType {
+  SI_CAPTURE_REG_WRITE = 1,
+  SI_CAPTURE_DMA_WRITE,
+  SI_CAPTURE_DMA_READ,
+  SI_CAPTURE_RAM_READ,
+  SI_CAPTURE_RAM_WRITE,
+};
+
+/* ============================================================================
+ *  A log is an 8-byte header ("PIFS", a version and the mask of ports that
+ *  were connected) followed by 12-byte records: the type, the access size
+ *  in bytes, two reserved bytes, then the address and value (both little
+ *  endian). DMA records have a size of 64 and are followed by the block:
+ *  what was copied into PIF RAM (the value is the DRAM source), or what
+ *  was copied back out (the value is the DRAM target).
+ *
+ *  Register writes are logged once they have been handled, so a DMA
+ *  record always comes just before the write that started the DMA.
+ * ========================================================================= */
+#define SI_CAPTURE_HEADER_SIZE    8
+#define SI_CAPTURE_RECORD_SIZE    12
+#define SI_CAPTURE_VERSION        1
+
+struct SICaptureEvent {
+  enum SICaptureEventType type;
+  unsigned size;
+  uint32_t address;
+  uint32_t value;
+  const uint8_t *block;
+};
+
+struct SICapture *CreateSICapture(struct PIFController *, const char *);
+void DestroySICapture(struct SICapture *);
+
+void CaptureSIEvent(struct SICapture *, enum SICaptureEventType, unsigned,
+  uint32_t, uint32_t, const uint8_t *);
+int DecodeSICaptureEvent(const uint8_t **, const uint8_t *,
+  struct SICaptureEvent *);
+
+#endif
+
@@ -0,0 +1,163 @@
+/* ============================================================================
+ *  SITiming.c: Optional cycle costs and deferred SI DMA completion.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Definitions.h"
+#include "Externs.h"
+#include "PIFIdle.h"
+#include "PIFWorker.h"
+#include "SITiming.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  CompleteSIDMA: Finishes the DMA the host was asked to schedule.
+ *
+ *  A read's response reaches DRAM only now. Returns -1 (and does nothing)
+ *  if id is not the DMA in flight, e.g., because a later DMA forced it
+ *  to finish early.
+ * ========================================================================= */
+int
+CompleteSIDMA(struct PIFController *controller, uint32_t id) {
+  struct SITiming *timing = controller->timing;
+
+  if (timing == NULL || !timing->pending || timing->id != id)
+    return -1;
+
+  timing->pending = false;
+  ResetPIFIdle(controller);
+
+  if (timing->read)
+    DMAToDRAM(controller->bus, timing->target, timing->response, 64);
+
+  controller->regs[SI_STATUS_REG] &= ~(SI_STATUS_DMA_BUSY | SI_STATUS_IO_BUSY);
+  controller->regs[SI_STATUS_REG] |= 0x1000;
+  BusRaiseRCPInterrupt(controller->bus, MI_INTR_SI);
+  return 0;
+}
+
+/* ============================================================================
+ *  GetSITransactionCycles: Returns what the last DMA cost, in cycles.
+ *
+ *  If channelCycles is given, it receives the cost of each channel's
+ *  commands (SI_TIMING_CHANNELS entries; the cartridge is channel 4).
+ * ========================================================================= */
+uint32_t
+GetSITransactionCycles(const struct PIFController *controller,
+  uint32_t *channelCycles) {
+  const struct SITiming *timing = controller->timing;
+
+  if (timing == NULL)
+    return 0;
+
+  if (channelCycles) {
+    memcpy(channelCycles, timing->channelCycles,
+      sizeof(timing->channelCycles));
+  }
+
+  return timing->cycles;
+}
+
+/* ============================================================================
+ *  InitSITimingModel: Fills in the default costs.
+ * ========================================================================= */
+void
+InitSITimingModel(struct SITimingModel *model) {
+  model->dmaCycles = SI_TIMING_DMA_CYCLES;
+  model->commandCycles = SI_TIMING_COMMAND_CYCLES;
+  model->byteCycles = SI_TIMING_BYTE_CYCLES;
+  model->absentCycles = SI_TIMING_ABSENT_CYCLES;
+}
+
+/* ============================================================================
+ *  ScheduleSIDMA: Marks the SI busy and hands a DMA's completion to the host.
+ *
+ *  A read (PIF RAM to DRAM at target) is charged for the commands it ran,
+ *  and its response is held back until completion. A DMA still in flight
+ *  is finished first, as the SI only runs one at a time.
+ * ========================================================================= */
+void
+ScheduleSIDMA(struct PIFController *controller, bool read, uint32_t target) {
+  struct SITiming *timing = controller->timing;
+
+  if (timing->pending)
+    CompleteSIDMA(controller, timing->id);
+
+  timing->cycles = timing->model.dmaCycles;
+  timing->target = target;
+  timing->read = read;
+
+  if (read) {
+    memcpy(timing->response, controller->ram, sizeof(timing->response));
+
+    if (controller->command[0x3F] == 0x1)
+      timing->cycles += timing->commandCycles;
+  }
+
+  controller->regs[SI_STATUS_REG] |= read ?
+    SI_STATUS_DMA_BUSY | SI_STATUS_IO_BUSY : SI_STATUS_DMA_BUSY;
+
+  timing->pending = true;
+  timing->schedule(timing->opaque, timing->cycles, ++timing->id);
+}
+
+/* ============================================================================
+ *  SetSITiming: Starts (or, given no model, stops) deferring SI DMAs.
+ *
+ *  Without a timing model, DMAs finish inside the register write that
+ *  starts them. With one, the host is told what each costs and finishes
+ *  it through CompleteSIDMA. Stopping finishes any DMA in flight.
+ * ========================================================================= */
+int
+SetSITiming(struct PIFController *controller,
+  const struct SITimingModel *model, SIScheduleFunction schedule,
+  void *opaque) {
+  struct SITiming *timing = controller->timing;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (model == NULL) {
+    if (timing) {
+      CompleteSIDMA(controller, timing->id);
+
+      controller->timing = NULL;
+      free(timing);
+    }
+
+    return 0;
+  }
+
+  if (schedule == NULL) {
+    debug("SITiming: A scheduler callback is required.");
+    return -1;
+  }
+
+  if (timing == NULL) {
+    if ((timing = (struct SITiming *) calloc(1, sizeof(*timing))) == NULL)
+      return -1;
+
+    controller->timing = timing;
+  }
+
+  timing->model = *model;
+  timing->schedule = schedule;
+  timing->opaque = opaque;
+  return 0;
+}
+
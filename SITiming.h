@@ -0,0 +1,93 @@
+/* ============================================================================
+ *  SITiming.h: Optional cycle costs and deferred SI DMA completion.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__SITIMING_H__
+#define __PIF__SITIMING_H__
+#include "Common.h"
+#include "Controller.h"
+
+/* ============================================================================
+ *  Costs are in CPU cycles (93.75 MHz). The joybus runs at 250 kbit/s, so
+ *  a byte takes about 3000 cycles; a port with nothing plugged in costs a
+ *  timeout instead. The defaults are rough and meant to be tuned.
+ * ========================================================================= */
+#define SI_TIMING_CHANNELS        5
+#define SI_TIMING_DMA_CYCLES      2304
+#define SI_TIMING_COMMAND_CYCLES  1500
+#define SI_TIMING_BYTE_CYCLES     3000
+#define SI_TIMING_ABSENT_CYCLES   9000
+
+/* SI_STATUS_REG bits set while a DMA is in flight. */
+#define SI_STATUS_DMA_BUSY        0x0001
+#define SI_STATUS_IO_BUSY         0x0002
+
+struct SITimingModel {
+  uint32_t dmaCycles;
+  uint32_t commandCycles;
+  uint32_t byteCycles;
+  uint32_t absentCycles;
+};
+
+/* Called with the cost of a DMA just started; once that many cycles have
+ * passed, the host calls CompleteSIDMA with the same id. */
+typedef void (*SIScheduleFunction)(void *, uint32_t, uint32_t);
+
+struct SITiming {
+  struct SITimingModel model;
+  SIScheduleFunction schedule;
+  void *opaque;
+
+  /* What the commands of the last block processed cost, per channel. */
+  uint32_t channelCycles[SI_TIMING_CHANNELS];
+  uint32_t commandCycles;
+
+  /* The DMA in flight, if any. */
+  uint8_t response[PIF_RAM_ADDRESS_LEN];
+  uint32_t cycles;
+  uint32_t target;
+  uint32_t id;
+  bool pending;
+  bool read;
+};
+
+int CompleteSIDMA(struct PIFController *, uint32_t);
+uint32_t GetSITransactionCycles(const struct PIFController *, uint32_t *);
+void InitSITimingModel(struct SITimingModel *);
+void ScheduleSIDMA(struct PIFController *, bool, uint32_t);
+int SetSITiming(struct PIFController *, const struct SITimingModel *,
+  SIScheduleFunction, void *);
+
+/* ============================================================================
+ *  CostSICommand: Charges a joybus command to its channel.
+ * ========================================================================= */
+static inline void
+CostSICommand(struct SITiming *timing, unsigned channel,
+  unsigned sendBytes, unsigned recvBytes, int result) {
+  uint32_t cycles = timing->model.commandCycles + (result ?
+    timing->model.absentCycles : (sendBytes + recvBytes) *
+    timing->model.byteCycles);
+
+  if (channel < SI_TIMING_CHANNELS)
+    timing->channelCycles[channel] += cycles;
+
+  timing->commandCycles += cycles;
+}
+
+/* ============================================================================
+ *  ResetSICommandCycles: Starts costing a new command block.
+ * ========================================================================= */
+static inline void
+ResetSICommandCycles(struct SITiming *timing) {
+  memset(timing->channelCycles, 0, sizeof(timing->channelCycles));
+  timing->commandCycles = 0;
+}
+
+#endif
+
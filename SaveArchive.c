@@ -0,0 +1,660 @@
+/* ============================================================================
+ *  SaveArchive.c: Indexed, single-file archive of per-game saves.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "FileMap.h"
+#include "MemPak.h"
+#include "PIFWorker.h"
+#include "SaveArchive.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  On-disk layout (host byte order):
+ *
+ *    header | slots[slotCapacity] | blobs[blobCapacity] | data
+ *
+ *  Slots form an open-addressed hash table keyed by ROM identity; each
+ *  slot names one blob per save medium. Blobs are reference counted so
+ *  that identical images (most commonly, blank ones) are stored once and
+ *  copied only when a game first writes to them. The data region is
+ *  reserved up front as a sparse file so that images never move.
+ * ========================================================================= */
+#define SAVE_ARCHIVE_MAGIC        "PIFSAVE"
+#define SAVE_ARCHIVE_VERSION      1
+#define SAVE_ARCHIVE_PAGE_SIZE    4096
+
+/* Blob 0 means "none"; blobs 1 and 2 are the shared blank images. */
+#define SAVE_BLOB_BLANK_EEPROM    1
+#define SAVE_BLOB_BLANK_PAK       2
+#define SAVE_BLOB_FIRST_FREE      3
+
+struct SaveArchiveHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t slotCapacity;
+  uint32_t slotsUsed;
+  uint32_t blobCapacity;
+  uint32_t blobsUsed;
+  uint32_t reserved;
+  uint64_t slotOffset;
+  uint64_t blobOffset;
+  uint64_t dataOffset;
+  uint64_t dataUsed;
+  uint64_t dataCapacity;
+};
+
+struct SaveArchiveSlot {
+  uint64_t key;
+  uint32_t media[NUM_SAVE_MEDIA];
+  uint32_t reserved;
+};
+
+struct SaveArchiveBlob {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t refs;
+};
+
+struct SaveArchive {
+  struct FileMap map;
+  struct PIFMutex lock;
+
+  struct SaveArchiveHeader *header;
+  struct SaveArchiveSlot *slots;
+  struct SaveArchiveBlob *blobs;
+  uint8_t *data;
+
+  /* Shared writes refused for want of space since the open. */
+  uint64_t writesRefused;
+};
+
+static uint32_t AllocSaveBlob(struct SaveArchive *, const uint8_t *, size_t);
+static void BindSaveArchiveMedia(struct PIFController *, unsigned);
+static int CreateSaveArchive(struct SaveArchive *, const char *,
+  unsigned, uint64_t, uint64_t);
+static struct SaveArchiveSlot *FindSaveArchiveSlot(
+  struct SaveArchive *, uint64_t, bool);
+static uint64_t HashSaveImage(const uint8_t *, size_t);
+static int MapSaveArchive(struct SaveArchive *, const char *);
+
+/* ============================================================================
+ *  SaveMediaSize: Returns the image size of a save medium.
+ * ========================================================================= */
+static inline size_t
+SaveMediaSize(unsigned media) {
+  return media == SAVE_MEDIA_EEPROM ? EEPROM_SIZE : MEMPAK_SIZE;
+}
+
+/* ============================================================================
+ *  AllocSaveBlob: Appends a new blob holding a copy of an image.
+ * ========================================================================= */
+static uint32_t
+AllocSaveBlob(struct SaveArchive *archive, const uint8_t *image, size_t size) {
+  struct SaveArchiveHeader *header = archive->header;
+  struct SaveArchiveBlob *blob;
+  uint32_t id;
+
+  if (header->blobsUsed >= header->blobCapacity ||
+    header->dataUsed + size > header->dataCapacity)
+    return 0;
+
+  id = header->blobsUsed;
+  blob = archive->blobs + id;
+  blob->offset = header->dataUsed;
+  blob->size = (uint32_t) size;
+  blob->refs = 1;
+
+  memcpy(archive->data + blob->offset, image, size);
+
+  /* Publish the blob only once its contents are in place. */
+  header->dataUsed += size;
+  header->blobsUsed++;
+  return id;
+}
+
+/* ============================================================================
+ *  AttachSaveArchive: Backs a controller's save media with an archive slot.
+ *
+ *  Any per-file EEPROM or pak mappings are closed; the slot for the ROM
+ *  key is looked up (or created, pointing at the shared blank images) and
+ *  the controller then reads and writes the archive mapping directly.
+ * ========================================================================= */
+int
+AttachSaveArchive(struct PIFController *controller,
+  struct SaveArchive *archive, uint64_t key) {
+  struct SaveArchiveSlot *slot;
+  unsigned i;
+
+  if (controller->flusher)
+    return -1;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->archive)
+    DetachSaveArchive(controller);
+
+  LockPIFMutex(&archive->lock);
+
+  if ((slot = FindSaveArchiveSlot(archive, key ? key : 1, true)) == NULL) {
+    UnlockPIFMutex(&archive->lock);
+
+    debug("SaveArchive: The archive index is full.");
+    return -1;
+  }
+
+  for (i = 0; i < NUM_SAVE_MEDIA; i++) {
+    if (slot->media[i] == 0) {
+      slot->media[i] = i == SAVE_MEDIA_EEPROM
+        ? SAVE_BLOB_BLANK_EEPROM : SAVE_BLOB_BLANK_PAK;
+
+      archive->blobs[slot->media[i]].refs++;
+    }
+  }
+
+  CloseFileMap(&controller->eepromFile);
+
+  for (i = 0; i < MEMPAK_NUM_CHANNELS; i++)
+    CloseMemPakFile(controller, i);
+
+  controller->archive = archive;
+  controller->archiveSlot = slot;
+  controller->archiveShared = 0;
+
+  for (i = 0; i < NUM_SAVE_MEDIA; i++)
+    BindSaveArchiveMedia(controller, i);
+
+  UnlockPIFMutex(&archive->lock);
+
+  memset(controller->eepromDirty, 0, sizeof(controller->eepromDirty));
+  controller->memo.valid = false;
+  return 0;
+}
+
+/* ============================================================================
+ *  BindSaveArchiveMedia: Points a controller at its slot's image.
+ * ========================================================================= */
+static void
+BindSaveArchiveMedia(struct PIFController *controller, unsigned media) {
+  struct SaveArchive *archive = controller->archive;
+  const struct SaveArchiveBlob *blob = archive->blobs +
+    controller->archiveSlot->media[media];
+  uint8_t *image = archive->data + blob->offset;
+
+  if (blob->refs > 1)
+    controller->archiveShared |= 1 << media;
+  else
+    controller->archiveShared &= ~(1 << media);
+
+  if (media == SAVE_MEDIA_EEPROM)
+    controller->eeprom = image;
+  else
+    controller->paks[media - SAVE_MEDIA_PAK(0)].data = image;
+}
+
+/* ============================================================================
+ *  CloseSaveArchive: Unmaps an archive. Controllers must be detached.
+ * ========================================================================= */
+void
+CloseSaveArchive(struct SaveArchive *archive) {
+  SyncFileMap(&archive->map, 0, archive->map.size);
+  CloseFileMap(&archive->map);
+
+  DestroyPIFMutex(&archive->lock);
+  free(archive);
+}
+
+/* ============================================================================
+ *  CompactSaveArchive: Rewrites an archive, dropping dead images.
+ *
+ *  Every image still referenced by a slot is copied to a fresh archive
+ *  at dst, and identical images are merged into a single blob as they
+ *  are copied. The new archive has room for the given number of slots
+ *  (or the source's capacity, if zero).
+ * ========================================================================= */
+int
+CompactSaveArchive(const char *src, const char *dst, unsigned slots) {
+  struct SaveArchive source, archive, *target = &archive;
+  uint64_t *hashes, blobs = 0, dataBytes = 0;
+  uint32_t *table, tableMask, i;
+  int status = -1;
+
+  if (MapSaveArchive(&source, src))
+    return -1;
+
+  if (slots == 0)
+    slots = source.header->slotCapacity / 2;
+  if (slots < source.header->slotsUsed)
+    slots = source.header->slotsUsed;
+
+  /* Leave room for at least every live image, and the usual headroom. */
+  for (i = SAVE_BLOB_FIRST_FREE; i < source.header->blobsUsed; i++) {
+    if (source.blobs[i].refs) {
+      dataBytes += source.blobs[i].size;
+      blobs++;
+    }
+  }
+
+  if (blobs < 2 * (uint64_t) slots)
+    blobs = 2 * (uint64_t) slots;
+  if (dataBytes < (uint64_t) slots * (EEPROM_SIZE + MEMPAK_SIZE))
+    dataBytes = (uint64_t) slots * (EEPROM_SIZE + MEMPAK_SIZE);
+
+  remove(dst);
+
+  if (CreateSaveArchive(target, dst, slots, blobs, dataBytes)) {
+    CloseFileMap(&source.map);
+    return -1;
+  }
+
+  /* Maps image hashes to target blobs, for merging identical images. */
+  for (tableMask = 1; tableMask < target->header->blobCapacity * 2; )
+    tableMask <<= 1;
+
+  table = (uint32_t *) calloc(tableMask--, sizeof(*table));
+  hashes = (uint64_t *) calloc(target->header->blobCapacity, sizeof(*hashes));
+
+  if (table == NULL || hashes == NULL)
+    goto out;
+
+  for (i = 1; i < SAVE_BLOB_FIRST_FREE; i++) {
+    const struct SaveArchiveBlob *blob = target->blobs + i;
+    uint32_t bucket;
+
+    hashes[i] = HashSaveImage(target->data + blob->offset, blob->size);
+
+    for (bucket = hashes[i] & tableMask; table[bucket];)
+      bucket = (bucket + 1) & tableMask;
+
+    table[bucket] = i;
+  }
+
+  for (i = 0; i < source.header->slotCapacity; i++) {
+    const struct SaveArchiveSlot *from = source.slots + i;
+    struct SaveArchiveSlot *to;
+    unsigned media;
+
+    if (from->key == 0)
+      continue;
+
+    if ((to = FindSaveArchiveSlot(target, from->key, true)) == NULL)
+      goto out;
+
+    for (media = 0; media < NUM_SAVE_MEDIA; media++) {
+      const struct SaveArchiveBlob *blob = source.blobs + from->media[media];
+      const uint8_t *image = source.data + blob->offset;
+      uint64_t hash;
+      uint32_t bucket, id;
+
+      if (from->media[media] == 0)
+        continue;
+
+      hash = HashSaveImage(image, blob->size);
+
+      for (bucket = hash & tableMask; (id = table[bucket]) != 0;
+        bucket = (bucket + 1) & tableMask) {
+        const struct SaveArchiveBlob *other = target->blobs + id;
+
+        if (hashes[id] == hash && other->size == blob->size &&
+          !memcmp(target->data + other->offset, image, blob->size))
+          break;
+      }
+
+      if (id)
+        target->blobs[id].refs++;
+
+      else {
+        if ((id = AllocSaveBlob(target, image, blob->size)) == 0)
+          goto out;
+
+        hashes[id] = hash;
+        table[bucket] = id;
+      }
+
+      to->media[media] = id;
+    }
+  }
+
+  status = 0;
+
+out:
+  free(hashes);
+  free(table);
+
+  SyncFileMap(&target->map, 0, target->map.size);
+  CloseFileMap(&target->map);
+  DestroyPIFMutex(&target->lock);
+  CloseFileMap(&source.map);
+
+  if (status)
+    remove(dst);
+
+  return status;
+}
+
+/* ============================================================================
+ *  CreateSaveArchive: Lays out and maps a new, empty archive.
+ * ========================================================================= */
+static int
+CreateSaveArchive(struct SaveArchive *archive, const char *path,
+  unsigned slots, uint64_t blobs, uint64_t dataBytes) {
+  struct SaveArchiveHeader header;
+  uint32_t slotCapacity;
+
+  for (slotCapacity = 16; slotCapacity < 2 * slots; slotCapacity <<= 1);
+
+  memset(archive, 0, sizeof(*archive));
+  memset(&header, 0, sizeof(header));
+
+  header.version = SAVE_ARCHIVE_VERSION;
+  header.slotCapacity = slotCapacity;
+  header.blobCapacity = (uint32_t) (SAVE_BLOB_FIRST_FREE + blobs);
+  header.slotOffset = sizeof(header);
+  header.blobOffset = header.slotOffset +
+    (uint64_t) slotCapacity * sizeof(struct SaveArchiveSlot);
+  header.dataOffset = (header.blobOffset + (uint64_t) header.blobCapacity *
+    sizeof(struct SaveArchiveBlob) + SAVE_ARCHIVE_PAGE_SIZE - 1) &
+    ~(uint64_t) (SAVE_ARCHIVE_PAGE_SIZE - 1);
+  header.dataCapacity = EEPROM_SIZE + MEMPAK_SIZE + dataBytes;
+
+  if (OpenFileMap(&archive->map, path, (size_t) (header.dataOffset +
+    header.dataCapacity), FILEMAP_SHARED)) {
+    debug("SaveArchive: Failed to create the archive.");
+    return -1;
+  }
+
+  archive->header = (struct SaveArchiveHeader *) archive->map.base;
+  memcpy(archive->header, &header, sizeof(header));
+
+  archive->slots = (struct SaveArchiveSlot *)
+    (archive->map.base + header.slotOffset);
+  archive->blobs = (struct SaveArchiveBlob *)
+    (archive->map.base + header.blobOffset);
+  archive->data = archive->map.base + header.dataOffset;
+
+  /* The blank images are owned by the archive itself. */
+  archive->blobs[SAVE_BLOB_BLANK_EEPROM].offset = 0;
+  archive->blobs[SAVE_BLOB_BLANK_EEPROM].size = EEPROM_SIZE;
+  archive->blobs[SAVE_BLOB_BLANK_EEPROM].refs = 1;
+  archive->blobs[SAVE_BLOB_BLANK_PAK].offset = EEPROM_SIZE;
+  archive->blobs[SAVE_BLOB_BLANK_PAK].size = MEMPAK_SIZE;
+  archive->blobs[SAVE_BLOB_BLANK_PAK].refs = 1;
+  archive->header->blobsUsed = SAVE_BLOB_FIRST_FREE;
+  archive->header->dataUsed = EEPROM_SIZE + MEMPAK_SIZE;
+
+  /* Writing the magic last marks the archive as valid. */
+  memcpy(archive->header->magic, SAVE_ARCHIVE_MAGIC,
+    sizeof(archive->header->magic));
+
+  InitPIFMutex(&archive->lock);
+  return 0;
+}
+
+/* ============================================================================
+ *  DetachSaveArchive: Moves a controller's media back off of its archive.
+ *
+ *  The EEPROM contents are carried over into the controller's private
+ *  copy; paks are left without backing storage.
+ * ========================================================================= */
+void
+DetachSaveArchive(struct PIFController *controller) {
+  unsigned i;
+
+  if (!controller->archive)
+    return;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  if (controller->eeprom != controller->eepromData)
+    memcpy(controller->eepromData, controller->eeprom, EEPROM_SIZE);
+
+  controller->eeprom = controller->eepromData;
+
+  for (i = 0; i < MEMPAK_NUM_CHANNELS; i++)
+    controller->paks[i].data = NULL;
+
+  controller->archive = NULL;
+  controller->archiveSlot = NULL;
+  controller->archiveShared = 0;
+  controller->memo.valid = false;
+}
+
+/* ============================================================================
+ *  FindSaveArchiveSlot: Looks up (and optionally inserts) a slot by key.
+ * ========================================================================= */
+static struct SaveArchiveSlot *
+FindSaveArchiveSlot(struct SaveArchive *archive, uint64_t key, bool insert) {
+  struct SaveArchiveHeader *header = archive->header;
+  uint32_t mask = header->slotCapacity - 1;
+  uint32_t i = (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  uint32_t probes;
+
+  for (probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+    struct SaveArchiveSlot *slot = archive->slots + i;
+
+    if (slot->key == key)
+      return slot;
+
+    if (slot->key == 0) {
+      /* Always leave a hole, so that probes terminate. */
+      if (!insert || header->slotsUsed + 1 >= header->slotCapacity)
+        return NULL;
+
+      slot->key = key;
+      header->slotsUsed++;
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+/* ============================================================================
+ *  GetSaveArchiveStats: Reports on the archive's index and data usage.
+ * ========================================================================= */
+void
+GetSaveArchiveStats(struct SaveArchive *archive,
+  struct SaveArchiveStats *stats) {
+  const struct SaveArchiveHeader *header = archive->header;
+  uint32_t i;
+
+  LockPIFMutex(&archive->lock);
+  memset(stats, 0, sizeof(*stats));
+
+  stats->slotsUsed = header->slotsUsed;
+  stats->slotCapacity = header->slotCapacity;
+  stats->blobsUsed = header->blobsUsed;
+  stats->blobCapacity = header->blobCapacity;
+  stats->dataUsed = header->dataUsed;
+  stats->dataCapacity = header->dataCapacity;
+  stats->writesRefused = archive->writesRefused;
+
+  for (i = 1; i < header->blobsUsed; i++) {
+    if (archive->blobs[i].refs) {
+      stats->blobsLive++;
+      stats->dataLive += archive->blobs[i].size;
+    }
+  }
+
+  UnlockPIFMutex(&archive->lock);
+}
+
+/* ============================================================================
+ *  HashSaveImage: Hashes an image (whose size is a multiple of 8 bytes).
+ * ========================================================================= */
+static uint64_t
+HashSaveImage(const uint8_t *image, size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t i;
+
+  for (i = 0; i < size; i += 8) {
+    uint64_t word;
+
+    memcpy(&word, image + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ULL;
+    hash ^= hash >> 29;
+  }
+
+  return hash;
+}
+
+/* ============================================================================
+ *  MapSaveArchive: Maps and validates an existing archive.
+ *
+ *  Returns -1 if the file is missing or empty, and -2 if it exists but
+ *  does not hold a valid archive.
+ * ========================================================================= */
+static int
+MapSaveArchive(struct SaveArchive *archive, const char *path) {
+  const struct SaveArchiveHeader *header;
+  size_t size;
+
+  memset(archive, 0, sizeof(*archive));
+
+  if (OpenFileMap(&archive->map, path, 0, FILEMAP_SHARED))
+    return -1;
+
+  size = archive->map.size;
+  header = (const struct SaveArchiveHeader *) archive->map.base;
+
+  if (size < sizeof(*header) ||
+    memcmp(header->magic, SAVE_ARCHIVE_MAGIC, sizeof(header->magic)) ||
+    header->version != SAVE_ARCHIVE_VERSION ||
+    header->slotCapacity == 0 ||
+    (header->slotCapacity & (header->slotCapacity - 1)) ||
+    header->slotOffset + (uint64_t) header->slotCapacity *
+      sizeof(struct SaveArchiveSlot) > header->blobOffset ||
+    header->blobOffset + (uint64_t) header->blobCapacity *
+      sizeof(struct SaveArchiveBlob) > header->dataOffset ||
+    header->dataOffset + header->dataCapacity > size ||
+    header->dataUsed > header->dataCapacity ||
+    header->blobsUsed > header->blobCapacity) {
+    debug("SaveArchive: Not a valid save archive.");
+
+    CloseFileMap(&archive->map);
+    return -2;
+  }
+
+  archive->header = (struct SaveArchiveHeader *) archive->map.base;
+  archive->slots = (struct SaveArchiveSlot *)
+    (archive->map.base + header->slotOffset);
+  archive->blobs = (struct SaveArchiveBlob *)
+    (archive->map.base + header->blobOffset);
+  archive->data = archive->map.base + header->dataOffset;
+  return 0;
+}
+
+/* ============================================================================
+ *  OpenSaveArchive: Opens an archive, creating it if it does not exist.
+ *
+ *  New archives are sized for the given number of games: the index gets
+ *  twice as many slots, and the (sparse) data region room for an EEPROM
+ *  and one written pak per game.
+ * ========================================================================= */
+struct SaveArchive *
+OpenSaveArchive(const char *path, unsigned slots) {
+  struct SaveArchive *archive;
+  int status;
+
+  if ((archive = (struct SaveArchive *) malloc(sizeof(*archive))) == NULL)
+    return NULL;
+
+  if ((status = MapSaveArchive(archive, path)) == 0) {
+    InitPIFMutex(&archive->lock);
+    return archive;
+  }
+
+  if (slots == 0)
+    slots = 1;
+
+  /* Never clobber a file that is not (or no longer) an archive. */
+  if (status == -2 || CreateSaveArchive(archive, path, slots,
+    2 * (uint64_t) slots, (uint64_t) slots * (EEPROM_SIZE + MEMPAK_SIZE))) {
+    free(archive);
+    return NULL;
+  }
+
+  return archive;
+}
+
+/* ============================================================================
+ *  SaveArchiveKey: Derives a ROM identity key (e.g., from the ROM header).
+ * ========================================================================= */
+uint64_t
+SaveArchiveKey(const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *) data;
+  uint64_t key = 0xCBF29CE484222325ULL;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    key = (key ^ bytes[i]) * 0x100000001B3ULL;
+
+  /* Zero marks an empty slot. */
+  return key ? key : 1;
+}
+
+/* ============================================================================
+ *  SyncSaveArchive: Writes a range of the archive back to disk.
+ * ========================================================================= */
+int
+SyncSaveArchive(struct SaveArchive *archive, const uint8_t *data,
+  size_t length) {
+  return SyncFileMap(&archive->map, data - archive->map.base, length);
+}
+
+/* ============================================================================
+ *  UnshareSaveArchiveMedia: Gives a controller a private copy of an image.
+ *
+ *  Called before the first write to an image that is shared with other
+ *  games. Should the archive be full, returns -1 and the image stays
+ *  shared (and read-only); the write must then fail, so the game sees
+ *  the error instead of a save that is never stored. Refused writes
+ *  are counted in the archive's stats.
+ * ========================================================================= */
+int
+UnshareSaveArchiveMedia(struct PIFController *controller, unsigned media) {
+  struct SaveArchive *archive = controller->archive;
+  struct SaveArchiveSlot *slot = controller->archiveSlot;
+  struct SaveArchiveBlob *blob;
+  uint32_t id;
+
+  LockPIFMutex(&archive->lock);
+  blob = archive->blobs + slot->media[media];
+
+  if (blob->refs > 1) {
+    if ((id = AllocSaveBlob(archive, archive->data + blob->offset,
+      SaveMediaSize(media))) == 0) {
+      debug("SaveArchive: The archive is full; refusing a shared write.");
+      archive->writesRefused++;
+      UnlockPIFMutex(&archive->lock);
+      return -1;
+    }
+
+    blob->refs--;
+    slot->media[media] = id;
+  }
+
+  BindSaveArchiveMedia(controller, media);
+  UnlockPIFMutex(&archive->lock);
+  return 0;
+}
+
@@ -0,0 +1,53 @@
+/* ============================================================================
+ *  SaveArchive.h: Indexed, single-file archive of per-game saves.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__SAVEARCHIVE_H__
+#define __PIF__SAVEARCHIVE_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+/* Save media held per game: the EEPROM, then one pak per channel. */
+#define SAVE_MEDIA_EEPROM         0
+#define SAVE_MEDIA_PAK(channel)   (1 + (channel))
+#define NUM_SAVE_MEDIA            5
+
+struct PIFController;
+struct SaveArchive;
+
+struct SaveArchiveStats {
+  uint32_t slotsUsed;
+  uint32_t slotCapacity;
+  uint32_t blobsUsed;
+  uint32_t blobsLive;
+  uint32_t blobCapacity;
+  uint64_t dataUsed;
+  uint64_t dataLive;
+  uint64_t dataCapacity;
+  uint64_t writesRefused;
+};
+
+struct SaveArchive *OpenSaveArchive(const char *, unsigned);
+void CloseSaveArchive(struct SaveArchive *);
+int CompactSaveArchive(const char *, const char *, unsigned);
+void GetSaveArchiveStats(struct SaveArchive *, struct SaveArchiveStats *);
+uint64_t SaveArchiveKey(const void *, size_t);
+
+int AttachSaveArchive(struct PIFController *, struct SaveArchive *, uint64_t);
+void DetachSaveArchive(struct PIFController *);
+int SyncSaveArchive(struct SaveArchive *, const uint8_t *, size_t);
+int UnshareSaveArchiveMedia(struct PIFController *, unsigned);
+
+#endif
+
@@ -0,0 +1,509 @@
+/* ============================================================================
+ *  SaveFlusher.c: Background writeback of save media.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "Controller.h"
+#include "FileMap.h"
+#include "MemPak.h"
+#include "PIFWorker.h"
+#include "SaveFlusher.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  A save image is a staging copy of one save medium (EEPROM or a pak).
+ *
+ *  The emulation thread copies each write into the staging buffer under
+ *  the lock; the flusher thread snapshots the staging buffer under the
+ *  lock and then writes the snapshot out without holding it.
+ * ========================================================================= */
+struct SaveImage {
+  struct SaveImage *next;
+  struct SaveFlusher *flusher;
+  const struct PIFController *owner;
+
+  char *path;
+  size_t size;
+  uint64_t dirtySince;
+  uint64_t retryAt;
+  unsigned retries;
+  bool dirty, writing, failed;
+
+  uint8_t *staging;
+  uint8_t *snapshot;
+};
+
+struct SaveFlusher {
+  struct PIFMutex lock;
+  struct PIFCond wake;
+  struct PIFCond idle;
+  struct PIFThread thread;
+
+  struct SaveImage *images;
+  struct SaveFlusherStats stats;
+  uint64_t window;
+  bool stopping, urgent;
+};
+
+static struct SaveImage *AddSaveImage(struct SaveFlusher *,
+  const struct PIFController *, const char *, const uint8_t *, size_t);
+static int RemapSaveFile(struct FileMap *, size_t, enum FileMapMode);
+static int RestoreSaveFile(struct FileMap *, size_t,
+  const struct SaveImage *);
+static void *SaveFlusherThread(void *);
+
+/* ============================================================================
+ *  AddSaveImage: Registers a save medium with the flusher.
+ * ========================================================================= */
+static struct SaveImage *
+AddSaveImage(struct SaveFlusher *flusher, const struct PIFController *owner,
+  const char *path, const uint8_t *contents, size_t size) {
+  size_t pathLength = strlen(path) + 1;
+  struct SaveImage *image;
+
+  if ((image = (struct SaveImage *) calloc(1,
+    sizeof(*image) + 2 * size + pathLength)) == NULL)
+    return NULL;
+
+  image->flusher = flusher;
+  image->owner = owner;
+  image->size = size;
+  image->staging = (uint8_t *) (image + 1);
+  image->snapshot = image->staging + size;
+  image->path = (char *) (image->snapshot + size);
+
+  memcpy(image->path, path, pathLength);
+  memcpy(image->staging, contents, size);
+
+  LockPIFMutex(&flusher->lock);
+  image->next = flusher->images;
+  flusher->images = image;
+  UnlockPIFMutex(&flusher->lock);
+
+  return image;
+}
+
+/* ============================================================================
+ *  AttachSaveFlusher: Hands a controller's mapped save media to a flusher.
+ *
+ *  While attached, the media are mapped copy-on-write and the flusher is
+ *  the only writer of the backing files, so every file on disk is always
+ *  a complete snapshot (on Windows, where mapped files are written in
+ *  place, barring a crash mid-write). Backing files should be set before
+ *  attaching.
+ *  Fails for a controller whose saves live in an archive, which already
+ *  keeps them on disk.
+ * ========================================================================= */
+int
+AttachSaveFlusher(struct PIFController *controller,
+  struct SaveFlusher *flusher) {
+  struct FileMap *map;
+  unsigned i;
+
+  if (controller->archive) {
+    debug("SaveFlusher: Saves are kept in an archive.");
+    return -1;
+  }
+
+  if (controller->flusher && DetachSaveFlusher(controller))
+    return -1;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  controller->flusher = flusher;
+  map = &controller->eepromFile;
+
+  if (map->base) {
+    if (RemapSaveFile(map, EEPROM_SIZE, FILEMAP_PRIVATE))
+      goto fail;
+
+    controller->eeprom = map->base;
+    if ((controller->eepromImage = AddSaveImage(flusher,
+      controller, map->path, map->base, EEPROM_SIZE)) == NULL)
+      goto fail;
+  }
+
+  for (i = 0; i < MEMPAK_NUM_CHANNELS; i++) {
+    map = &controller->paks[i].map;
+
+    if (map->base) {
+      if (RemapSaveFile(map, MEMPAK_SIZE, FILEMAP_PRIVATE))
+        goto fail;
+
+      controller->paks[i].data = map->base;
+
+      if ((controller->paks[i].image = AddSaveImage(flusher,
+        controller, map->path, map->base, MEMPAK_SIZE)) == NULL)
+        goto fail;
+    }
+  }
+
+  return 0;
+
+fail:
+  debug("SaveFlusher: Failed to attach save media.");
+
+  DetachSaveFlusher(controller);
+  return -1;
+}
+
+/* ============================================================================
+ *  CreateSaveFlusher: Starts a flusher that coalesces writes for window ms.
+ * ========================================================================= */
+struct SaveFlusher *
+CreateSaveFlusher(unsigned window) {
+  struct SaveFlusher *flusher;
+
+  if ((flusher = (struct SaveFlusher *) calloc(1, sizeof(*flusher))) == NULL)
+    return NULL;
+
+  flusher->window = (uint64_t) window * 1000000;
+  InitPIFMutex(&flusher->lock);
+  InitPIFCond(&flusher->wake);
+  InitPIFCond(&flusher->idle);
+
+  if (StartPIFThread(&flusher->thread, SaveFlusherThread, flusher)) {
+    debug("SaveFlusher: Failed to start the flusher thread.");
+
+    DestroyPIFCond(&flusher->idle);
+    DestroyPIFCond(&flusher->wake);
+    DestroyPIFMutex(&flusher->lock);
+    free(flusher);
+    return NULL;
+  }
+
+  return flusher;
+}
+
+/* ============================================================================
+ *  DestroySaveFlusher: Writes out anything pending and stops the flusher.
+ *
+ *  Controllers should be detached first; any images left behind are
+ *  written out and released here.
+ * ========================================================================= */
+void
+DestroySaveFlusher(struct SaveFlusher *flusher) {
+  struct SaveImage *image, *next;
+
+  LockPIFMutex(&flusher->lock);
+  flusher->stopping = true;
+  SignalPIFCond(&flusher->wake);
+  UnlockPIFMutex(&flusher->lock);
+
+  JoinPIFThread(&flusher->thread);
+
+  for (image = flusher->images; image; image = next) {
+    next = image->next;
+    free(image);
+  }
+
+  DestroyPIFCond(&flusher->idle);
+  DestroyPIFCond(&flusher->wake);
+  DestroyPIFMutex(&flusher->lock);
+  free(flusher);
+}
+
+/* ============================================================================
+ *  DetachSaveFlusher: Writes out a controller's media and detaches them.
+ *
+ *  Blocks until the controller's images are on disk, then maps the media
+ *  shared again so that the controller can carry on without a flusher.
+ *  Images the flusher gave up on are written back here, one last time;
+ *  returns -1 if any medium could not be saved or mapped again.
+ * ========================================================================= */
+int
+DetachSaveFlusher(struct PIFController *controller) {
+  struct SaveFlusher *flusher = controller->flusher;
+  struct SaveImage **link, *image;
+  struct FileMap *map;
+  int status = 0;
+  bool busy;
+  unsigned i;
+
+  if (!flusher)
+    return 0;
+
+  if (unlikely(controller->worker != NULL))
+    SyncPIFWorker(controller->worker);
+
+  LockPIFMutex(&flusher->lock);
+  flusher->urgent = true;
+  SignalPIFCond(&flusher->wake);
+
+  do {
+    busy = false;
+
+    for (image = flusher->images; image; image = image->next) {
+      if (image->owner == controller && (image->dirty || image->writing))
+        busy = true;
+    }
+
+    if (busy)
+      WaitPIFCond(&flusher->idle, &flusher->lock);
+  } while (busy);
+
+  /* Unlinked, the images are ours; they are freed once written back. */
+  for (link = &flusher->images; (image = *link) != NULL; ) {
+    if (image->owner == controller)
+      *link = image->next;
+    else
+      link = &image->next;
+  }
+
+  UnlockPIFMutex(&flusher->lock);
+
+  controller->flusher = NULL;
+  map = &controller->eepromFile;
+
+  if (map->base && RestoreSaveFile(map, EEPROM_SIZE,
+    controller->eepromImage))
+    status = -1;
+
+  controller->eeprom = map->base ? map->base : controller->eepromData;
+  free(controller->eepromImage);
+  controller->eepromImage = NULL;
+
+  for (i = 0; i < MEMPAK_NUM_CHANNELS; i++) {
+    map = &controller->paks[i].map;
+
+    if (map->base && RestoreSaveFile(map, MEMPAK_SIZE,
+      controller->paks[i].image))
+      status = -1;
+
+    controller->paks[i].data = map->base;
+    free(controller->paks[i].image);
+    controller->paks[i].image = NULL;
+  }
+
+  return status;
+}
+
+/* ============================================================================
+ *  GetSaveFlusherStats: Copies out the flusher's counters.
+ * ========================================================================= */
+void
+GetSaveFlusherStats(struct SaveFlusher *flusher,
+  struct SaveFlusherStats *stats) {
+  LockPIFMutex(&flusher->lock);
+  memcpy(stats, &flusher->stats, sizeof(*stats));
+  UnlockPIFMutex(&flusher->lock);
+}
+
+/* ============================================================================
+ *  KickSaveFlusher: Asks the flusher to write out everything now.
+ * ========================================================================= */
+void
+KickSaveFlusher(struct SaveFlusher *flusher) {
+  LockPIFMutex(&flusher->lock);
+  flusher->urgent = true;
+  SignalPIFCond(&flusher->wake);
+  UnlockPIFMutex(&flusher->lock);
+}
+
+/* ============================================================================
+ *  RemapSaveFile: Maps a save file again in a different mode.
+ * ========================================================================= */
+static int
+RemapSaveFile(struct FileMap *map, size_t size, enum FileMapMode mode) {
+  char *path = map->path;
+  int status;
+
+  if (path == NULL)
+    return -1;
+
+  map->path = NULL;
+  CloseFileMap(map);
+
+  status = OpenFileMap(map, path, size, mode);
+  free(path);
+  return status;
+}
+
+/* ============================================================================
+ *  RestoreSaveFile: Maps a save file shared again once it is detached.
+ *
+ *  The copy-on-write mapping goes away with the remap, so an image the
+ *  flusher failed to write is copied into the new mapping and synced.
+ * ========================================================================= */
+static int
+RestoreSaveFile(struct FileMap *map, size_t size,
+  const struct SaveImage *image) {
+  bool failed = image && image->failed;
+
+  if (RemapSaveFile(map, size, FILEMAP_SHARED)) {
+    debug("SaveFlusher: Failed to map a save file again.");
+
+    if (failed)
+      WriteFileAtomic(image->path, image->staging, size);
+
+    return -1;
+  }
+
+  if (failed) {
+    memcpy(map->base, image->staging, size);
+
+    if (SyncFileMap(map, 0, size)) {
+      debugarg("SaveFlusher: Failed to write back %s.", image->path);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* ============================================================================
+ *  SaveFlusherThread: Writes out images once their window has elapsed.
+ * ========================================================================= */
+static void *
+SaveFlusherThread(void *opaque) {
+  struct SaveFlusher *flusher = (struct SaveFlusher *) opaque;
+
+  LockPIFMutex(&flusher->lock);
+
+  for (;;) {
+    uint64_t now = PIFMonotonicTime(), deadline = (uint64_t) -1;
+    struct SaveImage *image, *due = NULL;
+    bool pending = false;
+
+    for (image = flusher->images; image; image = image->next) {
+      if (!image->dirty)
+        continue;
+
+      pending = true;
+
+      /* A failed write waits out its delay, even when urgent. */
+      if (image->retryAt > now) {
+        if (image->retryAt < deadline)
+          deadline = image->retryAt;
+
+        continue;
+      }
+
+      if (flusher->urgent || flusher->stopping ||
+        now - image->dirtySince >= flusher->window) {
+        due = image;
+        break;
+      }
+
+      if (image->dirtySince + flusher->window < deadline)
+        deadline = image->dirtySince + flusher->window;
+    }
+
+    if (due) {
+      uint64_t start, latency;
+      int status;
+
+      memcpy(due->snapshot, due->staging, due->size);
+      due->dirty = false;
+      due->writing = true;
+      UnlockPIFMutex(&flusher->lock);
+
+      start = PIFMonotonicTime();
+#ifdef _WIN32
+      /* The media's views keep the file from being renamed over. */
+      status = WriteFileInPlace(due->path, due->snapshot, due->size);
+#else
+      status = WriteFileAtomic(due->path, due->snapshot, due->size);
+#endif
+      latency = PIFMonotonicTime() - start;
+
+      LockPIFMutex(&flusher->lock);
+      due->writing = false;
+
+      if (status == 0) {
+        due->retries = 0;
+        due->retryAt = 0;
+        due->failed = false;
+
+        flusher->stats.flushes++;
+        flusher->stats.bytesWritten += due->size;
+        flusher->stats.lastLatency = latency;
+        flusher->stats.totalLatency += latency;
+
+        if (latency > flusher->stats.maxLatency)
+          flusher->stats.maxLatency = latency;
+      }
+
+      /* Keep the image dirty, so the write is tried again. */
+      else {
+        flusher->stats.failures++;
+
+        if (++due->retries < SAVE_FLUSHER_MAX_RETRIES) {
+          if (!due->dirty) {
+            due->dirty = true;
+            due->dirtySince = PIFMonotonicTime();
+          }
+
+          due->retryAt = PIFMonotonicTime() + SAVE_FLUSHER_RETRY_DELAY;
+        }
+
+        else {
+          debugarg("SaveFlusher: Giving up on writing %s.", due->path);
+
+          /* Detaching writes it back; until then, keep the data. */
+          due->failed = true;
+          due->retries = 0;
+          due->retryAt = 0;
+        }
+      }
+
+      BroadcastPIFCond(&flusher->idle);
+      continue;
+    }
+
+    flusher->urgent = false;
+    BroadcastPIFCond(&flusher->idle);
+
+    if (flusher->stopping && !pending)
+      break;
+
+    if (pending)
+      TimedWaitPIFCond(&flusher->wake, &flusher->lock, deadline);
+    else
+      WaitPIFCond(&flusher->wake, &flusher->lock);
+  }
+
+  UnlockPIFMutex(&flusher->lock);
+  return NULL;
+}
+
+/* ============================================================================
+ *  UpdateSaveImage: Mirrors a write to a save medium into its image.
+ *
+ *  Called from the emulation thread; only copies the written bytes and
+ *  never waits on I/O.
+ * ========================================================================= */
+void
+UpdateSaveImage(struct SaveImage *image, size_t offset,
+  const uint8_t *data, size_t length) {
+  struct SaveFlusher *flusher = image->flusher;
+
+  LockPIFMutex(&flusher->lock);
+  memcpy(image->staging + offset, data, length);
+  flusher->stats.updates++;
+  image->retries = 0;
+
+  if (!image->dirty) {
+    image->dirty = true;
+    image->dirtySince = PIFMonotonicTime();
+    SignalPIFCond(&flusher->wake);
+  }
+
+  UnlockPIFMutex(&flusher->lock);
+}
+
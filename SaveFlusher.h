@@ -0,0 +1,56 @@
+/* ============================================================================
+ *  SaveFlusher.h: Background writeback of save media.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__SAVEFLUSHER_H__
+#define __PIF__SAVEFLUSHER_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+/* ============================================================================
+ *  A failed write leaves the image dirty and is tried again after the
+ *  delay (ns), up to the limit; a later write to the image starts the
+ *  count over. Images given up on are written back when detached.
+ * ========================================================================= */
+#define SAVE_FLUSHER_MAX_RETRIES  5
+#define SAVE_FLUSHER_RETRY_DELAY  500000000ULL
+
+struct PIFController;
+struct SaveFlusher;
+struct SaveImage;
+
+struct SaveFlusherStats {
+  uint64_t updates;
+  uint64_t flushes;
+  uint64_t failures;
+  uint64_t bytesWritten;
+
+  /* Time spent writing, syncing and renaming one image (ns). */
+  uint64_t lastLatency;
+  uint64_t maxLatency;
+  uint64_t totalLatency;
+};
+
+struct SaveFlusher *CreateSaveFlusher(unsigned);
+void DestroySaveFlusher(struct SaveFlusher *);
+void GetSaveFlusherStats(struct SaveFlusher *, struct SaveFlusherStats *);
+void KickSaveFlusher(struct SaveFlusher *);
+
+int AttachSaveFlusher(struct PIFController *, struct SaveFlusher *);
+int DetachSaveFlusher(struct PIFController *);
+
+void UpdateSaveImage(struct SaveImage *, size_t, const uint8_t *, size_t);
+
+#endif
+
@@ -0,0 +1,265 @@
+/* ============================================================================
+ *  Thread.c: Threading and timing primitives.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "Common.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdlib>
+#else
+#include <stdlib.h>
+#endif
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <process.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+/* ============================================================================
+ *  PIFThreadTrampoline: Adapts a POSIX-style entry point for Win32.
+ * ========================================================================= */
+static unsigned __stdcall
+PIFThreadTrampoline(void *opaque) {
+  struct PIFThread *thread = (struct PIFThread *) opaque;
+
+  thread->entry(thread->opaque);
+  return 0;
+}
+#endif
+
+/* ============================================================================
+ *  StartPIFThread: Spawns a thread running entry(opaque).
+ * ========================================================================= */
+int
+StartPIFThread(struct PIFThread *thread, void *(*entry)(void *), void *opaque) {
+#ifdef _WIN32
+  thread->entry = entry;
+  thread->opaque = opaque;
+
+  thread->handle = (HANDLE) _beginthreadex(NULL, 0,
+    PIFThreadTrampoline, thread, 0, NULL);
+
+  return thread->handle ? 0 : -1;
+#else
+  return pthread_create(&thread->thread, NULL, entry, opaque) ? -1 : 0;
+#endif
+}
+
+/* ============================================================================
+ *  JoinPIFThread: Waits for a thread to exit.
+ * ========================================================================= */
+void
+JoinPIFThread(struct PIFThread *thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->thread, NULL);
+#endif
+}
+
+/* ============================================================================
+ *  Mutex wrappers.
+ * ========================================================================= */
+void
+InitPIFMutex(struct PIFMutex *mutex) {
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->cs);
+#else
+  pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+}
+
+void
+DestroyPIFMutex(struct PIFMutex *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->cs);
+#else
+  pthread_mutex_destroy(&mutex->mutex);
+#endif
+}
+
+void
+LockPIFMutex(struct PIFMutex *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->cs);
+#else
+  pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+void
+UnlockPIFMutex(struct PIFMutex *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->cs);
+#else
+  pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+/* ============================================================================
+ *  Condition variable wrappers.
+ * ========================================================================= */
+void
+InitPIFCond(struct PIFCond *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->cv);
+#else
+  pthread_condattr_t attr;
+
+  /* Timed waits are measured against the monotonic clock. */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond->cond, &attr);
+  pthread_condattr_destroy(&attr);
+#endif
+}
+
+void
+DestroyPIFCond(struct PIFCond *cond) {
+#ifndef _WIN32
+  pthread_cond_destroy(&cond->cond);
+#else
+  (void) cond;
+#endif
+}
+
+void
+BroadcastPIFCond(struct PIFCond *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->cv);
+#else
+  pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+void
+SignalPIFCond(struct PIFCond *cond) {
+#ifdef _WIN32
+  WakeConditionVariable(&cond->cv);
+#else
+  pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void
+WaitPIFCond(struct PIFCond *cond, struct PIFMutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+#else
+  pthread_cond_wait(&cond->cond, &mutex->mutex);
+#endif
+}
+
+/* ============================================================================
+ *  TimedWaitPIFCond: Waits until signalled or until a monotonic deadline.
+ * ========================================================================= */
+void
+TimedWaitPIFCond(struct PIFCond *cond, struct PIFMutex *mutex,
+  uint64_t deadline) {
+  uint64_t now = PIFMonotonicTime();
+
+  if (deadline <= now)
+    return;
+
+#ifdef _WIN32
+  SleepConditionVariableCS(&cond->cv, &mutex->cs,
+    (DWORD) ((deadline - now + 999999) / 1000000));
+#else
+  {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) (deadline / 1000000000);
+    ts.tv_nsec = (long) (deadline % 1000000000);
+    pthread_cond_timedwait(&cond->cond, &mutex->mutex, &ts);
+  }
+#endif
+}
+
+/* ============================================================================
+ *  AllocPIFAligned: Allocates memory that starts on a cache line.
+ *
+ *  The size is rounded up to whole lines, so no other allocation shares a
+ *  line with it, and threads writing their own never contend for one.
+ *  Free it with FreePIFAligned.
+ * ========================================================================= */
+void *
+AllocPIFAligned(size_t size) {
+  size_t mask = PIF_CACHE_LINE_SIZE - 1;
+
+  size = (size + mask) & ~mask;
+
+#ifdef _WIN32
+  return _aligned_malloc(size, PIF_CACHE_LINE_SIZE);
+#else
+  void *memory;
+
+  return posix_memalign(&memory, PIF_CACHE_LINE_SIZE, size) ? NULL : memory;
+#endif
+}
+
+/* ============================================================================
+ *  CountPIFProcessors: Returns the number of processors online (at least 1).
+ * ========================================================================= */
+unsigned
+CountPIFProcessors(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return count > 0 ? (unsigned) count : 1;
+#endif
+}
+
+/* ============================================================================
+ *  FreePIFAligned: Frees memory from AllocPIFAligned.
+ * ========================================================================= */
+void
+FreePIFAligned(void *memory) {
+#ifdef _WIN32
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
+}
+
+/* ============================================================================
+ *  PIFMonotonicTime: Returns a monotonic timestamp in nanoseconds.
+ * ========================================================================= */
+uint64_t
+PIFMonotonicTime(void) {
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+
+  return (uint64_t) ((double) count.QuadPart *
+    1000000000.0 / (double) frequency.QuadPart);
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
@@ -0,0 +1,183 @@
+/* ============================================================================
+ *  Thread.h: Threading and timing primitives.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__THREAD_H__
+#define __PIF__THREAD_H__
+#include "Common.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Allocations from AllocPIFAligned start and end on one of these. */
+#define PIF_CACHE_LINE_SIZE       64
+
+struct PIFThread {
+#ifdef _WIN32
+  HANDLE handle;
+  void *(*entry)(void *);
+  void *opaque;
+#else
+  pthread_t thread;
+#endif
+};
+
+struct PIFMutex {
+#ifdef _WIN32
+  CRITICAL_SECTION cs;
+#else
+  pthread_mutex_t mutex;
+#endif
+};
+
+struct PIFCond {
+#ifdef _WIN32
+  CONDITION_VARIABLE cv;
+#else
+  pthread_cond_t cond;
+#endif
+};
+
+/* ============================================================================
+ *  Atomic 32-bit and pointer operations with acquire/release ordering.
+ * ========================================================================= */
+#ifdef _MSC_VER
+static inline uint32_t
+AddPIFAtomic(volatile uint32_t *value, uint32_t delta) {
+  return (uint32_t) InterlockedExchangeAdd((volatile LONG *) value,
+    (LONG) delta) + delta;
+}
+
+static inline uint32_t
+ExchangePIFAtomic(volatile uint32_t *value, uint32_t result) {
+  return (uint32_t) InterlockedExchange((volatile LONG *) value,
+    (LONG) result);
+}
+
+static inline uint32_t
+LoadPIFAtomic(const volatile uint32_t *value) {
+  uint32_t result = *value;
+  _ReadWriteBarrier();
+  return result;
+}
+
+static inline void
+StorePIFAtomic(volatile uint32_t *value, uint32_t result) {
+  _ReadWriteBarrier();
+  *value = result;
+}
+
+static inline void *
+LoadPIFAtomicPointer(void *const volatile *value) {
+  void *result = *value;
+  _ReadWriteBarrier();
+  return result;
+}
+
+static inline void
+StorePIFAtomicPointer(void *volatile *value, void *result) {
+  _ReadWriteBarrier();
+  *value = result;
+}
+
+static inline void
+PIFAcquireFence(void) {
+  MemoryBarrier();
+}
+
+static inline void
+PIFReleaseFence(void) {
+  MemoryBarrier();
+}
+
+#else
+static inline uint32_t
+AddPIFAtomic(volatile uint32_t *value, uint32_t delta) {
+  return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t
+ExchangePIFAtomic(volatile uint32_t *value, uint32_t result) {
+  return __atomic_exchange_n(value, result, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t
+LoadPIFAtomic(const volatile uint32_t *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+StorePIFAtomic(volatile uint32_t *value, uint32_t result) {
+  __atomic_store_n(value, result, __ATOMIC_RELEASE);
+}
+
+static inline void *
+LoadPIFAtomicPointer(void *const volatile *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+StorePIFAtomicPointer(void *volatile *value, void *result) {
+  __atomic_store_n(value, result, __ATOMIC_RELEASE);
+}
+
+static inline void
+PIFAcquireFence(void) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void
+PIFReleaseFence(void) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+#endif
+
+/* ============================================================================
+ *  PIFCpuRelax: Hints to the CPU that the caller is spinning.
+ * ========================================================================= */
+static inline void
+PIFCpuRelax(void) {
+#if defined(_MSC_VER)
+  YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#endif
+}
+
+int StartPIFThread(struct PIFThread *, void *(*)(void *), void *);
+void JoinPIFThread(struct PIFThread *);
+
+void InitPIFMutex(struct PIFMutex *);
+void DestroyPIFMutex(struct PIFMutex *);
+void LockPIFMutex(struct PIFMutex *);
+void UnlockPIFMutex(struct PIFMutex *);
+
+void InitPIFCond(struct PIFCond *);
+void DestroyPIFCond(struct PIFCond *);
+void BroadcastPIFCond(struct PIFCond *);
+void SignalPIFCond(struct PIFCond *);
+void WaitPIFCond(struct PIFCond *, struct PIFMutex *);
+void TimedWaitPIFCond(struct PIFCond *, struct PIFMutex *, uint64_t);
+
+void *AllocPIFAligned(size_t);
+unsigned CountPIFProcessors(void);
+void FreePIFAligned(void *);
+uint64_t PIFMonotonicTime(void);
+
+#endif
+
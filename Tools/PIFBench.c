@@ -0,0 +1,591 @@
+/* ============================================================================
+ *  PIFBench.c: Benchmarks libpif on its own, against a stub bus.
+ *
+ *  Every result is printed as one line of "key=value" pairs, starting
+ *  with bench=<name>, so runs can be compared across versions.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Actions.h"
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "CRC.h"
+#include "Externs.h"
+#include "HeadlessInput.h"
+#include "Input.h"
+#include "InputMovie.h"
+#include "MemPak.h"
+#include "PIFROMCache.h"
+#include "PIFStats.h"
+#include "PIFWorker.h"
+#include "StubBus.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* Bus functions exported by the library. */
+int PIFRAMReadByte(void *, uint32_t, void *);
+int PIFRAMReadHWord(void *, uint32_t, void *);
+int PIFRAMReadWord(void *, uint32_t, void *);
+int PIFRAMWriteByte(void *, uint32_t, void *);
+int PIFRAMWriteHWord(void *, uint32_t, void *);
+int PIFRAMWriteWord(void *, uint32_t, void *);
+int PIFROMRead(void *, uint32_t, void *);
+int SIRegWrite(void *, uint32_t, void *);
+
+#define BENCH_CHECK_BLOCKS        15
+#define BENCH_DRAM_SIZE           0x10000
+#define BENCH_FORMAT_VERSION      1
+#define BENCH_MEMPAK_PATH         "PIFBench.mpk"
+#define BENCH_MOVIE_PATH          "PIFBench.movie"
+
+/* Keeps results the compiler would otherwise throw away. */
+static volatile uint32_t BenchSink;
+
+static void BenchPoll(struct PIFController *, const char *, unsigned,
+  unsigned long);
+static void ReportBench(const char *, unsigned long, uint64_t);
+static void RunTransaction(struct PIFController *);
+
+/* ============================================================================
+ *  BenchBlock: Times full joybus round trips (WR64B, then RD64B).
+ * ========================================================================= */
+static void
+BenchBlock(struct PIFController *controller, const char *name,
+  const uint8_t *block, unsigned long iterations) {
+  uint64_t start;
+  unsigned long i;
+
+  for (i = 0; i < iterations / 16 + 1; i++) {
+    memcpy(StubBus.dram, block, PIF_RAM_ADDRESS_LEN);
+    RunTransaction(controller);
+  }
+
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    memcpy(StubBus.dram, block, PIF_RAM_ADDRESS_LEN);
+    RunTransaction(controller);
+  }
+
+  ReportBench(name, iterations, start);
+}
+
+/* ============================================================================
+ *  BenchCRC: Times the pak data CRC over one 32-byte block.
+ * ========================================================================= */
+static void
+BenchCRC(unsigned long iterations) {
+  uint8_t data[MEMPAK_BLOCK_SIZE];
+  uint64_t start;
+  unsigned long i;
+  uint8_t crc = 0;
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i * 37 + 11;
+
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    data[0] = i;
+    crc ^= MemPakCRC(data, sizeof(data));
+  }
+
+  ReportBench("crc_mempak", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations / 8; i++) {
+    data[0] = i;
+    crc ^= MemPakCRCReference(data, sizeof(data));
+  }
+
+  ReportBench("crc_mempak_reference", iterations / 8, start);
+  BenchSink = crc;
+}
+
+/* ============================================================================
+ *  BenchCreate: Times creating instances that share a ROM already loaded.
+ *
+ *  The bench ROM was deleted once the first instance loaded it, so these
+ *  only succeed without touching the file.
+ * ========================================================================= */
+static void
+BenchCreate(const struct PIFController *first, unsigned long iterations) {
+  const char *path = first->romImage->map.path;
+  struct PIFController *controller;
+  uint64_t start;
+  unsigned long i;
+
+  iterations = iterations / 100 ? iterations / 100 : 1;
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    if ((controller = CreatePIF(path)) == NULL) {
+      fprintf(stderr, "Failed to share the bench ROM.\n");
+      return;
+    }
+
+    DestroyPIF(controller);
+  }
+
+  ReportBench("create_pif_shared", iterations, start);
+}
+
+/* ============================================================================
+ *  BenchDirect: Times word reads a host inlines through the descriptors.
+ *
+ *  RAM reads cover the special offsets too, so some take the callback.
+ * ========================================================================= */
+static void
+BenchDirect(struct PIFController *controller, unsigned long iterations) {
+  struct PIFMemoryDescriptor rom, ram;
+  uint32_t address, word, sum = 0;
+  uint64_t start;
+  unsigned long i;
+
+  GetPIFMemoryDescriptor(controller, PIF_MEMORY_ROM, &rom);
+  GetPIFMemoryDescriptor(controller, PIF_MEMORY_RAM, &ram);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    address = PIF_ROM_BASE_ADDRESS + (i * 4 & 0x3FC);
+
+    if (ReadPIFMemoryWord(&rom, address, &word))
+      PIFROMRead(controller, address, &word);
+
+    sum += word;
+  }
+
+  ReportBench("rom_read32_direct", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    address = PIF_RAM_BASE_ADDRESS + (i * 4 & 0x3C);
+
+    if (ReadPIFMemoryWord(&ram, address, &word))
+      PIFRAMReadWord(controller, address, &word);
+
+    sum += word;
+  }
+
+  ReportBench("ram_read32_direct", iterations, start);
+  BenchSink = sum;
+}
+
+/* ============================================================================
+ *  BenchMedia: Times EEPROM and pak reads and writes.
+ * ========================================================================= */
+static void
+BenchMedia(struct PIFController *controller, unsigned long iterations) {
+  uint8_t block[PIF_RAM_ADDRESS_LEN];
+  unsigned i;
+
+  /* EEPROM sits behind the four controller ports. */
+  memset(block, 0, sizeof(block));
+  block[4] = 0x02;
+  block[5] = 0x08;
+  block[6] = 0x04;
+  block[7] = 0x10;
+  block[16] = 0xFE;
+  block[0x3F] = 0x01;
+  BenchBlock(controller, "eeprom_read", block, iterations);
+
+  memset(block, 0, sizeof(block));
+  block[4] = 0x0A;
+  block[5] = 0x01;
+  block[6] = 0x05;
+  block[7] = 0x10;
+
+  for (i = 0; i < EEPROM_BLOCK_SIZE; i++)
+    block[8 + i] = i;
+
+  block[17] = 0xFE;
+  block[0x3F] = 0x01;
+  BenchBlock(controller, "eeprom_write", block, iterations);
+
+  if (SetMemPakFile(controller, 0, BENCH_MEMPAK_PATH))
+    return;
+
+  memset(block, 0, sizeof(block));
+  block[0] = 0x03;
+  block[1] = 0x21;
+  block[2] = 0x02;
+  block[3] = 0x01;
+  block[4] = 0x00;
+  block[5 + MEMPAK_BLOCK_SIZE + 1] = 0xFE;
+  block[0x3F] = 0x01;
+  BenchBlock(controller, "pak_read", block, iterations);
+
+  memset(block, 0, sizeof(block));
+  block[0] = 0x23;
+  block[1] = 0x01;
+  block[2] = 0x03;
+  block[3] = 0x01;
+  block[4] = 0x00;
+
+  for (i = 0; i < MEMPAK_BLOCK_SIZE; i++)
+    block[5 + i] = i;
+
+  block[5 + MEMPAK_BLOCK_SIZE + 1] = 0xFE;
+  block[0x3F] = 0x01;
+  BenchBlock(controller, "pak_write", block, iterations);
+
+  CloseMemPakFile(controller, 0);
+  remove(BENCH_MEMPAK_PATH);
+}
+
+/* ============================================================================
+ *  BenchMovie: Times live, recorded and replayed input for the same script.
+ *
+ *  The script presses and releases A and moves the stick about once a
+ *  second (every 60 polls).
+ * ========================================================================= */
+static void
+BenchMovie(struct PIFController *controller, struct HeadlessInput *input,
+  unsigned long iterations) {
+  struct InputMovie *movie;
+  unsigned long i;
+  FILE *file;
+
+  for (i = 0; i < iterations; i += 60) {
+    AddHeadlessInputEvent(input, 0, i, (i / 60) & 1 ? 0x8000 : 0x0000,
+      (int8_t) (i / 60 * 7), 0);
+  }
+
+  AttachHeadlessInput(controller, input, 0x1);
+  BenchPoll(controller, "poll_scripted", 0x1, iterations);
+
+  RewindHeadlessInput(input);
+
+  if ((movie = CreateInputMovie(controller, BENCH_MOVIE_PATH,
+    INPUT_MOVIE_RECORD)) == NULL)
+    return;
+
+  BenchPoll(controller, "poll_record", 0x1, iterations);
+  DestroyInputMovie(movie);
+  DisconnectChannel(controller, 0);
+
+  if ((file = fopen(BENCH_MOVIE_PATH, "rb")) != NULL) {
+    fseek(file, 0, SEEK_END);
+    printf("bench=movie_size polls=%lu bytes=%ld\n", iterations, ftell(file));
+    fclose(file);
+  }
+
+  if ((movie = CreateInputMovie(controller, BENCH_MOVIE_PATH,
+    INPUT_MOVIE_PLAYBACK)) != NULL) {
+    BenchPoll(controller, "poll_replay", 0x1, iterations);
+    DestroyInputMovie(movie);
+  }
+
+  remove(BENCH_MOVIE_PATH);
+}
+
+/* ============================================================================
+ *  BenchPipeline: Times 4-port polls with CPU work between the two DMAs.
+ *
+ *  Run once in place and once on a worker, which can only hide the work
+ *  of running the block when there is a spare core to run it on; on a
+ *  single processor no worker is created and the second run is skipped.
+ * ========================================================================= */
+static void
+BenchPipeline(struct PIFController *controller, unsigned long iterations) {
+  static const char *names[2] = {"poll_4port_overlap",
+    "poll_4port_overlap_pipelined"};
+  uint8_t block[PIF_RAM_ADDRESS_LEN];
+  uint32_t zero = 0, work = 0;
+  unsigned long i, j;
+  uint64_t start;
+  unsigned mode;
+
+  BuildPollBlock(block, 0xF);
+
+  for (mode = 0; mode < 2; mode++) {
+    if (mode && CreatePIFWorker(controller) == NULL)
+      break;
+
+    start = PIFMonotonicTime();
+
+    for (i = 0; i < iterations; i++) {
+      memcpy(StubBus.dram, block, PIF_RAM_ADDRESS_LEN);
+
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_DRAM_ADDR_REG, &zero);
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_PIF_ADDR_WR64B_REG, &zero);
+
+      for (j = 0; j < 64; j++)
+        work = work * 1664525 + 1013904223;
+
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_DRAM_ADDR_REG, &zero);
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_PIF_ADDR_RD64B_REG, &zero);
+    }
+
+    ReportBench(names[mode], iterations, start);
+
+    if (mode)
+      DestroyPIFWorker(controller->worker);
+  }
+
+  BenchSink = work;
+}
+
+/* ============================================================================
+ *  BenchPoll: Times controller polls of a set of ports.
+ * ========================================================================= */
+static void
+BenchPoll(struct PIFController *controller, const char *name,
+  unsigned channels, unsigned long iterations) {
+  uint8_t block[PIF_RAM_ADDRESS_LEN];
+
+  BuildPollBlock(block, channels);
+  BenchBlock(controller, name, block, iterations);
+}
+
+/* ============================================================================
+ *  BenchRAM: Times CPU reads and writes of PIF RAM, and PIF ROM reads.
+ * ========================================================================= */
+static void
+BenchRAM(struct PIFController *controller, unsigned long iterations) {
+  uint32_t word = 0, sum = 0;
+  uint16_t hword = 0;
+  uint8_t byte = 0;
+  uint64_t start;
+  unsigned long i;
+
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    PIFRAMReadByte(controller, PIF_RAM_BASE_ADDRESS + (i & 0x3B), &byte);
+    sum += byte;
+  }
+
+  ReportBench("ram_read8", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    PIFRAMReadHWord(controller, PIF_RAM_BASE_ADDRESS + (i & 0x3A), &hword);
+    sum += hword;
+  }
+
+  ReportBench("ram_read16", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    PIFRAMReadWord(controller, PIF_RAM_BASE_ADDRESS + (i & 0x38), &word);
+    sum += word;
+  }
+
+  ReportBench("ram_read32", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    byte = i;
+    PIFRAMWriteByte(controller, PIF_RAM_BASE_ADDRESS + (i & 0x3B), &byte);
+  }
+
+  ReportBench("ram_write8", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    hword = i;
+    PIFRAMWriteHWord(controller, PIF_RAM_BASE_ADDRESS + (i & 0x3A), &hword);
+  }
+
+  ReportBench("ram_write16", iterations, start);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    word = i;
+    PIFRAMWriteWord(controller, PIF_RAM_BASE_ADDRESS + (i & 0x38), &word);
+  }
+
+  ReportBench("ram_write32", iterations, start);
+  SetPIFWriteCombining(controller, true);
+  start = PIFMonotonicTime();
+
+  /* A run of 16 stores fills the RAM, then the SI is accessed. */
+  for (i = 0; i < iterations; i++) {
+    word = i;
+    PIFRAMWriteWord(controller, PIF_RAM_BASE_ADDRESS + (i * 4 & 0x3C), &word);
+
+    if ((i & 0xF) == 0xF)
+      FlushPIFRAMWrites(controller);
+  }
+
+  ReportBench("ram_write32_combined", iterations, start);
+  SetPIFWriteCombining(controller, false);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < iterations; i++) {
+    PIFROMRead(controller, PIF_ROM_BASE_ADDRESS + (i * 4 & 0x3FC), &word);
+    sum += word;
+  }
+
+  ReportBench("rom_read32", iterations, start);
+  BenchSink = sum;
+}
+
+/* ============================================================================
+ *  BenchStats: Times polls with stats enabled, then prints the stats.
+ *
+ *  Does nothing unless libpif was built with PIF_STATS (make STATS=1).
+ * ========================================================================= */
+static void
+BenchStats(struct PIFController *controller, unsigned long iterations) {
+  struct PIFStats stats;
+  unsigned i;
+
+  if (SetPIFStats(controller, true))
+    return;
+
+  BenchPoll(controller, "poll_1port_stats", 0x1, iterations);
+  GetPIFStats(controller, &stats);
+
+  for (i = 0; i < NUM_PIF_STATS_COUNTERS; i++) {
+    const struct PIFStatsHistogram *histogram = stats.counters + i;
+
+    if (histogram->count) {
+      printf("stats=%s count=%llu samples=%llu mean_ticks=%.1f "
+        "max_ticks=%llu\n", GetPIFStatsName((enum PIFStatsCounter) i),
+        (unsigned long long) histogram->count,
+        (unsigned long long) histogram->samples,
+        histogram->samples ? (double) histogram->totalTicks /
+        histogram->samples : 0.0, (unsigned long long) histogram->maxTicks);
+    }
+  }
+
+  SetPIFStats(controller, false);
+}
+
+/* ============================================================================
+ *  CheckCRC: Cross-checks the fast CRC paths against the reference.
+ *
+ *  Every third block is all zero, the rest random; an odd count makes
+ *  MemPakCRCBlocks run its unpaired tail. Returns -1 on any mismatch.
+ * ========================================================================= */
+static int
+CheckCRC(void) {
+  uint8_t blocks[BENCH_CHECK_BLOCKS][MEMPAK_BLOCK_SIZE];
+  uint8_t crcs[BENCH_CHECK_BLOCKS];
+  uint32_t seed = 0x2545F491;
+  unsigned i, j;
+  int status = 0;
+
+  for (i = 0; i < BENCH_CHECK_BLOCKS; i++) {
+    for (j = 0; j < MEMPAK_BLOCK_SIZE; j++) {
+      seed = seed * 1664525 + 1013904223;
+      blocks[i][j] = i % 3 ? seed >> 24 : 0;
+    }
+  }
+
+  MemPakCRCBlocks(blocks[0], BENCH_CHECK_BLOCKS, crcs);
+
+  for (i = 0; i < BENCH_CHECK_BLOCKS; i++) {
+    uint8_t reference = MemPakCRCReference(blocks[i], MEMPAK_BLOCK_SIZE);
+    uint8_t crc = MemPakCRC(blocks[i], MEMPAK_BLOCK_SIZE);
+
+    if (crc != reference || crcs[i] != reference ||
+      (i % 3 == 0 && reference != MEMPAK_ZERO_BLOCK_CRC)) {
+      fprintf(stderr, "CRC mismatch on block %u: crc=%02X blocks=%02X "
+        "reference=%02X\n", i, crc, crcs[i], reference);
+
+      status = -1;
+    }
+  }
+
+  return status;
+}
+
+/* ============================================================================
+ *  ReportBench: Prints the result of a benchmark started at start.
+ * ========================================================================= */
+static void
+ReportBench(const char *name, unsigned long iterations, uint64_t start) {
+  uint64_t elapsed = PIFMonotonicTime() - start;
+
+  printf("bench=%s iterations=%lu ns_per_op=%.2f\n", name, iterations,
+    iterations ? (double) elapsed / iterations : 0.0);
+}
+
+/* ============================================================================
+ *  RunTransaction: Writes the block at DRAM 0 to PIF RAM and reads it back.
+ * ========================================================================= */
+static void
+RunTransaction(struct PIFController *controller) {
+  uint32_t zero = 0;
+
+  SIRegWrite(controller, SI_REGS_BASE_ADDRESS + 4 * SI_DRAM_ADDR_REG, &zero);
+  SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+    4 * SI_PIF_ADDR_WR64B_REG, &zero);
+  SIRegWrite(controller, SI_REGS_BASE_ADDRESS + 4 * SI_DRAM_ADDR_REG, &zero);
+  SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+    4 * SI_PIF_ADDR_RD64B_REG, &zero);
+}
+
+/* ============================================================================
+ *  main: Runs each benchmark; the iteration count may be given.
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+  struct PIFController *controller;
+  struct HeadlessInput *input;
+
+  if (!iterations || InitStubBus(&StubBus, BENCH_DRAM_SIZE) ||
+    (controller = CreateStubPIF(NULL)) == NULL ||
+    (input = CreateHeadlessInput()) == NULL) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  /* Timing a wrong answer is worse than useless. */
+  if (CheckCRC()) {
+    DestroyPIF(controller);
+    DestroyHeadlessInput(input);
+    DestroyStubBus(&StubBus);
+    return 1;
+  }
+
+  printf("suite=libpif format=%u\n", BENCH_FORMAT_VERSION);
+
+  BenchRAM(controller, iterations);
+  BenchDirect(controller, iterations);
+  BenchCRC(iterations);
+  BenchCreate(controller, iterations);
+
+  AttachHeadlessInput(controller, input, 0x1);
+  BenchPoll(controller, "poll_1port", 0x1, iterations);
+  BenchStats(controller, iterations);
+
+  AttachHeadlessInput(controller, input, 0xF);
+  BenchPoll(controller, "poll_4port", 0xF, iterations);
+  BenchPipeline(controller, iterations);
+  BenchMedia(controller, iterations);
+
+  DisconnectChannel(controller, 1);
+  DisconnectChannel(controller, 2);
+  DisconnectChannel(controller, 3);
+  BenchMovie(controller, input, iterations);
+
+  DestroyPIF(controller);
+  DestroyHeadlessInput(input);
+  DestroyStubBus(&StubBus);
+  return 0;
+}
+
@@ -0,0 +1,186 @@
+/* ============================================================================
+ *  PIFBootCheck.c: Checks a high-level boot against a capture of a real one.
+ *
+ *  The capture is an SI log recorded while the host booted the cartridge
+ *  through the PIF ROM. Up to the first write of any kind, the IPL only
+ *  polls PIF RAM for the CIC seed and the status; the last value it read
+ *  at each address must be what BootPIF leaves there. Without a capture,
+ *  BootPIF's result is printed and nothing is checked. The CPU state is
+ *  printed for comparison with the host's.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Externs.h"
+#include "FileMap.h"
+#include "PIFBoot.h"
+#include "SICapture.h"
+#include "StubBus.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <string.h>
+#endif
+
+/* Bus functions exported by the library. */
+int PIFRAMReadByte(void *, uint32_t, void *);
+int PIFRAMReadHWord(void *, uint32_t, void *);
+int PIFRAMReadWord(void *, uint32_t, void *);
+
+/* ============================================================================
+ *  CheckBootCapture: Compares the IPL's reads in a capture with the PIF.
+ *
+ *  Returns the number of mismatches, or -1 if the capture holds no read
+ *  of the seed (it was not started before the boot, or is not a log).
+ * ========================================================================= */
+static int
+CheckBootCapture(struct PIFController *controller, const struct FileMap *map) {
+  struct SICaptureEvent reads[PIF_RAM_ADDRESS_LEN];
+  const uint8_t *cursor, *end = map->base + map->size;
+  struct SICaptureEvent event;
+
+  uint32_t offset, value;
+  int mismatches = 0;
+  unsigned i;
+
+  if (map->size < SI_CAPTURE_HEADER_SIZE ||
+    memcmp(map->base, "PIFS", 4) || map->base[4] != SI_CAPTURE_VERSION) {
+    fprintf(stderr, "Not an SI capture, or an unsupported version.\n");
+    return -1;
+  }
+
+  memset(reads, 0, sizeof(reads));
+  cursor = map->base + SI_CAPTURE_HEADER_SIZE;
+
+  /* Earlier polls may predate the seed; only the last one counts. */
+  while (DecodeSICaptureEvent(&cursor, end, &event) == 0 &&
+    event.type == SI_CAPTURE_RAM_READ) {
+    offset = event.address - PIF_RAM_BASE_ADDRESS;
+
+    if (offset < PIF_RAM_ADDRESS_LEN)
+      reads[offset] = event;
+  }
+
+  if (reads[0x24].type != SI_CAPTURE_RAM_READ) {
+    fprintf(stderr, "The capture holds no read of the CIC seed.\n");
+    return -1;
+  }
+
+  for (i = 0; i < PIF_RAM_ADDRESS_LEN; i++) {
+    if (reads[i].type != SI_CAPTURE_RAM_READ)
+      continue;
+
+    value = 0;
+
+    switch (reads[i].size) {
+      case 1:
+        PIFRAMReadByte(controller, reads[i].address, &value);
+        value &= 0xFF;
+        break;
+
+      case 2:
+        PIFRAMReadHWord(controller, reads[i].address, &value);
+        value &= 0xFFFF;
+        break;
+
+      default:
+        PIFRAMReadWord(controller, reads[i].address, &value);
+        break;
+    }
+
+    printf("read 0x%.2X: captured=0x%.8X booted=0x%.8X%s\n", i,
+      reads[i].value, value, reads[i].value != value ? " MISMATCH" : "");
+
+    if (reads[i].value != value)
+      mismatches++;
+  }
+
+  return mismatches;
+}
+
+/* ============================================================================
+ *  main: Boots a cartridge and checks the PIF's state against a capture.
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  struct PIFController *controller;
+  struct PIFBootState state;
+  struct FileMap cart, capture;
+
+  uint64_t start, elapsed;
+  int status, mismatches;
+  unsigned i;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <cartridge> [capture]\n", argv[0]);
+    return 1;
+  }
+
+  if (OpenFileMap(&cart, argv[1], 0, FILEMAP_READ_ONLY)) {
+    fprintf(stderr, "Failed to open the cartridge image.\n");
+    return 1;
+  }
+
+  if ((controller = CreateStubPIF(NULL)) == NULL) {
+    fprintf(stderr, "Failed to create the PIF.\n");
+    return 1;
+  }
+
+  start = PIFMonotonicTime();
+  status = BootPIF(controller, cart.base, cart.size, PIF_TV_NTSC, &state);
+  elapsed = PIFMonotonicTime() - start;
+
+  printf("cic=%s seed=0x%.8X status=0x%.2X boot_ns=%lu\n",
+    GetPIFCICName(state.cic), state.seed, controller->status,
+    (unsigned long) elapsed);
+
+  if (status) {
+    fprintf(stderr, "Boot code not recognised; nothing to check.\n");
+    return 1;
+  }
+
+  printf("pc=0x%.16llX cp0_status=0x%.8X cp0_config=0x%.8X "
+    "dmem_offset=0x%X imem_words=%u\n", (unsigned long long) state.pc,
+    state.cp0Status, state.cp0Config, state.dmemOffset, state.imemWords);
+
+  for (i = 0; i < 32; i++) {
+    if (state.gpr[i]) {
+      printf("gpr%u=0x%.16llX\n", i,
+        (unsigned long long) state.gpr[i]);
+    }
+  }
+
+  if (argc > 2) {
+    if (OpenFileMap(&capture, argv[2], 0, FILEMAP_READ_ONLY)) {
+      fprintf(stderr, "Failed to open the capture.\n");
+      return 1;
+    }
+
+    mismatches = CheckBootCapture(controller, &capture);
+    CloseFileMap(&capture);
+
+    if (mismatches < 0)
+      status = 1;
+
+    else {
+      printf("pif_ram=%s\n", mismatches ? "MISMATCH" : "match");
+      status = mismatches ? 1 : 0;
+    }
+  }
+
+  DestroyPIF(controller);
+  CloseFileMap(&cart);
+  return status;
+}
+
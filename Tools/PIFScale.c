@@ -0,0 +1,241 @@
+/* ============================================================================
+ *  PIFScale.c: Runs one PIF per thread and reports how throughput scales.
+ *
+ *  Each thread owns a controller, its input and its own DRAM, and polls
+ *  all four ports with input that changes every poll, so every block is
+ *  run for real. Instances share nothing but the ROM image; anything that
+ *  keeps efficiency well below 1 on idle cores is false sharing or a
+ *  lock. Results are "key=value" lines, as with PIFBench.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Externs.h"
+#include "HeadlessInput.h"
+#include "StubBus.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* Bus functions exported by the library. */
+void ConnectPIFToBus(struct PIFController *, struct BusController *);
+int SIRegWrite(void *, uint32_t, void *);
+
+/* Every instance gets a small DRAM of its own. */
+#define SCALE_DRAM_SIZE           0x1000
+
+#define SCALE_FORMAT_VERSION      1
+#define SCALE_MAX_THREADS         64
+
+struct ScaleRun {
+  struct PIFMutex lock;
+  struct PIFCond ready;
+  struct PIFCond go;
+  unsigned numReady;
+  unsigned numFailed;
+  bool started;
+
+  unsigned long iterations;
+  const char *romPath;
+};
+
+struct ScaleThread {
+  struct ScaleRun *run;
+  struct PIFThread thread;
+  uint64_t finish;
+};
+
+static void *ScaleThreadMain(void *);
+
+/* ============================================================================
+ *  RunScale: Times iterations polls on each of numThreads instances.
+ *
+ *  Returns the wall time from the moment every instance is ready until
+ *  the last one finishes, or 0 if any of them could not be set up.
+ * ========================================================================= */
+static uint64_t
+RunScale(const char *romPath, unsigned numThreads, unsigned long iterations) {
+  struct ScaleThread threads[SCALE_MAX_THREADS];
+  struct ScaleRun run;
+  uint64_t start, finish = 0;
+  unsigned i, started;
+
+  memset(&run, 0, sizeof(run));
+  run.iterations = iterations;
+  run.romPath = romPath;
+
+  InitPIFMutex(&run.lock);
+  InitPIFCond(&run.ready);
+  InitPIFCond(&run.go);
+
+  for (started = 0; started < numThreads; started++) {
+    threads[started].run = &run;
+
+    if (StartPIFThread(&threads[started].thread, ScaleThreadMain,
+      threads + started))
+      break;
+  }
+
+  /* Start every thread's clock at once. */
+  LockPIFMutex(&run.lock);
+
+  while (run.numReady < started)
+    WaitPIFCond(&run.ready, &run.lock);
+
+  start = PIFMonotonicTime();
+  run.started = true;
+  BroadcastPIFCond(&run.go);
+  UnlockPIFMutex(&run.lock);
+
+  for (i = 0; i < started; i++) {
+    JoinPIFThread(&threads[i].thread);
+
+    if (threads[i].finish > finish)
+      finish = threads[i].finish;
+  }
+
+  DestroyPIFCond(&run.go);
+  DestroyPIFCond(&run.ready);
+  DestroyPIFMutex(&run.lock);
+
+  return started == numThreads && !run.numFailed ? finish - start : 0;
+}
+
+/* ============================================================================
+ *  ScaleThreadMain: Sets up an instance, then polls it until done.
+ * ========================================================================= */
+static void *
+ScaleThreadMain(void *opaque) {
+  struct ScaleThread *thread = (struct ScaleThread *) opaque;
+  struct ScaleRun *run = thread->run;
+  struct PIFController *controller;
+  struct HeadlessInput *input;
+  struct BusController bus;
+  int busStatus;
+
+  uint8_t block[PIF_RAM_ADDRESS_LEN];
+  uint32_t zero = 0;
+  unsigned long i;
+
+  controller = CreatePIF(run->romPath);
+  input = CreateHeadlessInput();
+  busStatus = InitStubBus(&bus, SCALE_DRAM_SIZE);
+
+  LockPIFMutex(&run->lock);
+
+  if (controller == NULL || input == NULL || busStatus) {
+    run->numFailed++;
+    run->iterations = 0;
+  }
+
+  run->numReady++;
+  SignalPIFCond(&run->ready);
+
+  while (!run->started)
+    WaitPIFCond(&run->go, &run->lock);
+
+  UnlockPIFMutex(&run->lock);
+
+  if (controller && input && !busStatus) {
+    ConnectPIFToBus(controller, &bus);
+    AttachHeadlessInput(controller, input, 0xF);
+    BuildPollBlock(block, 0xF);
+
+    for (i = 0; i < run->iterations; i++) {
+      SetHeadlessInput(input, i & 3, (uint16_t) i, (int8_t) i, 0);
+      memcpy(bus.dram, block, sizeof(block));
+
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_DRAM_ADDR_REG, &zero);
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_PIF_ADDR_WR64B_REG, &zero);
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_DRAM_ADDR_REG, &zero);
+      SIRegWrite(controller, SI_REGS_BASE_ADDRESS +
+        4 * SI_PIF_ADDR_RD64B_REG, &zero);
+    }
+  }
+
+  thread->finish = PIFMonotonicTime();
+
+  if (controller)
+    DestroyPIF(controller);
+
+  if (input)
+    DestroyHeadlessInput(input);
+
+  DestroyStubBus(&bus);
+  return NULL;
+}
+
+/* ============================================================================
+ *  main: Runs 1, 2, 4, ... threads, up to the processor count (or given).
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  unsigned maxThreads = argc > 2 ? (unsigned) strtoul(argv[2], NULL, 0) :
+    CountPIFProcessors();
+
+  char romPath[STUB_ROM_PATH_LEN];
+  double baseline = 0.0;
+  unsigned numThreads;
+
+  if (!iterations || !maxThreads || maxThreads > SCALE_MAX_THREADS) {
+    fprintf(stderr, "Usage: %s [iterations] [max threads, up to %u]\n",
+      argv[0], SCALE_MAX_THREADS);
+    return 1;
+  }
+
+  if (CreateBlankPIFROM(romPath)) {
+    fprintf(stderr, "Failed to write the PIF ROM.\n");
+    return 1;
+  }
+
+  printf("suite=libpif_scale format=%u processors=%u\n",
+    SCALE_FORMAT_VERSION, CountPIFProcessors());
+
+  for (numThreads = 1; ; numThreads = numThreads * 2 < maxThreads ?
+    numThreads * 2 : maxThreads) {
+    uint64_t elapsed = RunScale(romPath, numThreads, iterations);
+    double opsPerSecond;
+
+    if (elapsed == 0) {
+      fprintf(stderr, "Failed to set up %u instances.\n", numThreads);
+      remove(romPath);
+      return 1;
+    }
+
+    opsPerSecond = (double) iterations * numThreads * 1e9 / elapsed;
+
+    if (numThreads == 1)
+      baseline = opsPerSecond;
+
+    printf("bench=scale threads=%u iterations=%lu ns_per_op=%.2f "
+      "ops_per_sec=%.0f speedup=%.2f efficiency=%.2f\n", numThreads,
+      iterations, (double) elapsed / iterations, opsPerSecond,
+      opsPerSecond / baseline, opsPerSecond / baseline / numThreads);
+
+    if (numThreads == maxThreads)
+      break;
+  }
+
+  remove(romPath);
+  return 0;
+}
+
@@ -0,0 +1,129 @@
+/* ============================================================================
+ *  PIFTraceDump.c: Prints a trace file written by WritePIFTrace.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "FileMap.h"
+#include "PIFTrace.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  PrintTraceRecord: Prints one record; times are relative to the first.
+ * ========================================================================= */
+static void
+PrintTraceRecord(const struct PIFTraceRecord *record, uint64_t base) {
+  uint32_t value = record->value;
+  char access[16];
+  unsigned reg;
+
+  printf("%10u %12.3f ", record->sequence,
+    (record->time - base) / 1000.0);
+
+  switch (record->event) {
+  case PIF_TRACE_REG_READ:
+  case PIF_TRACE_REG_WRITE:
+    reg = (record->address - SI_REGS_BASE_ADDRESS) / 4;
+
+    printf("SI     %-5s %-22s 0x%.8X\n",
+      record->event == PIF_TRACE_REG_READ ? "read" : "write",
+      reg < NUM_SI_REGISTERS ? SIRegisterMnemonics[reg] : "?", value);
+    break;
+
+  case PIF_TRACE_DMA_TO_PIF:
+    printf("DMA    DRAM [0x%.8X] -> PIF RAM (%u bytes)\n",
+      record->address, record->size);
+    break;
+
+  case PIF_TRACE_DMA_FROM_PIF:
+    printf("DMA    PIF RAM -> DRAM [0x%.8X] (%u bytes)\n",
+      record->address, record->size);
+    break;
+
+  case PIF_TRACE_RAM_READ:
+  case PIF_TRACE_RAM_WRITE:
+    sprintf(access, "%s%u", record->event == PIF_TRACE_RAM_READ ?
+      "read" : "write", (record->size & 0x7) * 8);
+
+    printf("RAM    %-7s [0x%.8X] 0x%.*X\n", access,
+      record->address, record->size * 2, value);
+    break;
+
+  case PIF_TRACE_COMMAND:
+    printf("JOYBUS channel %u command 0x%.2X send %u recv %u%s\n",
+      record->address, value & 0xFF, (value >> 8) & 0xFF,
+      (value >> 16) & 0xFF, value & (1 << 24) ? " (no response)" : "");
+    break;
+
+  default:
+    printf("?      event %u [0x%.8X] 0x%.8X\n",
+      record->event, record->address, value);
+    break;
+  }
+}
+
+/* ============================================================================
+ *  main: Decodes and prints every record in a trace file.
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  const struct PIFTraceRecord *records;
+  uint32_t count, dropped, i;
+  struct FileMap map;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <trace>\n", argv[0]);
+    return 1;
+  }
+
+  if (OpenFileMap(&map, argv[1], 0, FILEMAP_READ_ONLY)) {
+    fprintf(stderr, "Failed to open the trace.\n");
+    return 1;
+  }
+
+  if (map.size < PIF_TRACE_HEADER_SIZE || memcmp(map.base, "PIFT", 4) ||
+    map.base[4] != PIF_TRACE_VERSION ||
+    map.base[5] != sizeof(struct PIFTraceRecord)) {
+    fprintf(stderr, "Not a trace, or from an incompatible build.\n");
+
+    CloseFileMap(&map);
+    return 1;
+  }
+
+  memcpy(&count, map.base + 8, sizeof(count));
+  memcpy(&dropped, map.base + 12, sizeof(dropped));
+
+  if ((map.size - PIF_TRACE_HEADER_SIZE) / sizeof(*records) < count) {
+    fprintf(stderr, "Trace is truncated.\n");
+
+    CloseFileMap(&map);
+    return 1;
+  }
+
+  records = (const struct PIFTraceRecord *)
+    (map.base + PIF_TRACE_HEADER_SIZE);
+
+  printf("# %u records (%u older ones were overwritten)\n", count, dropped);
+  printf("# %8s %12s event\n", "sequence", "time (us)");
+
+  for (i = 0; i < count; i++)
+    PrintTraceRecord(records + i, records[0].time);
+
+  CloseFileMap(&map);
+  return 0;
+}
+
@@ -0,0 +1,238 @@
+/* ============================================================================
+ *  SIReplay.c: Replays a captured SI log against the PIF, as fast as it can.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Externs.h"
+#include "FileMap.h"
+#include "HeadlessInput.h"
+#include "SICapture.h"
+#include "StubBus.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* Bus functions exported by the library. */
+int PIFRAMReadByte(void *, uint32_t, void *);
+int PIFRAMReadHWord(void *, uint32_t, void *);
+int PIFRAMReadWord(void *, uint32_t, void *);
+int PIFRAMWriteByte(void *, uint32_t, void *);
+int PIFRAMWriteHWord(void *, uint32_t, void *);
+int PIFRAMWriteWord(void *, uint32_t, void *);
+int SIRegWrite(void *, uint32_t, void *);
+
+/* Enough DRAM for any SI_DRAM_ADDR. */
+#define REPLAY_DRAM_SIZE          0x800000
+
+/* ============================================================================
+ *  A log, decoded up front so replay only measures the PIF.
+ * ========================================================================= */
+struct ReplayLog {
+  struct SICaptureEvent *events;
+  size_t count;
+
+  uint64_t transactions;
+  uint8_t channels;
+};
+
+/* ============================================================================
+ *  LoadReplayLog: Decodes every event in a mapped log.
+ * ========================================================================= */
+static int
+LoadReplayLog(struct ReplayLog *log, const struct FileMap *map) {
+  const uint8_t *cursor, *end = map->base + map->size;
+  struct SICaptureEvent event;
+  size_t capacity = 0;
+  int status;
+
+  memset(log, 0, sizeof(*log));
+
+  if (map->size < SI_CAPTURE_HEADER_SIZE ||
+    memcmp(map->base, "PIFS", 4) || map->base[4] != SI_CAPTURE_VERSION) {
+    fprintf(stderr, "Not an SI capture, or an unsupported version.\n");
+    return -1;
+  }
+
+  log->channels = map->base[5] & 0xF;
+  cursor = map->base + SI_CAPTURE_HEADER_SIZE;
+
+  while ((status = DecodeSICaptureEvent(&cursor, end, &event)) == 0) {
+    if (log->count == capacity) {
+      struct SICaptureEvent *events;
+
+      capacity = capacity ? capacity * 2 : 4096;
+
+      if ((events = (struct SICaptureEvent *) realloc(log->events,
+        capacity * sizeof(*events))) == NULL) {
+        free(log->events);
+        return -1;
+      }
+
+      log->events = events;
+    }
+
+    if (event.type == SI_CAPTURE_REG_WRITE && event.address ==
+      SI_REGS_BASE_ADDRESS + 4 * SI_PIF_ADDR_RD64B_REG)
+      log->transactions++;
+
+    log->events[log->count++] = event;
+  }
+
+  if (status < 0) {
+    fprintf(stderr, "Log is corrupt after %lu events.\n",
+      (unsigned long) log->count);
+
+    free(log->events);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ============================================================================
+ *  ReplayEvents: Runs a log once; counts responses that differ if asked.
+ *
+ *  A DMA into PIF RAM is replayed by placing the captured block in DRAM
+ *  before the register write that starts it. Responses only match the
+ *  capture when the inputs and save media do too.
+ * ========================================================================= */
+static void
+ReplayEvents(struct PIFController *controller,
+  const struct ReplayLog *log, uint64_t *mismatches) {
+  const uint8_t *expected = NULL;
+  uint32_t target = 0;
+  size_t i;
+
+  for (i = 0; i < log->count; i++) {
+    const struct SICaptureEvent *event = log->events + i;
+    uint32_t value = event->value;
+    uint16_t hword = value;
+    uint8_t byte = value;
+
+    switch (event->type) {
+    case SI_CAPTURE_REG_WRITE:
+      SIRegWrite(controller, event->address, &value);
+
+      if (expected && mismatches) {
+        *mismatches += memcmp(StubBus.dram + target,
+          expected, PIF_RAM_ADDRESS_LEN) != 0;
+      }
+
+      expected = NULL;
+      break;
+
+    case SI_CAPTURE_DMA_WRITE:
+      memcpy(StubBus.dram + (value & (REPLAY_DRAM_SIZE - 1)),
+        event->block, PIF_RAM_ADDRESS_LEN);
+      break;
+
+    case SI_CAPTURE_DMA_READ:
+      target = value & (REPLAY_DRAM_SIZE - 1);
+      expected = event->block;
+      break;
+
+    case SI_CAPTURE_RAM_READ:
+      if (event->size == 1)
+        PIFRAMReadByte(controller, event->address, &byte);
+      else if (event->size == 2)
+        PIFRAMReadHWord(controller, event->address, &hword);
+      else
+        PIFRAMReadWord(controller, event->address, &value);
+
+      break;
+
+    case SI_CAPTURE_RAM_WRITE:
+      if (event->size == 1)
+        PIFRAMWriteByte(controller, event->address, &byte);
+      else if (event->size == 2)
+        PIFRAMWriteHWord(controller, event->address, &hword);
+      else
+        PIFRAMWriteWord(controller, event->address, &value);
+
+      break;
+    }
+  }
+}
+
+/* ============================================================================
+ *  main: Verifies a log against the PIF once, then times repeated replays.
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  struct PIFController *controller;
+  struct HeadlessInput *input;
+  struct ReplayLog log;
+  struct FileMap map;
+
+  uint64_t mismatches = 0, start, elapsed;
+  unsigned long passes, i;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <log> [passes] [pifrom]\n", argv[0]);
+    return 1;
+  }
+
+  passes = argc > 2 ? strtoul(argv[2], NULL, 0) : 100;
+
+  if (OpenFileMap(&map, argv[1], 0, FILEMAP_READ_ONLY)) {
+    fprintf(stderr, "Failed to open the log.\n");
+    return 1;
+  }
+
+  if (LoadReplayLog(&log, &map)) {
+    CloseFileMap(&map);
+    return 1;
+  }
+
+  if (InitStubBus(&StubBus, REPLAY_DRAM_SIZE) ||
+    (controller = CreateStubPIF(argc > 3 ? argv[3] : NULL)) == NULL ||
+    (input = CreateHeadlessInput()) == NULL) {
+    fprintf(stderr, "Failed to set up the PIF.\n");
+    return 1;
+  }
+
+  /* Idle controllers stand in for whatever was plugged in. */
+  AttachHeadlessInput(controller, input, log.channels);
+
+  ReplayEvents(controller, &log, &mismatches);
+  start = PIFMonotonicTime();
+
+  for (i = 0; i < passes; i++)
+    ReplayEvents(controller, &log, NULL);
+
+  elapsed = PIFMonotonicTime() - start;
+
+  printf("events=%lu transactions=%lu mismatches=%lu\n",
+    (unsigned long) log.count, (unsigned long) log.transactions,
+    (unsigned long) mismatches);
+
+  if (passes && log.transactions && elapsed) {
+    printf("passes=%lu ns_per_transaction=%.1f transactions_per_sec=%.0f\n",
+      passes, (double) elapsed / (passes * log.transactions),
+      passes * log.transactions * 1e9 / elapsed);
+  }
+
+  DestroyPIF(controller);
+  DestroyHeadlessInput(input);
+  CloseFileMap(&map);
+  free(log.events);
+  DestroyStubBus(&StubBus);
+  return 0;
+}
+
@@ -0,0 +1,84 @@
+/* ============================================================================
+ *  SaveArchiveTool.c: Inspects and compacts save archives.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#include "Common.h"
+#include "SaveArchive.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* ============================================================================
+ *  PrintStats: Prints index and data usage of an archive.
+ * ========================================================================= */
+static int
+PrintStats(const char *path) {
+  struct SaveArchiveStats stats;
+  struct SaveArchive *archive;
+  FILE *probe;
+
+  /* OpenSaveArchive would create a missing archive. */
+  if ((probe = fopen(path, "rb")) == NULL) {
+    fprintf(stderr, "Cannot open '%s'.\n", path);
+    return 1;
+  }
+
+  fclose(probe);
+
+  if ((archive = OpenSaveArchive(path, 0)) == NULL) {
+    fprintf(stderr, "'%s' is not a save archive.\n", path);
+    return 1;
+  }
+
+  GetSaveArchiveStats(archive, &stats);
+  CloseSaveArchive(archive);
+
+  printf("slots: %u/%u\n", stats.slotsUsed, stats.slotCapacity);
+  printf("blobs: %u live, %u used, %u capacity\n",
+    stats.blobsLive, stats.blobsUsed, stats.blobCapacity);
+  printf("data:  %llu live, %llu used, %llu capacity\n",
+    (unsigned long long) stats.dataLive, (unsigned long long) stats.dataUsed,
+    (unsigned long long) stats.dataCapacity);
+
+  return 0;
+}
+
+/* ============================================================================
+ *  main: Parses the command line.
+ * ========================================================================= */
+int
+main(int argc, const char *argv[]) {
+  if (argc == 3 && !strcmp(argv[1], "stats"))
+    return PrintStats(argv[2]);
+
+  if ((argc == 4 || argc == 5) && !strcmp(argv[1], "compact")) {
+    unsigned slots = argc == 5 ? (unsigned) strtoul(argv[4], NULL, 0) : 0;
+
+    if (CompactSaveArchive(argv[2], argv[3], slots)) {
+      fprintf(stderr, "Failed to compact '%s'.\n", argv[2]);
+      return 1;
+    }
+
+    return PrintStats(argv[3]);
+  }
+
+  fprintf(stderr,
+    "Usage: %s stats <archive>\n"
+    "       %s compact <archive> <output> [slots]\n", argv[0], argv[0]);
+
+  return 1;
+}
+
@@ -0,0 +1,187 @@
+/* ============================================================================
+ *  StubBus.c: The stub bus and helpers shared by the tools.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "Address.h"
+#include "Common.h"
+#include "Controller.h"
+#include "Externs.h"
+#include "StubBus.h"
+#include "Thread.h"
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct BusController StubBus;
+
+void
+BusClearRCPInterrupt(struct BusController *bus, unsigned mask) {
+  (void) bus;
+  (void) mask;
+}
+
+void
+BusRaiseRCPInterrupt(struct BusController *bus, unsigned mask) {
+  (void) bus;
+  (void) mask;
+}
+
+void
+DMAFromDRAM(struct BusController *bus, void *dest,
+  uint32_t source, uint32_t length) {
+  if (bus == NULL)
+    bus = &StubBus;
+
+  if (bus->dram == NULL)
+    memset(dest, 0, length);
+  else
+    memcpy(dest, bus->dram + (source & (bus->size - 1)), length);
+}
+
+void
+DMAToDRAM(struct BusController *bus, uint32_t dest,
+  const void *source, size_t length) {
+  if (bus == NULL)
+    bus = &StubBus;
+
+  if (bus->dram)
+    memcpy(bus->dram + (dest & (bus->size - 1)), source, length);
+}
+
+/* ============================================================================
+ *  BuildPollBlock: Lays out a command block reading the given ports.
+ * ========================================================================= */
+void
+BuildPollBlock(uint8_t *block, unsigned channels) {
+  unsigned i, ptr = 0;
+
+  memset(block, 0, PIF_RAM_ADDRESS_LEN);
+
+  for (i = 0; i < PIF_NUM_CONTROLLERS; i++) {
+    if (channels & (1 << i)) {
+      block[ptr++] = 0x01;
+      block[ptr++] = 0x04;
+      block[ptr++] = 0x01;
+      memset(block + ptr, 0xFF, 4);
+      ptr += 4;
+    }
+
+    /* Skip the port. */
+    else
+      block[ptr++] = 0x00;
+  }
+
+  block[ptr] = 0xFE;
+  block[0x3F] = 0x01;
+}
+
+/* ============================================================================
+ *  CreateBlankPIFROM: Writes a blank PIF ROM to a new, unique file.
+ *
+ *  path must hold STUB_ROM_PATH_LEN bytes and receives the file's name;
+ *  the caller removes the file once it is done with it.
+ * ========================================================================= */
+int
+CreateBlankPIFROM(char *path) {
+  static const uint8_t rom[PIF_ROM_ADDRESS_LEN] = {0};
+  size_t written;
+  FILE *file;
+
+  memcpy(path, STUB_ROM_TEMPLATE, STUB_ROM_PATH_LEN);
+
+#ifdef _WIN32
+  if (_mktemp_s(path, STUB_ROM_PATH_LEN) ||
+    (file = fopen(path, "wb")) == NULL)
+    return -1;
+#else
+  {
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0)
+      return -1;
+
+    if ((file = fdopen(fd, "wb")) == NULL) {
+      close(fd);
+      remove(path);
+      return -1;
+    }
+  }
+#endif
+
+  written = fwrite(rom, 1, sizeof(rom), file);
+
+  if (fclose(file) || written != sizeof(rom)) {
+    remove(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ============================================================================
+ *  CreateStubPIF: Creates a controller from a PIF ROM, or a blank one.
+ * ========================================================================= */
+struct PIFController *
+CreateStubPIF(const char *romPath) {
+  struct PIFController *controller;
+  char path[STUB_ROM_PATH_LEN];
+
+  if (romPath)
+    return CreatePIF(romPath);
+
+  if (CreateBlankPIFROM(path))
+    return NULL;
+
+  controller = CreatePIF(path);
+  remove(path);
+  return controller;
+}
+
+/* ============================================================================
+ *  DestroyStubBus: Frees a stub bus's DRAM.
+ * ========================================================================= */
+void
+DestroyStubBus(struct BusController *bus) {
+  FreePIFAligned(bus->dram);
+  memset(bus, 0, sizeof(*bus));
+}
+
+/* ============================================================================
+ *  InitStubBus: Gives a stub bus size bytes (a power of two) of DRAM.
+ *
+ *  The DRAM starts on a cache line of its own, so buses used by
+ *  different threads never share one.
+ * ========================================================================= */
+int
+InitStubBus(struct BusController *bus, size_t size) {
+  if ((bus->dram = (uint8_t *) AllocPIFAligned(size)) == NULL)
+    return -1;
+
+  memset(bus->dram, 0, size);
+  bus->size = size;
+  return 0;
+}
+
@@ -0,0 +1,45 @@
+/* ============================================================================
+ *  StubBus.h: The stub bus and helpers shared by the tools.
+ *
+ *  PIFSIM: Peripheral InterFace SIMulator.
+ *  Copyright (C) 2013, Tyler J. Stachecki.
+ *  All rights reserved.
+ *
+ *  This file is subject to the terms and conditions defined in
+ *  file 'LICENSE', which is part of this source code package.
+ * ========================================================================= */
+#ifndef __PIF__STUBBUS_H__
+#define __PIF__STUBBUS_H__
+#include "Common.h"
+#include "Controller.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#else
+#include <stddef.h>
+#endif
+
+/* ============================================================================
+ *  A stub bus is DRAM and no interrupt controller. Addresses wrap around
+ *  its size (a power of two); without DRAM, DMAs read back zeroes and
+ *  writes go nowhere. Controllers never connected to a bus use StubBus.
+ * ========================================================================= */
+struct BusController {
+  uint8_t *dram;
+  size_t size;
+};
+
+/* Blank ROMs are written to the working directory under a unique name. */
+#define STUB_ROM_TEMPLATE         "PIFTool.rom.XXXXXX"
+#define STUB_ROM_PATH_LEN         sizeof(STUB_ROM_TEMPLATE)
+
+extern struct BusController StubBus;
+
+void BuildPollBlock(uint8_t *, unsigned);
+int CreateBlankPIFROM(char *);
+struct PIFController *CreateStubPIF(const char *);
+void DestroyStubBus(struct BusController *);
+int InitStubBus(struct BusController *, size_t);
+
+#endif
+